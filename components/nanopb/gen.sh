@@ -3,4 +3,5 @@ SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
 cd $SCRIPT_DIR/protobuf
 $SCRIPT_DIR/nanopb/generator/nanopb_generator.py lane.proto
 $SCRIPT_DIR/nanopb/generator/nanopb_generator.py ble.proto
+$SCRIPT_DIR/nanopb/generator/nanopb_generator.py diag.proto
 # $SCRIPT_DIR/nanopb/generator/nanopb_generator.py track_option.proto
@@ -21,6 +21,15 @@ PB_BIND(WhiteListResponse, WhiteListResponse, AUTO)
 PB_BIND(WhiteListRequest, WhiteListRequest, AUTO)
 
 
+PB_BIND(WhiteItemFixed, WhiteItemFixed, AUTO)
+
+
+PB_BIND(WhiteListFixed, WhiteListFixed, 2)
+
+
+PB_BIND(WhiteListRequestFixed, WhiteListRequestFixed, 2)
+
+
 
 
 
@@ -12,13 +12,20 @@
 /* Enum definitions */
 typedef enum _WhiteListCommand {
     /* response with list */
-    WhiteListCommand_REQUEST = 0
+    WhiteListCommand_REQUEST = 0,
+    /* remove all the items */
+    WhiteListCommand_CLEAR = 1
 } WhiteListCommand;
 
 typedef enum _WhiteListErrorCode {
     WhiteListErrorCode_OK = 0,
     WhiteListErrorCode_NULL = 1,
-    WhiteListErrorCode_OUT_OF_MEMORY = 2
+    WhiteListErrorCode_OUT_OF_MEMORY = 2,
+    /* the `version` of the request is not the current one.
+ the client should request the whole list again */
+    WhiteListErrorCode_VERSION_MISMATCH = 3,
+    /* nothing to remove, or the item to add exists already */
+    WhiteListErrorCode_NOT_CHANGED = 4
 } WhiteListErrorCode;
 
 /* Struct definitions */
@@ -39,12 +46,20 @@ typedef struct _WhiteListRequest {
     WhiteListCommand command;
     bool has_set;
     WhiteList set;
+    bool has_add;
+    WhiteItem add;
+    bool has_remove;
+    WhiteItem remove;
+    /* the version the change is based on. 0 to skip the check */
+    uint32_t version;
 } WhiteListRequest;
 
 typedef struct _WhiteListResponse {
     bool has_list;
     WhiteList list;
     WhiteListErrorCode code;
+    /* bumped by every change of the list */
+    uint32_t version;
 } WhiteListResponse;
 
 typedef struct _bluetooth_device_pb {
@@ -52,15 +67,40 @@ typedef struct _bluetooth_device_pb {
     char name[21];
 } bluetooth_device_pb;
 
+typedef PB_BYTES_ARRAY_T(6) WhiteItemFixed_mac_t;
+typedef struct _WhiteItemFixed {
+    pb_size_t which_item;
+    union {
+        char name[32];
+        WhiteItemFixed_mac_t mac;
+    } item;
+} WhiteItemFixed;
+
+typedef struct _WhiteListFixed {
+    pb_size_t items_count;
+    WhiteItemFixed items[16];
+} WhiteListFixed;
+
+typedef struct _WhiteListRequestFixed {
+    WhiteListCommand command;
+    bool has_set;
+    WhiteListFixed set;
+    bool has_add;
+    WhiteItemFixed add;
+    bool has_remove;
+    WhiteItemFixed remove;
+    uint32_t version;
+} WhiteListRequestFixed;
+
 
 /* Helper constants for enums */
 #define _WhiteListCommand_MIN WhiteListCommand_REQUEST
-#define _WhiteListCommand_MAX WhiteListCommand_REQUEST
-#define _WhiteListCommand_ARRAYSIZE ((WhiteListCommand)(WhiteListCommand_REQUEST+1))
+#define _WhiteListCommand_MAX WhiteListCommand_CLEAR
+#define _WhiteListCommand_ARRAYSIZE ((WhiteListCommand)(WhiteListCommand_CLEAR+1))
 
 #define _WhiteListErrorCode_MIN WhiteListErrorCode_OK
-#define _WhiteListErrorCode_MAX WhiteListErrorCode_OUT_OF_MEMORY
-#define _WhiteListErrorCode_ARRAYSIZE ((WhiteListErrorCode)(WhiteListErrorCode_OUT_OF_MEMORY+1))
+#define _WhiteListErrorCode_MAX WhiteListErrorCode_NOT_CHANGED
+#define _WhiteListErrorCode_ARRAYSIZE ((WhiteListErrorCode)(WhiteListErrorCode_NOT_CHANGED+1))
 
 
 #ifdef __cplusplus
@@ -71,13 +111,19 @@ extern "C" {
 #define WhiteItem_init_default                   {0, {{{NULL}, NULL}}}
 #define WhiteList_init_default                   {{{NULL}, NULL}}
 #define bluetooth_device_pb_init_default         {{{NULL}, NULL}, ""}
-#define WhiteListResponse_init_default           {false, WhiteList_init_default, _WhiteListErrorCode_MIN}
-#define WhiteListRequest_init_default            {_WhiteListCommand_MIN, false, WhiteList_init_default}
+#define WhiteListResponse_init_default           {false, WhiteList_init_default, _WhiteListErrorCode_MIN, 0}
+#define WhiteListRequest_init_default            {_WhiteListCommand_MIN, false, WhiteList_init_default, false, WhiteItem_init_default, false, WhiteItem_init_default, 0}
+#define WhiteItemFixed_init_default              {0, {""}}
+#define WhiteListFixed_init_default              {0, {WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default, WhiteItemFixed_init_default}}
+#define WhiteListRequestFixed_init_default       {_WhiteListCommand_MIN, false, WhiteListFixed_init_default, false, WhiteItemFixed_init_default, false, WhiteItemFixed_init_default, 0}
 #define WhiteItem_init_zero                      {0, {{{NULL}, NULL}}}
 #define WhiteList_init_zero                      {{{NULL}, NULL}}
 #define bluetooth_device_pb_init_zero            {{{NULL}, NULL}, ""}
-#define WhiteListResponse_init_zero              {false, WhiteList_init_zero, _WhiteListErrorCode_MIN}
-#define WhiteListRequest_init_zero               {_WhiteListCommand_MIN, false, WhiteList_init_zero}
+#define WhiteListResponse_init_zero              {false, WhiteList_init_zero, _WhiteListErrorCode_MIN, 0}
+#define WhiteListRequest_init_zero               {_WhiteListCommand_MIN, false, WhiteList_init_zero, false, WhiteItem_init_zero, false, WhiteItem_init_zero, 0}
+#define WhiteItemFixed_init_zero                 {0, {""}}
+#define WhiteListFixed_init_zero                 {0, {WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero, WhiteItemFixed_init_zero}}
+#define WhiteListRequestFixed_init_zero          {_WhiteListCommand_MIN, false, WhiteListFixed_init_zero, false, WhiteItemFixed_init_zero, false, WhiteItemFixed_init_zero, 0}
 
 /* Field tags (for use in manual encoding/decoding) */
 #define WhiteItem_name_tag                       1
@@ -85,10 +131,22 @@ extern "C" {
 #define WhiteList_items_tag                      1
 #define WhiteListRequest_command_tag             1
 #define WhiteListRequest_set_tag                 2
+#define WhiteListRequest_add_tag                 3
+#define WhiteListRequest_remove_tag              4
+#define WhiteListRequest_version_tag             5
 #define WhiteListResponse_list_tag               1
 #define WhiteListResponse_code_tag               2
+#define WhiteListResponse_version_tag            3
 #define bluetooth_device_pb_mac_tag              1
 #define bluetooth_device_pb_name_tag             2
+#define WhiteItemFixed_name_tag                  1
+#define WhiteItemFixed_mac_tag                   2
+#define WhiteListFixed_items_tag                 1
+#define WhiteListRequestFixed_command_tag        1
+#define WhiteListRequestFixed_set_tag            2
+#define WhiteListRequestFixed_add_tag            3
+#define WhiteListRequestFixed_remove_tag         4
+#define WhiteListRequestFixed_version_tag        5
 
 /* Struct field encoding specification for nanopb */
 #define WhiteItem_FIELDLIST(X, a) \
@@ -111,23 +169,56 @@ X(a, STATIC,   SINGULAR, STRING,   name,              2)
 
 #define WhiteListResponse_FIELDLIST(X, a) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  list,              1) \
-X(a, STATIC,   SINGULAR, UENUM,    code,              2)
+X(a, STATIC,   SINGULAR, UENUM,    code,              2) \
+X(a, STATIC,   SINGULAR, UINT32,   version,           3)
 #define WhiteListResponse_CALLBACK NULL
 #define WhiteListResponse_DEFAULT NULL
 #define WhiteListResponse_list_MSGTYPE WhiteList
 
 #define WhiteListRequest_FIELDLIST(X, a) \
 X(a, STATIC,   SINGULAR, UENUM,    command,           1) \
-X(a, STATIC,   OPTIONAL, MESSAGE,  set,               2)
+X(a, STATIC,   OPTIONAL, MESSAGE,  set,               2) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  add,               3) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  remove,            4) \
+X(a, STATIC,   SINGULAR, UINT32,   version,           5)
 #define WhiteListRequest_CALLBACK NULL
 #define WhiteListRequest_DEFAULT NULL
 #define WhiteListRequest_set_MSGTYPE WhiteList
+#define WhiteListRequest_add_MSGTYPE WhiteItem
+#define WhiteListRequest_remove_MSGTYPE WhiteItem
+
+#define WhiteItemFixed_FIELDLIST(X, a) \
+X(a, STATIC,   ONEOF,    STRING,   (item,name,item.name),   1) \
+X(a, STATIC,   ONEOF,    BYTES,    (item,mac,item.mac),   2)
+#define WhiteItemFixed_CALLBACK NULL
+#define WhiteItemFixed_DEFAULT NULL
+
+#define WhiteListFixed_FIELDLIST(X, a) \
+X(a, STATIC,   REPEATED, MESSAGE,  items,             1)
+#define WhiteListFixed_CALLBACK NULL
+#define WhiteListFixed_DEFAULT NULL
+#define WhiteListFixed_items_MSGTYPE WhiteItemFixed
+
+#define WhiteListRequestFixed_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UENUM,    command,           1) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  set,               2) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  add,               3) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  remove,            4) \
+X(a, STATIC,   SINGULAR, UINT32,   version,           5)
+#define WhiteListRequestFixed_CALLBACK NULL
+#define WhiteListRequestFixed_DEFAULT NULL
+#define WhiteListRequestFixed_set_MSGTYPE WhiteListFixed
+#define WhiteListRequestFixed_add_MSGTYPE WhiteItemFixed
+#define WhiteListRequestFixed_remove_MSGTYPE WhiteItemFixed
 
 extern const pb_msgdesc_t WhiteItem_msg;
 extern const pb_msgdesc_t WhiteList_msg;
 extern const pb_msgdesc_t bluetooth_device_pb_msg;
 extern const pb_msgdesc_t WhiteListResponse_msg;
 extern const pb_msgdesc_t WhiteListRequest_msg;
+extern const pb_msgdesc_t WhiteItemFixed_msg;
+extern const pb_msgdesc_t WhiteListFixed_msg;
+extern const pb_msgdesc_t WhiteListRequestFixed_msg;
 
 /* Defines for backwards compatibility with code written before nanopb-0.4.0 */
 #define WhiteItem_fields &WhiteItem_msg
@@ -135,6 +226,9 @@ extern const pb_msgdesc_t WhiteListRequest_msg;
 #define bluetooth_device_pb_fields &bluetooth_device_pb_msg
 #define WhiteListResponse_fields &WhiteListResponse_msg
 #define WhiteListRequest_fields &WhiteListRequest_msg
+#define WhiteItemFixed_fields &WhiteItemFixed_msg
+#define WhiteListFixed_fields &WhiteListFixed_msg
+#define WhiteListRequestFixed_fields &WhiteListRequestFixed_msg
 
 /* Maximum encoded size of messages (where known) */
 /* WhiteItem_size depends on runtime parameters */
@@ -142,6 +236,9 @@ extern const pb_msgdesc_t WhiteListRequest_msg;
 /* bluetooth_device_pb_size depends on runtime parameters */
 /* WhiteListResponse_size depends on runtime parameters */
 /* WhiteListRequest_size depends on runtime parameters */
+#define WhiteItemFixed_size                      33
+#define WhiteListFixed_size                      560
+#define WhiteListRequestFixed_size               641
 
 #ifdef __cplusplus
 } /* extern "C" */
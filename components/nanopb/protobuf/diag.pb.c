@@ -0,0 +1,15 @@
+/* Automatically generated nanopb constant definitions */
+/* Generated by nanopb-0.4.7-dev */
+
+#include "diag.pb.h"
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+PB_BIND(Histogram, Histogram, 2)
+
+
+PB_BIND(Metrics, Metrics, AUTO)
+
+
+
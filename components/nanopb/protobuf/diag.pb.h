@@ -0,0 +1,143 @@
+/* Automatically generated nanopb header */
+/* Generated by nanopb-0.4.7-dev */
+
+#ifndef PB_DIAG_PB_H_INCLUDED
+#define PB_DIAG_PB_H_INCLUDED
+#include <pb.h>
+
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+/* Struct definitions */
+/* fixed bucket histogram */
+typedef struct _Histogram {
+    /* the upper bounds (inclusive) of the buckets, ascending */
+    pb_size_t bounds_count;
+    uint32_t bounds[8];
+    /* one more than `bounds`. the last one counts the samples above all the bounds */
+    pb_size_t counts_count;
+    uint32_t counts[9];
+    uint32_t sum;
+    uint32_t max;
+} Histogram;
+
+/* the runtime metrics since boot. the counters wrap around
+ go through Metrics Characteristic via Read */
+typedef struct _Metrics {
+    uint32_t uptime_ms;
+    /* lane */
+    uint32_t frames;
+    /* the frame boundaries skipped since the frame is not ready in time */
+    uint32_t frame_misses;
+    /* `iterate` and `show` of a frame, in us */
+    bool has_frame_us;
+    Histogram frame_us;
+    /* LoRa */
+    uint32_t rx_packets;
+    /* could not be read, or unknown magic */
+    uint32_t rx_dropped;
+    /* known magic but failed to unmarshal */
+    uint32_t rx_malformed;
+    uint32_t tx_packets;
+    uint32_t tx_failed;
+    /* the time spent in `transmit` of the successful packets */
+    uint32_t tx_airtime_us;
+    /* HR characteristic */
+    uint32_t hr_notify_sent;
+    uint32_t hr_notify_failed;
+    /* BLE scan, after the deduplication */
+    uint32_t scan_results;
+    /* of the last whole second */
+    uint32_t scan_results_per_sec;
+    /* the level of the QoS governor, 0 is the full quality */
+    uint32_t qos_level;
+    /* HR notifications skipped by the QoS governor */
+    uint32_t hr_notify_skipped;
+    /* how late `show` starts after the frame boundary, in us */
+    bool has_frame_jitter_us;
+    Histogram frame_jitter_us;
+} Metrics;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initializer values for message structs */
+#define Histogram_init_default                   {0, {0, 0, 0, 0, 0, 0, 0, 0}, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0}, 0, 0}
+#define Metrics_init_default                     {0, 0, 0, false, Histogram_init_default, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, false, Histogram_init_default}
+#define Histogram_init_zero                      {0, {0, 0, 0, 0, 0, 0, 0, 0}, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0}, 0, 0}
+#define Metrics_init_zero                        {0, 0, 0, false, Histogram_init_zero, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, false, Histogram_init_zero}
+
+/* Field tags (for use in manual encoding/decoding) */
+#define Histogram_bounds_tag                     1
+#define Histogram_counts_tag                     2
+#define Histogram_sum_tag                        3
+#define Histogram_max_tag                        4
+#define Metrics_uptime_ms_tag                    1
+#define Metrics_frames_tag                       2
+#define Metrics_frame_misses_tag                 3
+#define Metrics_frame_us_tag                     4
+#define Metrics_rx_packets_tag                   5
+#define Metrics_rx_dropped_tag                   6
+#define Metrics_rx_malformed_tag                 7
+#define Metrics_tx_packets_tag                   8
+#define Metrics_tx_failed_tag                    9
+#define Metrics_tx_airtime_us_tag                10
+#define Metrics_hr_notify_sent_tag               11
+#define Metrics_hr_notify_failed_tag             12
+#define Metrics_scan_results_tag                 13
+#define Metrics_scan_results_per_sec_tag         14
+#define Metrics_qos_level_tag                    15
+#define Metrics_hr_notify_skipped_tag            16
+#define Metrics_frame_jitter_us_tag              17
+
+/* Struct field encoding specification for nanopb */
+#define Histogram_FIELDLIST(X, a) \
+X(a, STATIC,   REPEATED, UINT32,   bounds,            1) \
+X(a, STATIC,   REPEATED, UINT32,   counts,            2) \
+X(a, STATIC,   SINGULAR, UINT32,   sum,               3) \
+X(a, STATIC,   SINGULAR, UINT32,   max,               4)
+#define Histogram_CALLBACK NULL
+#define Histogram_DEFAULT NULL
+
+#define Metrics_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   uptime_ms,         1) \
+X(a, STATIC,   SINGULAR, UINT32,   frames,            2) \
+X(a, STATIC,   SINGULAR, UINT32,   frame_misses,      3) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  frame_us,          4) \
+X(a, STATIC,   SINGULAR, UINT32,   rx_packets,        5) \
+X(a, STATIC,   SINGULAR, UINT32,   rx_dropped,        6) \
+X(a, STATIC,   SINGULAR, UINT32,   rx_malformed,      7) \
+X(a, STATIC,   SINGULAR, UINT32,   tx_packets,        8) \
+X(a, STATIC,   SINGULAR, UINT32,   tx_failed,         9) \
+X(a, STATIC,   SINGULAR, UINT32,   tx_airtime_us,    10) \
+X(a, STATIC,   SINGULAR, UINT32,   hr_notify_sent,   11) \
+X(a, STATIC,   SINGULAR, UINT32,   hr_notify_failed,  12) \
+X(a, STATIC,   SINGULAR, UINT32,   scan_results,     13) \
+X(a, STATIC,   SINGULAR, UINT32,   scan_results_per_sec,  14) \
+X(a, STATIC,   SINGULAR, UINT32,   qos_level,        15) \
+X(a, STATIC,   SINGULAR, UINT32,   hr_notify_skipped,  16) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  frame_jitter_us,  17)
+#define Metrics_CALLBACK NULL
+#define Metrics_DEFAULT NULL
+#define Metrics_frame_us_MSGTYPE Histogram
+#define Metrics_frame_jitter_us_MSGTYPE Histogram
+
+extern const pb_msgdesc_t Histogram_msg;
+extern const pb_msgdesc_t Metrics_msg;
+
+/* Defines for backwards compatibility with code written before nanopb-0.4.0 */
+#define Histogram_fields &Histogram_msg
+#define Metrics_fields &Metrics_msg
+
+/* Maximum encoded size of messages (where known) */
+#define Histogram_size                           114
+#define Metrics_size                             324
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
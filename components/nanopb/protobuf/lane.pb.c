@@ -18,6 +18,9 @@ PB_BIND(LaneSetStatus, LaneSetStatus, AUTO)
 PB_BIND(LaneSetSpeed, LaneSetSpeed, AUTO)
 
 
+PB_BIND(LaneStartAt, LaneStartAt, AUTO)
+
+
 PB_BIND(LaneState, LaneState, AUTO)
 
 
@@ -42,6 +42,17 @@ typedef struct _LaneSetStatus {
     LaneStatus status;
 } LaneSetStatus;
 
+/* start all the lanes (over LoRa) at the same time */
+typedef struct _LaneStartAt {
+    LaneStatus status;
+    /* in m/s */
+    double speed;
+    /* since the end of the LoRa broadcast */
+    uint32_t delay_ms;
+    /* whether to collect the start error of each board */
+    bool measure;
+} LaneStartAt;
+
 /* go through Control Characteristic via Notify/Read */
 typedef struct _LaneState {
     float shift;
@@ -81,6 +92,7 @@ typedef struct _LaneControl {
     union {
         LaneSetStatus set_status;
         LaneSetSpeed set_speed;
+        LaneStartAt start_at;
     } msg;
 } LaneControl;
 
@@ -100,6 +112,7 @@ extern "C" {
 #define LaneColorConfig_init_default             {0}
 #define LaneSetStatus_init_default               {_LaneStatus_MIN}
 #define LaneSetSpeed_init_default                {0}
+#define LaneStartAt_init_default                 {_LaneStatus_MIN, 0, 0, 0}
 #define LaneState_init_default                   {0, 0, 0, 0, _LaneStatus_MIN}
 #define LaneConfig_init_default                  {0, {LaneLengthConfig_init_default}}
 #define LaneConfigRO_init_default                {false, LaneLengthConfig_init_default, false, LaneColorConfig_init_default}
@@ -108,6 +121,7 @@ extern "C" {
 #define LaneColorConfig_init_zero                {0}
 #define LaneSetStatus_init_zero                  {_LaneStatus_MIN}
 #define LaneSetSpeed_init_zero                   {0}
+#define LaneStartAt_init_zero                    {_LaneStatus_MIN, 0, 0, 0}
 #define LaneState_init_zero                      {0, 0, 0, 0, _LaneStatus_MIN}
 #define LaneConfig_init_zero                     {0, {LaneLengthConfig_init_zero}}
 #define LaneConfigRO_init_zero                   {false, LaneLengthConfig_init_zero, false, LaneColorConfig_init_zero}
@@ -121,6 +135,10 @@ extern "C" {
 #define LaneLengthConfig_line_leds_num_tag       4
 #define LaneSetSpeed_speed_tag                   1
 #define LaneSetStatus_status_tag                 1
+#define LaneStartAt_status_tag                   1
+#define LaneStartAt_speed_tag                    2
+#define LaneStartAt_delay_ms_tag                 3
+#define LaneStartAt_measure_tag                  4
 #define LaneState_shift_tag                      1
 #define LaneState_speed_tag                      2
 #define LaneState_head_tag                       3
@@ -132,6 +150,7 @@ extern "C" {
 #define LaneConfigRO_color_cfg_tag               2
 #define LaneControl_set_status_tag               1
 #define LaneControl_set_speed_tag                2
+#define LaneControl_start_at_tag                 3
 
 /* Struct field encoding specification for nanopb */
 #define LaneLengthConfig_FIELDLIST(X, a) \
@@ -157,6 +176,14 @@ X(a, STATIC,   SINGULAR, DOUBLE,   speed,             1)
 #define LaneSetSpeed_CALLBACK NULL
 #define LaneSetSpeed_DEFAULT NULL
 
+#define LaneStartAt_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UENUM,    status,            1) \
+X(a, STATIC,   SINGULAR, DOUBLE,   speed,             2) \
+X(a, STATIC,   SINGULAR, UINT32,   delay_ms,          3) \
+X(a, STATIC,   SINGULAR, BOOL,     measure,           4)
+#define LaneStartAt_CALLBACK NULL
+#define LaneStartAt_DEFAULT NULL
+
 #define LaneState_FIELDLIST(X, a) \
 X(a, STATIC,   SINGULAR, FLOAT,    shift,             1) \
 X(a, STATIC,   SINGULAR, FLOAT,    speed,             2) \
@@ -184,16 +211,19 @@ X(a, STATIC,   OPTIONAL, MESSAGE,  color_cfg,         2)
 
 #define LaneControl_FIELDLIST(X, a) \
 X(a, STATIC,   ONEOF,    MESSAGE,  (msg,set_status,msg.set_status),   1) \
-X(a, STATIC,   ONEOF,    MESSAGE,  (msg,set_speed,msg.set_speed),   2)
+X(a, STATIC,   ONEOF,    MESSAGE,  (msg,set_speed,msg.set_speed),   2) \
+X(a, STATIC,   ONEOF,    MESSAGE,  (msg,start_at,msg.start_at),   3)
 #define LaneControl_CALLBACK NULL
 #define LaneControl_DEFAULT NULL
 #define LaneControl_msg_set_status_MSGTYPE LaneSetStatus
 #define LaneControl_msg_set_speed_MSGTYPE LaneSetSpeed
+#define LaneControl_msg_start_at_MSGTYPE LaneStartAt
 
 extern const pb_msgdesc_t LaneLengthConfig_msg;
 extern const pb_msgdesc_t LaneColorConfig_msg;
 extern const pb_msgdesc_t LaneSetStatus_msg;
 extern const pb_msgdesc_t LaneSetSpeed_msg;
+extern const pb_msgdesc_t LaneStartAt_msg;
 extern const pb_msgdesc_t LaneState_msg;
 extern const pb_msgdesc_t LaneConfig_msg;
 extern const pb_msgdesc_t LaneConfigRO_msg;
@@ -204,6 +234,7 @@ extern const pb_msgdesc_t LaneControl_msg;
 #define LaneColorConfig_fields &LaneColorConfig_msg
 #define LaneSetStatus_fields &LaneSetStatus_msg
 #define LaneSetSpeed_fields &LaneSetSpeed_msg
+#define LaneStartAt_fields &LaneStartAt_msg
 #define LaneState_fields &LaneState_msg
 #define LaneConfig_fields &LaneConfig_msg
 #define LaneConfigRO_fields &LaneConfigRO_msg
@@ -213,10 +244,11 @@ extern const pb_msgdesc_t LaneControl_msg;
 #define LaneColorConfig_size                     6
 #define LaneConfigRO_size                        31
 #define LaneConfig_size                          23
-#define LaneControl_size                         11
+#define LaneControl_size                         21
 #define LaneLengthConfig_size                    21
 #define LaneSetSpeed_size                        9
 #define LaneSetStatus_size                       2
+#define LaneStartAt_size                         19
 #define LaneState_size                           22
 
 #ifdef __cplusplus
@@ -0,0 +1,138 @@
+"""
+convert the dump of `trace` (see `main/inc/trace.h`) to a Chrome trace,
+which could be opened with `chrome://tracing` or https://ui.perfetto.dev
+
+the input is either the log of `dump_serial` (the lines after `trace: `),
+or the values read from the trace characteristic concatenated in a file
+"""
+import json
+import re
+import struct
+from pathlib import Path
+import click
+
+# keep in sync with `trace::event_t`. id -> (name, track)
+EVENTS = {
+    1: ("iterate", "lane"),
+    2: ("show", "lane"),
+    3: ("tx", "radio"),
+    4: ("rx", "radio"),
+    5: ("dio1", "radio"),
+    6: ("control", "ble"),
+    7: ("config", "ble"),
+    8: ("white_list", "ble"),
+    9: ("scan_result", "ble"),
+    10: ("nvs_write", "nvs"),
+}
+TRACKS = ["lane", "radio", "ble", "nvs"]
+
+INSTANT = 0
+BEGIN = 1
+END = 2
+FLAG_ISR = 0x80
+
+FRAME_MAGIC = ord("T")
+FRAME_HEADER = struct.Struct("<BBH")
+RECORD = struct.Struct("<IBBH")
+
+LOG_LINE = re.compile(r"trace: ([0-9a-f]+)(?:\x1b\[0m)?\s*$")
+
+
+def read_frames(path: Path) -> bytes:
+  raw = path.read_bytes()
+  if raw[:1] == bytes([FRAME_MAGIC]):
+    return raw
+  out = bytearray()
+  for line in raw.decode("utf-8", errors="ignore").splitlines():
+    if m := LOG_LINE.search(line):
+      out += bytes.fromhex(m.group(1))
+  return bytes(out)
+
+
+def parse(data: bytes) -> dict[int, list[tuple[int, int, int, int]]]:
+  """
+  returns the records `(ts_us, id, flags, arg)` of each core
+  """
+  cores: dict[int, list[tuple[int, int, int, int]]] = {}
+  offset = 0
+  while offset + FRAME_HEADER.size <= len(data):
+    magic, core, count = FRAME_HEADER.unpack_from(data, offset)
+    if magic != FRAME_MAGIC:
+      raise click.ClickException(f"bad frame at offset {offset}")
+    offset += FRAME_HEADER.size
+    records = cores.setdefault(core, [])
+    for _ in range(count):
+      records.append(RECORD.unpack_from(data, offset))
+      offset += RECORD.size
+  return cores
+
+
+def unwrap(records: list[tuple[int, int, int, int]]) -> list[tuple[int, int, int, int]]:
+  """
+  the timestamps are the lower 32 bits and wrap every ~71 minutes
+  """
+  out = []
+  base = 0
+  last = None
+  for ts, *rest in records:
+    if last is not None and ts < last and last - ts > (1 << 31):
+      base += 1 << 32
+    last = ts
+    out.append((base + ts, *rest))
+  return out
+
+
+def to_chrome(cores: dict[int, list[tuple[int, int, int, int]]]) -> dict:
+  events = []
+  for core, records in sorted(cores.items()):
+    records = unwrap(records)
+    for track in TRACKS:
+      events.append({
+          "name": "thread_name",
+          "ph": "M",
+          "pid": core,
+          "tid": TRACKS.index(track),
+          "args": {"name": track},
+      })
+    events.append({"name": "process_name", "ph": "M", "pid": core, "args": {"name": f"core {core}"}})
+    # the events of the same id don't overlap on the same core, unless they come from different tasks
+    opened: dict[int, list[tuple[int, int]]] = {}
+    for ts, id_, flags, arg in records:
+      name, track = EVENTS.get(id_, (f"unknown_{id_}", "lane"))
+      phase = flags & 0x0f
+      e = {"name": name, "pid": core, "tid": TRACKS.index(track), "ts": ts, "args": {"arg": arg}}
+      if flags & FLAG_ISR:
+        e["args"]["isr"] = True
+      if phase == BEGIN:
+        opened.setdefault(id_, []).append((ts, arg))
+      elif phase == END:
+        stack = opened.get(id_)
+        if not stack:
+          # the begin has been overwritten
+          continue
+        begin, _ = stack.pop()
+        e["ph"] = "X"
+        e["ts"] = begin
+        e["dur"] = ts - begin
+        events.append(e)
+      else:
+        e["ph"] = "i"
+        e["s"] = "t"
+        events.append(e)
+  return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+@click.command()
+@click.argument("src", type=click.Path(exists=True, dir_okay=False))
+@click.option("--dst", "-o", type=click.Path(dir_okay=False), default=None, help="default to SRC with .json suffix")
+def main(src: str, dst: str | None):
+  src_path = Path(src)
+  dst_path = Path(dst) if dst is not None else src_path.with_suffix(".json")
+  cores = parse(read_frames(src_path))
+  if not cores:
+    raise click.ClickException("no trace found")
+  dst_path.write_text(json.dumps(to_chrome(cores)))
+  click.echo(f"{sum(len(r) for r in cores.values())} records -> {dst_path}")
+
+
+main()
@@ -7,23 +7,29 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/timers.h>
 #include <NimBLEDevice.h>
-#include <Preferences.h>
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <variant>
+#include <etl/queue_spsc_atomic.h>
+#include <etl/delegate.h>
 #include "utils.h"
+#include "seqlock.h"
 #include "lane.pb.h"
 #include "Strip.hpp"
 #include "common.h"
+#include "config_store.h"
+#include "frame_pacer.h"
 
 namespace lane {
 
 using centimeter = common::lanely::centimeter;
 using meter      = common::lanely::meter;
 
-struct notify_timer_param {
-  std::function<void()> fn;
-};
-
 enum class LaneStatus {
   FORWARD  = ::LaneStatus_FORWARD,
   BACKWARD = ::LaneStatus_BACKWARD,
@@ -31,7 +37,20 @@ enum class LaneStatus {
   BLINK    = ::LaneStatus_BLINK,
 };
 
-std::string statusToStr(LaneStatus status);
+const char *statusToStr(LaneStatus status);
+
+/// whether `status` from the outside world (e.g. LoRa) is one of `LaneStatus`
+constexpr bool isLaneStatus(int status) {
+  switch (status) {
+    case ::LaneStatus_FORWARD:
+    case ::LaneStatus_BACKWARD:
+    case ::LaneStatus_STOP:
+    case ::LaneStatus_BLINK:
+      return true;
+    default:
+      return false;
+  }
+}
 
 enum class LaneError {
   OK = 0,
@@ -85,8 +104,58 @@ struct LaneParams {
   LaneStatus status;
 };
 
-// note: I assume every time call this function the time interval is 1/fps
-std::tuple<LaneState, LaneParams> static nextState(const LaneState &last_state, const LaneConfig &cfg, const LaneParams &input);
+//**************************************** Commands *********************************/
+
+struct set_status_t {
+  LaneStatus status;
+};
+
+struct set_speed_t {
+  float speed;
+};
+
+struct set_color_t {
+  uint32_t color;
+};
+
+/// only applied when the lane is stopped
+struct set_length_t {
+  meter line_length;
+  meter active_length;
+  meter finish_length;
+  uint32_t line_LEDs_num;
+};
+
+struct set_config_t {
+  LaneConfig cfg;
+};
+
+/**
+ * @brief show `LaneConfig::fps / divider` frames per second without touching the config
+ * @note the motion is computed with the lowered rate, so the speed is kept
+ */
+struct set_fps_divider_t {
+  uint8_t divider;
+};
+
+/// start at `at_us` (esp_timer_get_time) instead of the next frame
+struct start_at_t {
+  LaneStatus status;
+  float speed;
+  int64_t at_us;
+};
+
+/**
+ * @brief an input from the outside world, applied by `Lane::loop` at the frame boundary
+ */
+struct command_t {
+  std::variant<set_status_t, set_speed_t, set_color_t, set_length_t, set_config_t, start_at_t, set_fps_divider_t> payload;
+  /// when the command is sent (esp_timer_get_time), to measure the latency
+  int64_t timestamp_us;
+};
+
+/// @param dt_s the time since the last state, in seconds
+std::tuple<LaneState, LaneParams> static nextState(const LaneState &last_state, const LaneConfig &cfg, const LaneParams &input, float dt_s);
 
 //**************************************** Lane *********************************/
 
@@ -112,6 +181,8 @@ private:
 
   class ConfigCharCallback final : public NimBLECharacteristicCallbacks {
     lane::Lane &lane;
+    /// `onRead` encodes into it. only touched by the NimBLE host task
+    std::array<uint8_t, LaneConfigRO_size> encode_buffer{};
 
   public:
     /// would expect LaneConfig variant
@@ -136,13 +207,60 @@ private:
     explicit LaneBLE(Lane *lane) : lane(lane), ctrl_cb(*lane), config_cb(*lane) {}
   };
 
-  Preferences pref;
+  /// persists the config in background. could be null
+  config_store::Store *store = nullptr;
   using strip_ptr_t = std::unique_ptr<strip::IStrip>;
   strip_ptr_t strip = nullptr;
-  notify_timer_param timer_param{[]() {}};
-  TimerHandle_t timer_handle = nullptr;
-  std::array<uint8_t, common::lanely::DECODE_BUFFER_SIZE>
-      decode_buffer = {0};
+  /// notifies the state to the BLE clients while the lane is running. created by `begin`
+  StaticTimer_t notify_timer_buf{};
+  TimerHandle_t notify_timer = nullptr;
+  /// whether `notify_timer` is started. owned by `loop`
+  bool notifying = false;
+  /// notify every `notify_divider` periods of `notify_timer`
+  std::atomic<uint8_t> notify_divider{1};
+  /// the periods since the last notification. only touched by the timer task
+  uint8_t notify_ticks = 0;
+  /// the task running `loop`, which would be notified when the input changes
+  TaskHandle_t loop_handle = nullptr;
+  static constexpr size_t MAX_COMMANDS = 16;
+  /**
+   * @brief the inputs waiting for the next frame
+   * @note the consumer is `loop`, which never locks.
+   *       the producers (the NimBLE host task, and the LoRa recv task for a synchronized start)
+   *       are serialized by `send_mutex`
+   */
+  etl::queue_spsc_atomic<command_t, MAX_COMMANDS> commands;
+  std::mutex send_mutex;
+  /// published by `loop` for the BLE callbacks and the notify timer
+  utils::seqlock_t<LaneConfig> cfg_snapshot;
+  utils::seqlock_t<LaneState> state_snapshot{LaneState::zero()};
+  /// wakes `loop` a bit before the scheduled start
+  esp_timer_handle_t start_timer = nullptr;
+  /// owned by `loop`
+  std::optional<start_at_t> scheduled_start = std::nullopt;
+
+  struct frame_stats_t {
+    /// how late `show` starts after the frame boundary
+    int64_t max_jitter_us = 0;
+    int64_t sum_jitter_us = 0;
+    uint32_t frames       = 0;
+    /// the boundaries skipped since the frame is not ready in time
+    uint32_t missed = 0;
+  };
+
+  /// wakes `loop` at every frame boundary while the lane is running
+  esp_timer_handle_t frame_timer = nullptr;
+  /// the frame boundaries. owned by `loop`
+  pacer_t pacer{};
+  /// see `set_fps_divider_t`. owned by `loop`
+  uint8_t fps_divider = 1;
+  /// whether the frame timer is running, for the other tasks
+  std::atomic<bool> pacing{false};
+  /// bumped right after a frame is shown
+  std::atomic<uint32_t> shown_frames{0};
+  frame_stats_t frame_stats{};
+  /// the worst `max_jitter_us` since boot
+  int64_t worst_jitter_us = 0;
 
   LaneBLE ble    = LaneBLE{this};
   LaneConfig cfg = {
@@ -159,7 +277,43 @@ private:
       .status = LaneStatus::STOP,
   };
 
-  void iterate();
+  /**
+   * @return whether a frame is filled and should be shown
+   */
+  bool iterate();
+
+  /// the frame rate actually shown
+  [[nodiscard]] float pacedFps() const {
+    return cfg.fps / static_cast<float>(fps_divider);
+  }
+
+  /**
+   * @brief start the frame timer with the period of `pacedFps`, and the first boundary is now
+   */
+  void startPacing();
+  void stopPacing();
+  /**
+   * @brief block until `t` (esp_timer_get_time). sleep until it's close, and busy wait the rest
+   */
+  void waitUntil(int64_t t);
+
+  static void notifyTimerCb(TimerHandle_t timer);
+  /// start `notify_timer` if it's not running
+  void startNotify();
+  void stopNotify();
+
+  /**
+   * @brief apply all the pending commands. should only be called by `loop`
+   * @param[in,out] status_changed_us when the last status change was sent
+   */
+  void applyCommands(int64_t &status_changed_us);
+
+  /**
+   * @brief busy wait for the scheduled start if it's close enough, and apply it
+   * @param[out] status_changed_us set to the scheduled time if it's applied
+   * @return how late it's applied, or nullopt if it's not applied
+   */
+  std::optional<int64_t> tryScheduledStart(int64_t &status_changed_us);
 
   /**
    * @brief config the characteristic for BLE
@@ -172,11 +326,46 @@ private:
 
   void stop() const;
 
+  /**
+   * @brief wake `loop` up, so that it reacts to the new input immediately
+   *        instead of waiting for the end of an idle delay
+   */
+  void wake() {
+    if (loop_handle != nullptr) {
+      xTaskNotifyGive(loop_handle);
+    }
+  }
+
+  template <typename T>
+  void send(T payload) {
+    {
+      std::lock_guard<std::mutex> lk(send_mutex);
+      if (!commands.push(command_t{payload, esp_timer_get_time()})) {
+        ESP_LOGE("LANE", "command queue is full; dropped");
+        return;
+      }
+    }
+    wake();
+  }
+
 public:
-  explicit Lane(strip_ptr_t strip) : strip(std::move(strip)){};
+  /**
+   * @brief broadcast the start to the other lanes
+   * @return the end of the broadcast (esp_timer_get_time), which is the shared time base,
+   *         or nullopt if it's not sent
+   */
+  using broadcast_start_fn = etl::delegate<std::optional<int64_t>(const ::LaneStartAt &msg)>;
+  /// @param late_us the first frame minus the scheduled time
+  using started_fn = etl::delegate<void(int32_t late_us)>;
+  /// could be unset, then only this lane would start
+  broadcast_start_fn broadcastStartCb;
+  /// called by `loop` after a scheduled start. could be unset
+  started_fn onStartedCb;
+
+  explicit Lane(strip_ptr_t strip) : strip(std::move(strip)), cfg_snapshot(cfg){};
   [[nodiscard]] meter lengthPerLED() const;
   [[nodiscard]] auto getLaneLEDsNum() const {
-    return this->cfg.line_LEDs_num;
+    return getConfig().line_LEDs_num;
   }
 
   /**
@@ -192,6 +381,13 @@ public:
     _initBLE(server, ble);
   }
 
+  /**
+   * @brief apply the pending config and light `READY_LEDs_NUM` LEDs with its color
+   * @note should be called by the lane task after `begin` and before `loop`.
+   *       it's kept until the lane leaves `STOP`
+   */
+  void showReady();
+
   /**
    * @brief Loop the strip.
    * @warning This function will never return and you should call this in creatTask/Thread
@@ -216,29 +412,114 @@ public:
 
   esp_err_t begin();
 
+  /**
+   * @note all the setters below are applied at the next frame boundary
+   */
   void setConfig(const LaneConfig &newCfg) {
-    this->cfg = newCfg;
+    send(set_config_t{newCfg});
   };
 
+  /**
+   * @brief a copy of the config applied by the loop. safe to call from any task
+   */
+  [[nodiscard]] LaneConfig getConfig() const {
+    return cfg_snapshot.read();
+  }
+
+  /**
+   * @brief a copy of the state of the last frame. safe to call from any task
+   */
+  [[nodiscard]] LaneState getState() const {
+    return state_snapshot.read();
+  }
+
+  /**
+   * @brief set the store to persist the config written by BLE
+   */
+  void setStore(config_store::Store *s) {
+    this->store = s;
+  }
+
+  /**
+   * @brief persist the current config in background
+   * @note should be called by `loop`, which owns `cfg`
+   */
+  void persistConfig() {
+    if (store == nullptr) {
+      ESP_LOGW("LANE", "no config store; config would not be persisted");
+      return;
+    }
+    store->save(config_store::config_t{
+        .color           = cfg.color,
+        .line_length_m   = cfg.line_length.count(),
+        .active_length_m = cfg.active_length.count(),
+        .total_length_m  = cfg.finish_length.count(),
+        .line_LEDs_num   = cfg.line_LEDs_num,
+    });
+  }
+
   void setSpeed(const float speed) {
-    this->params.speed = speed;
+    send(set_speed_t{speed});
   };
 
+  /// persisted once applied
   void setColor(const uint32_t color) {
-    this->cfg.color = color;
+    send(set_color_t{color});
   };
 
+  /**
+   * @brief persisted once applied
+   * @note ignored if the lane is not stopped when it's applied
+   */
+  void setLength(meter line_length, meter active_length, meter finish_length, uint32_t line_LEDs_num) {
+    send(set_length_t{line_length, active_length, finish_length, line_LEDs_num});
+  }
+
   void setStatus(const LaneStatus status) {
-    this->params.status = status;
+    send(set_status_t{status});
   };
 
   void setStatus(::LaneStatus status) {
-    this->params.status = static_cast<LaneStatus>(status);
+    setStatus(static_cast<LaneStatus>(status));
+  }
+
+  /**
+   * @brief set the status and the speed at `at_us` (esp_timer_get_time) with a busy wait at the end
+   * @note meant to be used when the lane is stopped. A running lane only checks it once per frame.
+   */
+  void startAt(LaneStatus status, float speed, int64_t at_us) {
+    send(start_at_t{status, speed, at_us});
   }
 
-  inline void resetDecodeBuffer() {
-    decode_buffer.fill(0);
+  /**
+   * @brief show every `divider`th frame of the configured FPS. used by the QoS governor
+   * @note not persisted, and `getConfig` still reports the configured FPS
+   */
+  void setFpsDivider(uint8_t divider) {
+    send(set_fps_divider_t{std::max<uint8_t>(divider, 1)});
+  }
+
+  /**
+   * @brief notify the state every `divider` periods of `BLUE_TRANSMIT_INTERVAL`. used by the QoS governor
+   * @note safe to call from any task
+   */
+  void setNotifyDivider(uint8_t divider) {
+    notify_divider.store(std::max<uint8_t>(divider, 1), std::memory_order_relaxed);
   }
+
+  /// the commands waiting for the next frame, in percent of the capacity. safe to call from any task
+  [[nodiscard]] uint8_t pendingCommandsPercent() const {
+    return static_cast<uint8_t>(commands.size() * 100 / MAX_COMMANDS);
+  }
+
+  /**
+   * @brief block until the next frame is shown, so that a flash write started right after has
+   *        the most of the frame period before the next boundary
+   * @note a flash write stalls both cores, IRAM or not. returns true at once if the lane is not pacing
+   * @return false on timeout
+   */
+  bool waitForShown(TickType_t timeout) const;
+
   [[nodiscard]] float LEDsPerMeter() const;
 };
 
@@ -8,20 +8,51 @@
 #include "Arduino.h"
 #include "NimBLEDevice.h"
 #include "whitelist.h"
+#include "gatt_cache.h"
+#include "ad_dedup.h"
+#include "ad_decoder.h"
+#include "device_registry.h"
+#include "common.h"
+#include "name_table.h"
+#include <freertos/queue.h>
+#include <string_view>
 #include <c++/8.4.0/map>
 #include "etl/flat_map.h"
 #include "etl/vector.h"
+#include "etl/delegate.h"
 
 const int BLE_MAC_ADDR_SIZE = white_list::BLE_MAC_ADDR_SIZE;
 using DeviceAddr            = etl::array<uint8_t, BLE_MAC_ADDR_SIZE>;
 
-struct DeviceInfo {
-  DeviceAddr address;
-  NimBLEClient *client;
+/// shared by the scan callback, the connect tasks and the client callbacks. see `device_registry`
+using DeviceMap = device_registry::Registry;
+
+enum class ScanFilterMode {
+  /// every advertisement goes to the host, and is filtered by `white_list::matcher_t`
+  HOST,
+  /**
+   * @brief only the addresses in the white list pass the controller filter accept list
+   * @note name items and the name prefix of the watches can't be checked by the controller,
+   *       it would fallback to `HOST` if the list has any name item, or the HR broadcasts of
+   *       the watches are wanted (see `white_list::controller_filterable`).
+   *       Otherwise the watches not in the list are never seen.
+   */
+  CONTROLLER,
 };
 
-/// Should not touch the info pointer (Read Only)
-using DeviceMap = etl::vector<DeviceInfo, 24>;
+/**
+ * @brief shared by every client of the bands
+ * @note the band is told by the peer address of the client, so it's never allocated per connection
+ */
+class HRClientCallbacks : public NimBLEClientCallbacks {
+  DeviceMap *devices;
+
+  void onDisconnect(NimBLEClient *pClient, int reason) override;
+
+public:
+  explicit HRClientCallbacks(DeviceMap *d) : devices(d) {}
+  DeviceMap &getDevices() { return *devices; }
+};
 
 class ScanCallback : public NimBLEScanCallbacks {
   // the characteristic to send the heart rate data to the client with the format described in
@@ -31,15 +62,56 @@ public:
 
   /**
    * @brief callback when we have scan result
-   * @param device name
+   * @param device name, a view of the advertisement
    * @param 6 bytes (48 bits) of mac address
    */
-  std::function<void(std::string, const uint8_t *)> onResultCb = nullptr;
+  etl::delegate<void(std::string_view, const uint8_t *)> onResultCb;
 
 private:
   white_list::list_t _white_list{};
+  /// compiled from `_white_list`
+  white_list::matcher_t _matcher{};
+  /// bumped by every change of `_white_list`. 0 is reserved for "don't care"
+  uint32_t _white_list_version = 1;
+  /// the addresses we have pushed to the controller white list
+  std::vector<white_list::matcher_t::addr_t> controller_addrs{};
+  ScanFilterMode filter_mode = ScanFilterMode::HOST;
+  /// whether to decode the HR broadcasts of the watches not in the white list
+  bool broadcasts = true;
+  /// skip the repeated advertisements
+  ad_dedup::Cache ad_cache{};
   DeviceMap devices{};
+  HRClientCallbacks client_callbacks{&devices};
   NimBLECharacteristic *hr_char = nullptr;
+  /// GATT handles of the known bands, to skip the discovery when reconnecting
+  gatt_cache::HandleCache handle_cache;
+
+  /// what the connect task needs to know about a band. copied into `connect_queue`
+  struct connect_req_t {
+    ble_addr_t ble_addr;
+    /// the client of the last connection, could be null
+    NimBLEClient *prev_client;
+    /// a handle of `name_table::table`, held by `devices`
+    name_table::handle_t name;
+  };
+  static constexpr size_t CONNECT_QUEUE_SIZE = 4;
+  /**
+   * @brief the claimed bands waiting for the connect task
+   * @note NimBLE only allows one pending connection, so they are connected one by one
+   *       by a single task, instead of a task for each band
+   */
+  QueueHandle_t connect_queue = nullptr;
+  StaticQueue_t connect_queue_buf{};
+  std::array<uint8_t, CONNECT_QUEUE_SIZE * sizeof(connect_req_t)> connect_queue_storage{};
+  common::topology::static_task_t<common::topology::CONNECT> connect_task{};
+
+  /// create `connect_queue` and the connect task on the first use
+  bool startConnectTask();
+  /**
+   * @brief connect and subscribe the band. runs in the connect task
+   * @note `finish_connect` of the registry is always called
+   */
+  void connect(const connect_req_t &req);
 
   /**
    * @brief callback when a device is found
@@ -48,25 +120,98 @@ private:
    * @note This function will use nanopb to encode the payload and then send it to the characteristic
    */
   void onResult(BLEAdvertisedDevice *advertisedDevice) override;
-  void handleHrAdvertised(BLEAdvertisedDevice *advertisedDevice);
-  void handleHrWhiteListConnection(BLEAdvertisedDevice *advertisedDevice);
+  /**
+   * @brief decode the advertisement with the decoder found in `ad_decoder::DECODERS`
+   *        and send the record to the HR characteristic
+   * @param decoder the decoder found by `ad_decoder::find`
+   * @param fields the parsed advertisement
+   * @param addr 6 bytes (48 bits) of mac address, used as the name if the device has no name
+   */
+  void handleHrAdvertised(const ad_decoder::entry_t &decoder, const ad::fields_t &fields, const uint8_t *addr);
+  /**
+   * @brief claim the band and queue it for the connect task
+   * @param name a view of the name in the advertisement
+   */
+  void handleHrWhiteListConnection(BLEAdvertisedDevice *advertisedDevice, std::string_view name);
+  /**
+   * @brief push the addresses of the white list to the controller and set the filter policy
+   * @note the scan would be stopped and restarted if it's running,
+   *       since the controller white list can't be changed while it's in use
+   */
+  void syncControllerWhiteList();
+  void bump_white_list_version() {
+    // skip 0 when it wraps around
+    if (++_white_list_version == 0) {
+      _white_list_version = 1;
+    }
+  }
 
 public:
-  explicit ScanCallback(NimBLECharacteristic *c) : hr_char(c) {}
+  /**
+   * @param c the characteristic to send the heart rate data to
+   * @param persist_handles whether to persist the GATT handles of the bands in NVS
+   */
+  explicit ScanCallback(NimBLECharacteristic *c, bool persist_handles = false) : hr_char(c), handle_cache(persist_handles) {
+    // a list from the fixed decoder is copied in place
+    _white_list.reserve(white_list::MAX_FIXED_ITEMS);
+  }
   DeviceMap &getDevices() { return devices; }
+  /// the last seen time of the devices around, could be used for presence tracking
+  [[nodiscard]] const ad_dedup::Cache &seen() const { return ad_cache; }
+  /**
+   * @brief see `ad_dedup::Cache::set_intervals`
+   */
+  void set_dedup_intervals(std::chrono::milliseconds min_interval, std::chrono::milliseconds refresh_period) {
+    ad_cache.set_intervals(min_interval, refresh_period);
+  }
+  /// the bands waiting for the connect task, in percent of the queue. safe to call from any task
+  [[nodiscard]] uint8_t pending_connects_percent() const {
+    if (connect_queue == nullptr) {
+      return 0;
+    }
+    return static_cast<uint8_t>(uxQueueMessagesWaiting(connect_queue) * 100 / CONNECT_QUEUE_SIZE);
+  }
   [[nodiscard]] const white_list::list_t &white_list() const { return _white_list; }
-  void set_white_list(white_list::list_t list) { _white_list = std::move(list); }
-};
-
-class HRClientCallbacks : public NimBLEClientCallbacks {
-  DeviceMap *devices;
-  DeviceAddr addr;
-
-  void onDisconnect(NimBLEClient *pClient, int reason) override;
-
-public:
-  explicit HRClientCallbacks(DeviceMap *d, DeviceAddr addr) : devices(d), addr(addr) {}
-  DeviceMap &getDevices() { return *devices; }
+  [[nodiscard]] uint32_t white_list_version() const { return _white_list_version; }
+  void set_white_list(white_list::list_t list) {
+    _matcher    = white_list::matcher_t{list};
+    _white_list = std::move(list);
+    bump_white_list_version();
+    syncControllerWhiteList();
+  }
+  /**
+   * @brief set the list from the fixed decoder, reusing the storage of the list and the matcher
+   * @note the duplicated items are dropped
+   */
+  void set_white_list(const white_list::fixed_list_t &list);
+  /**
+   * @brief add an item to the white list in place
+   * @return false if it's in the list already
+   */
+  bool add_white_item(const white_list::item_t &item);
+  /**
+   * @return false if it's not in the list
+   */
+  bool remove_white_item(const white_list::item_t &item);
+  void clear_white_list() {
+    set_white_list({});
+  }
+  /**
+   * @brief whether to let the controller drop the advertisements not in the white list
+   * @param broadcasts false to give up the HR broadcasts of the watches for `CONTROLLER`
+   * @note only the address items could be filtered by the controller
+   */
+  void set_filter_mode(ScanFilterMode mode, bool broadcasts = true) {
+    filter_mode      = mode;
+    this->broadcasts = broadcasts;
+    syncControllerWhiteList();
+  }
+  [[nodiscard]] ScanFilterMode effective_filter_mode() const {
+    if (filter_mode == ScanFilterMode::CONTROLLER && white_list::controller_filterable(_matcher, broadcasts)) {
+      return ScanFilterMode::CONTROLLER;
+    }
+    return ScanFilterMode::HOST;
+  }
 };
 
 class ServerCallbacks : public NimBLEServerCallbacks {
@@ -78,11 +223,40 @@ class ServerCallbacks : public NimBLEServerCallbacks {
 };
 
 class WhiteListCallback : public NimBLECharacteristicCallbacks {
+  /// the response is encoded into it. only touched by the NimBLE host task
+  std::array<uint8_t, BLE_ATT_ATTR_MAX_LEN> encode_buffer{};
+  /// the request is decoded into it when it fits. too large for the host task stack
+  ::WhiteListRequestFixed fixed_request = WhiteListRequestFixed_init_zero;
+
+  /// a list that fits is kept in the fixed capacity one
+  using request_t = std::variant<white_list::fixed_list_t, white_list::list_t, white_list::command_t, white_list::add_t, white_list::remove_t>;
+  /// the last decoded request. a fixed list is too large for the host task stack as well
+  request_t request{};
+
+  /**
+   * @brief try the fixed capacity decoder first, fallback to the dynamic one for a long list
+   * @param[out] version the version the request is based on
+   * @return false if it can't be decoded, otherwise it's left in `request`
+   */
+  bool decode(const uint8_t *data, size_t size, uint32_t &version);
+  /// encode the response with the current version, and notify
+  void respond(NimBLECharacteristic *pCharacteristic, white_list::response_t resp);
+
 public:
-  using set_list_fn   = std::function<void(white_list::list_t)>;
-  using get_list_fn   = std::function<white_list::list_t(void)>;
-  set_list_fn setList = nullptr;
-  get_list_fn getList = nullptr;
+  using set_list_fn       = etl::delegate<void(white_list::list_t)>;
+  using set_fixed_list_fn = etl::delegate<void(const white_list::fixed_list_t &)>;
+  using get_list_fn       = etl::delegate<const white_list::list_t &()>;
+  /// return false if nothing is changed
+  using edit_item_fn  = etl::delegate<bool(const white_list::item_t &)>;
+  using clear_list_fn = etl::delegate<void()>;
+  using version_fn    = etl::delegate<uint32_t()>;
+  set_list_fn setList;
+  set_fixed_list_fn setFixedList;
+  get_list_fn getList;
+  edit_item_fn addItem;
+  edit_item_fn removeItem;
+  clear_list_fn clearList;
+  version_fn getVersion;
   void onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override;
 };
 
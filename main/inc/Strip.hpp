@@ -13,31 +13,21 @@ namespace strip {
 class IStrip {
 public:
   /**
-   * @brief expect to call `show` inside the function
-   * @param start
-   * @param count
-   * @param color
+   * @brief clear the buffer and fill `count` LEDs from `start`, without `show`
    * @return if the operation is successful
    */
-  virtual bool fill_and_show_forward(size_t start, size_t count, uint32_t color) {
+  virtual bool fill_forward(size_t start, size_t count, uint32_t color) {
     auto res = clear();
     if (!res) {
       return false;
     }
-    res = fill(start, count, color);
-    if (!res) {
-      return false;
-    }
-    return show();
+    return fill(start, count, color);
   };
   /**
-   * @note expect to call `show` inside the function
-   * @param start
-   * @param count
-   * @param color
+   * @brief like `fill_forward` but counts `start` from the end of the strip
    * @return if the operation is successful
    */
-  virtual bool fill_and_show_backward(size_t start, size_t count, uint32_t color) {
+  virtual bool fill_backward(size_t start, size_t count, uint32_t color) {
     auto total = get_max_LEDs();
     auto res   = clear();
     if (!res) {
@@ -46,11 +36,27 @@ public:
     if (total < start + count) {
       return false;
     }
-    res = fill(total - start - count, count, color);
-    if (!res) {
-      return false;
-    }
-    return show();
+    return fill(total - start - count, count, color);
+  };
+  /**
+   * @brief expect to call `show` inside the function
+   * @param start
+   * @param count
+   * @param color
+   * @return if the operation is successful
+   */
+  virtual bool fill_and_show_forward(size_t start, size_t count, uint32_t color) {
+    return fill_forward(start, count, color) && show();
+  };
+  /**
+   * @note expect to call `show` inside the function
+   * @param start
+   * @param count
+   * @param color
+   * @return if the operation is successful
+   */
+  virtual bool fill_and_show_backward(size_t start, size_t count, uint32_t color) {
+    return fill_backward(start, count, color) && show();
   };
   virtual bool clear()                                          = 0;
   virtual bool fill(size_t start, size_t count, uint32_t color) = 0;
@@ -0,0 +1,204 @@
+//
+// Created by Kurosu Chan on 2023/11/23.
+//
+
+#ifndef TRACK_SHORT_AD_DECODER_H
+#define TRACK_SHORT_AD_DECODER_H
+
+#include <array>
+#include <string_view>
+#include <etl/optional.h>
+#include "ad_parser.h"
+#include "watch_info.h"
+
+/**
+ * @brief registry of the advertisement decoders of the HR devices that broadcast their data
+ * @note to support a new brand, write a `decode_fn` and add an entry to `DECODERS`.
+ *       The dispatch tables are built at compile time, and a lookup is a single index for each key kind.
+ */
+namespace ad_decoder {
+/**
+ * @brief the normalized record for the HR characteristic pipeline
+ */
+struct record_t {
+  uint8_t hr = 0;
+  etl::optional<uint8_t> battery{};
+  etl::optional<uint16_t> steps{};
+  /// in Celsius
+  etl::optional<float> temperature{};
+  etl::optional<uint8_t> SpO2{};
+};
+
+using decode_fn = etl::optional<record_t> (*)(const ad::fields_t &fields);
+
+enum class key_kind_t : uint8_t {
+  /// the first 2 bytes (little endian) of the manufacturer specific data
+  COMPANY_ID,
+  /// the first 2 bytes (little endian) of the service data
+  SERVICE_UUID16,
+  /// the beginning of the local name. The first character is used for dispatch
+  NAME_PREFIX,
+};
+
+struct entry_t {
+  const char *vendor;
+  key_kind_t key;
+  /// company identifier or 16-bit service UUID. ignored for `NAME_PREFIX`
+  uint16_t id;
+  /// non-empty for `NAME_PREFIX`
+  std::string_view prefix;
+  decode_fn decode;
+};
+
+//****************************** decoders ************************************/
+
+/// the "Y" watches put `WatchInfo` after their name
+inline etl::optional<record_t> decode_y_watch(const ad::fields_t &fields) {
+  const auto info = WatchInfo::from_span(WatchInfo::locate(fields));
+  if (!info.has_value()) {
+    return etl::nullopt;
+  }
+  auto r        = record_t{};
+  r.hr          = info->hr;
+  r.battery     = info->battery;
+  r.steps       = info->steps;
+  r.temperature = info->temperature;
+  r.SpO2        = info->SpO2;
+  return r;
+}
+
+/**
+ * @brief Heart Rate Service (0x180D) data carrying a Heart Rate Measurement
+ * @note `flags(1) | hr(1 or 2)`. the bit 0 of flags indicates whether hr is uint16
+ */
+inline etl::optional<record_t> decode_hrs_service_data(const ad::fields_t &fields) {
+  const auto &d = fields.service_data;
+  // uuid(2) + flags(1) + hr(1)
+  if (d.size() < 4) {
+    return etl::nullopt;
+  }
+  const auto flags = d[2];
+  auto r           = record_t{};
+  if (flags & 0x01) {
+    if (d.size() < 5) {
+      return etl::nullopt;
+    }
+    const auto hr = ad::read_u16_le(d.data() + 3);
+    r.hr          = hr > 255 ? 255 : static_cast<uint8_t>(hr);
+  } else {
+    r.hr = d[3];
+  }
+  return r;
+}
+
+// clang-format off
+constexpr entry_t DECODERS[] = {
+    {"hrs", key_kind_t::SERVICE_UUID16, 0x180d, "",  decode_hrs_service_data},
+    {"Y",   key_kind_t::NAME_PREFIX,    0,      "Y", decode_y_watch},
+};
+// clang-format on
+constexpr size_t DECODERS_COUNT = std::size(DECODERS);
+static_assert(DECODERS_COUNT < 0xff, "too many decoders");
+
+//****************************** dispatch tables ************************************/
+
+constexpr uint8_t NONE     = 0xff;
+constexpr size_t ID_SLOTS  = 16;
+constexpr size_t CHR_SLOTS = 256;
+
+constexpr size_t id_slot(uint16_t id) {
+  return (id ^ (id >> 4) ^ (id >> 8) ^ (id >> 12)) & (ID_SLOTS - 1);
+}
+
+template <size_t N>
+struct table_t {
+  std::array<uint8_t, N> index{};
+  /// false if two decoders fall into the same slot
+  bool ok = true;
+};
+
+constexpr table_t<ID_SLOTS> make_id_table(key_kind_t key) {
+  auto t = table_t<ID_SLOTS>{};
+  for (auto &i : t.index) {
+    i = NONE;
+  }
+  for (size_t i = 0; i < DECODERS_COUNT; ++i) {
+    if (DECODERS[i].key != key) {
+      continue;
+    }
+    const auto slot = id_slot(DECODERS[i].id);
+    if (t.index[slot] != NONE) {
+      t.ok = false;
+    }
+    t.index[slot] = static_cast<uint8_t>(i);
+  }
+  return t;
+}
+
+constexpr table_t<CHR_SLOTS> make_name_table() {
+  auto t = table_t<CHR_SLOTS>{};
+  for (auto &i : t.index) {
+    i = NONE;
+  }
+  for (size_t i = 0; i < DECODERS_COUNT; ++i) {
+    if (DECODERS[i].key != key_kind_t::NAME_PREFIX) {
+      continue;
+    }
+    if (DECODERS[i].prefix.empty()) {
+      t.ok = false;
+      continue;
+    }
+    const auto slot = static_cast<uint8_t>(DECODERS[i].prefix[0]);
+    if (t.index[slot] != NONE) {
+      t.ok = false;
+    }
+    t.index[slot] = static_cast<uint8_t>(i);
+  }
+  return t;
+}
+
+constexpr auto COMPANY_TABLE = make_id_table(key_kind_t::COMPANY_ID);
+constexpr auto SERVICE_TABLE = make_id_table(key_kind_t::SERVICE_UUID16);
+constexpr auto NAME_TABLE    = make_name_table();
+static_assert(COMPANY_TABLE.ok, "company id collision in DECODERS. adjust `id_slot` or `ID_SLOTS`");
+static_assert(SERVICE_TABLE.ok, "service uuid collision in DECODERS. adjust `id_slot` or `ID_SLOTS`");
+static_assert(NAME_TABLE.ok, "empty name prefix or two prefixes share the first character in DECODERS");
+
+/**
+ * @brief find the decoder of the advertisement
+ * @note company id goes first, then service uuid, then name prefix
+ * @return nullptr if there's no decoder for it
+ */
+inline const entry_t *find(const ad::fields_t &fields) {
+  auto by_id = [](const table_t<ID_SLOTS> &table, ad::bytes_t data) -> const entry_t * {
+    if (data.size() < 2) {
+      return nullptr;
+    }
+    const auto id  = ad::read_u16_le(data.data());
+    const auto idx = table.index[id_slot(id)];
+    if (idx == NONE || DECODERS[idx].id != id) {
+      return nullptr;
+    }
+    return &DECODERS[idx];
+  };
+  if (const auto *e = by_id(COMPANY_TABLE, fields.manufacturer_data); e != nullptr) {
+    return e;
+  }
+  if (const auto *e = by_id(SERVICE_TABLE, fields.service_data); e != nullptr) {
+    return e;
+  }
+  if (!fields.name.empty()) {
+    const auto idx = NAME_TABLE.index[fields.name[0]];
+    if (idx == NONE) {
+      return nullptr;
+    }
+    const auto name = std::string_view(reinterpret_cast<const char *>(fields.name.data()), fields.name.size());
+    if (name.substr(0, DECODERS[idx].prefix.size()) == DECODERS[idx].prefix) {
+      return &DECODERS[idx];
+    }
+  }
+  return nullptr;
+}
+}
+
+#endif // TRACK_SHORT_AD_DECODER_H
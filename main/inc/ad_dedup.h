@@ -0,0 +1,169 @@
+//
+// Created by Kurosu Chan on 2023/11/21.
+//
+
+#ifndef TRACK_SHORT_AD_DEDUP_H
+#define TRACK_SHORT_AD_DEDUP_H
+
+#include <chrono>
+#include <mutex>
+#include <array>
+#include <cstring>
+#include <etl/array.h>
+#include <etl/optional.h>
+
+/**
+ * @brief per address cache of the last advertisement payload
+ * @note the watches re-advertise the same payload many times a second. Only a changed payload
+ *       is worth parsing, and even a changed one is throttled to `min_interval`.
+ *       The last seen time is also useful for presence tracking.
+ */
+namespace ad_dedup {
+constexpr auto BLE_MAC_ADDR_SIZE = 6;
+/// should be a power of 2
+constexpr size_t CACHE_SIZE = 64;
+/// the number of slots to look at before evicting
+constexpr size_t MAX_PROBE            = 4;
+constexpr auto DEFAULT_MIN_INTERVAL   = std::chrono::milliseconds(500);
+constexpr auto DEFAULT_REFRESH_PERIOD = std::chrono::seconds(10);
+
+using addr_t = etl::array<uint8_t, BLE_MAC_ADDR_SIZE>;
+
+/**
+ * @brief 32-bit FNV-1a
+ */
+inline uint32_t fnv1a(const uint8_t *data, size_t size, uint32_t hash = 2166136261u) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+struct entry_t {
+  addr_t addr{};
+  uint32_t hash = 0;
+  /// in microseconds, from `esp_timer_get_time`
+  int64_t last_seen = 0;
+  /// the last time the advertisement is let through
+  int64_t last_forward = 0;
+  bool used            = false;
+};
+
+class Cache {
+  std::array<entry_t, CACHE_SIZE> entries{};
+  int64_t min_interval_us   = std::chrono::duration_cast<std::chrono::microseconds>(DEFAULT_MIN_INTERVAL).count();
+  int64_t refresh_period_us = std::chrono::duration_cast<std::chrono::microseconds>(DEFAULT_REFRESH_PERIOD).count();
+  mutable std::mutex mutex;
+
+  static size_t slot_of(const uint8_t *addr) {
+    return fnv1a(addr, BLE_MAC_ADDR_SIZE) & (CACHE_SIZE - 1);
+  }
+
+  entry_t *find(const uint8_t *addr) {
+    const auto slot = slot_of(addr);
+    for (size_t i = 0; i < MAX_PROBE; ++i) {
+      auto &e = entries[(slot + i) & (CACHE_SIZE - 1)];
+      if (e.used && std::memcmp(e.addr.data(), addr, BLE_MAC_ADDR_SIZE) == 0) {
+        return &e;
+      }
+    }
+    return nullptr;
+  }
+
+  [[nodiscard]] const entry_t *find(const uint8_t *addr) const {
+    return const_cast<Cache *>(this)->find(addr);
+  }
+
+  /// take a free slot in the probe window, or evict the least recently seen one
+  entry_t &take(const uint8_t *addr) {
+    const auto slot = slot_of(addr);
+    entry_t *victim = nullptr;
+    for (size_t i = 0; i < MAX_PROBE; ++i) {
+      auto &e = entries[(slot + i) & (CACHE_SIZE - 1)];
+      if (!e.used) {
+        return e;
+      }
+      if (victim == nullptr || e.last_seen < victim->last_seen) {
+        victim = &e;
+      }
+    }
+    return *victim;
+  }
+
+public:
+  /**
+   * @param min_interval a changed payload would be let through at most once in this interval
+   * @param refresh_period an unchanged payload would still be let through once in this period,
+   *        so that the consumer (e.g. reconnecting a white listed band) won't starve
+   */
+  void set_intervals(std::chrono::milliseconds min_interval, std::chrono::milliseconds refresh_period) {
+    std::lock_guard<std::mutex> lk(mutex);
+    min_interval_us   = std::chrono::duration_cast<std::chrono::microseconds>(min_interval).count();
+    refresh_period_us = std::chrono::duration_cast<std::chrono::microseconds>(refresh_period).count();
+  }
+
+  /**
+   * @brief record the advertisement and decide whether it should be processed
+   * @param addr 6 bytes (48 bits) of mac address
+   * @param payload the raw advertisement payload
+   * @param size the size of payload
+   * @param now in microseconds
+   * @return true if the advertisement is new or changed (and not throttled)
+   */
+  bool should_forward(const uint8_t *addr, const uint8_t *payload, size_t size, int64_t now) {
+    const auto hash = fnv1a(payload, size);
+    std::lock_guard<std::mutex> lk(mutex);
+    auto *e = find(addr);
+    if (e == nullptr) {
+      auto &n = take(addr);
+      std::copy(addr, addr + BLE_MAC_ADDR_SIZE, n.addr.begin());
+      n.hash         = hash;
+      n.last_seen    = now;
+      n.last_forward = now;
+      n.used         = true;
+      return true;
+    }
+    e->last_seen        = now;
+    const auto since_fw = now - e->last_forward;
+    if (e->hash == hash && since_fw < refresh_period_us) {
+      return false;
+    }
+    if (since_fw < min_interval_us) {
+      // leave the hash untouched, so the change would be picked up after the interval
+      return false;
+    }
+    e->hash         = hash;
+    e->last_forward = now;
+    return true;
+  }
+
+  /**
+   * @return the last time (in microseconds) the device is seen, or nullopt if it's not in the cache
+   */
+  [[nodiscard]] etl::optional<int64_t> last_seen(const addr_t &addr) const {
+    std::lock_guard<std::mutex> lk(mutex);
+    if (const auto *e = find(addr.data()); e != nullptr) {
+      return e->last_seen;
+    }
+    return etl::nullopt;
+  }
+
+  /**
+   * @brief iterate the devices seen since `since`
+   * @param since in microseconds
+   * @param fn `void(const addr_t &addr, int64_t last_seen)`. would be called with the lock held
+   */
+  template <typename F>
+  void for_each_seen_since(int64_t since, F fn) const {
+    std::lock_guard<std::mutex> lk(mutex);
+    for (const auto &e : entries) {
+      if (e.used && e.last_seen >= since) {
+        fn(e.addr, e.last_seen);
+      }
+    }
+  }
+};
+}
+
+#endif // TRACK_SHORT_AD_DEDUP_H
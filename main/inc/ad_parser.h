@@ -0,0 +1,150 @@
+//
+// Created by Kurosu Chan on 2023/11/22.
+//
+
+#ifndef TRACK_SHORT_AD_PARSER_H
+#define TRACK_SHORT_AD_PARSER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <etl/span.h>
+
+/**
+ * @brief zero-copy reader of the advertisement data (a sequence of AD structures)
+ * @note every AD structure is `length(1) | type(1) | value(length - 1)`
+ * @see https://bluetoothle.wiki/advertising
+ * @see Core Specification Supplement, Part A, Section 1
+ */
+namespace ad {
+using bytes_t = etl::span<const uint8_t>;
+
+namespace type {
+  constexpr uint8_t FLAGS                 = 0x01;
+  constexpr uint8_t INCOMPLETE_UUID16     = 0x02;
+  constexpr uint8_t COMPLETE_UUID16       = 0x03;
+  constexpr uint8_t SHORTENED_LOCAL_NAME  = 0x08;
+  constexpr uint8_t COMPLETE_LOCAL_NAME   = 0x09;
+  constexpr uint8_t TX_POWER_LEVEL        = 0x0a;
+  constexpr uint8_t SERVICE_DATA_UUID16   = 0x16;
+  constexpr uint8_t MANUFACTURER_SPECIFIC = 0xff;
+}
+
+struct structure_t {
+  uint8_t type = 0;
+  /// without the length and type byte
+  bytes_t value{};
+};
+
+/**
+ * @brief iterate the AD structures one by one. never reads out of `payload`
+ */
+class reader_t {
+  const uint8_t *cur;
+  const uint8_t *end;
+  bool _malformed = false;
+
+public:
+  explicit reader_t(bytes_t payload) : cur(payload.data()), end(payload.data() + payload.size()) {}
+
+  /**
+   * @param[out] out the next structure
+   * @return false if there's no more structure (or the rest is malformed)
+   */
+  bool next(structure_t &out) {
+    if (cur >= end) {
+      return false;
+    }
+    const size_t length = cur[0];
+    // zero length means the significant part is over, the rest is padding
+    if (length == 0) {
+      cur = end;
+      return false;
+    }
+    const auto left = static_cast<size_t>(end - cur) - 1;
+    if (length > left) {
+      _malformed = true;
+      cur        = end;
+      return false;
+    }
+    out.type  = cur[1];
+    out.value = bytes_t(cur + 2, length - 1);
+    cur += length + 1;
+    return true;
+  }
+
+  /// whether the last structure claims more bytes than there are
+  [[nodiscard]] bool malformed() const {
+    return _malformed;
+  }
+};
+
+/**
+ * @brief the interesting fields of an advertisement, collected in one pass
+ * @note all of them are views into the original payload
+ */
+struct fields_t {
+  bytes_t name{};
+  /// with the 2 bytes company identifier (little endian) at the beginning
+  bytes_t manufacturer_data{};
+  /// with the 2 bytes service UUID (little endian) at the beginning
+  bytes_t service_data{};
+  /// the value of the structure right after the local name
+  bytes_t after_name{};
+  uint8_t after_name_type = 0;
+  bool malformed          = false;
+};
+
+inline fields_t parse(bytes_t payload) {
+  auto fields        = fields_t{};
+  auto reader        = reader_t{payload};
+  auto s             = structure_t{};
+  bool previous_name = false;
+  while (reader.next(s)) {
+    if (previous_name) {
+      fields.after_name      = s.value;
+      fields.after_name_type = s.type;
+      previous_name          = false;
+    }
+    switch (s.type) {
+      case type::SHORTENED_LOCAL_NAME:
+        // prefer the complete one
+        if (fields.name.empty()) {
+          fields.name   = s.value;
+          previous_name = true;
+        }
+        break;
+      case type::COMPLETE_LOCAL_NAME:
+        fields.name   = s.value;
+        previous_name = true;
+        break;
+      case type::MANUFACTURER_SPECIFIC:
+        if (fields.manufacturer_data.empty()) {
+          fields.manufacturer_data = s.value;
+        }
+        break;
+      case type::SERVICE_DATA_UUID16:
+        if (fields.service_data.empty()) {
+          fields.service_data = s.value;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  fields.malformed = reader.malformed();
+  return fields;
+}
+
+/**
+ * @brief read a big endian uint16_t. caller should check the bounds
+ */
+inline uint16_t read_u16_be(const uint8_t *p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline uint16_t read_u16_le(const uint8_t *p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+}
+
+#endif // TRACK_SHORT_AD_PARSER_H
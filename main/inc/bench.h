@@ -0,0 +1,30 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_BENCH_H
+#define TRACK_SHORT_BENCH_H
+
+#include <chrono>
+
+// write NVS against the running lane and report the frame timing of every phase
+// #define BENCH_NVS_STALL
+
+namespace lane {
+class Lane;
+}
+
+namespace bench {
+constexpr auto PHASE_DURATION = std::chrono::seconds(20);
+constexpr auto WRITE_INTERVAL = std::chrono::milliseconds(200);
+
+/**
+ * @brief cycle through the phases: no write, a write at any time, and a write right after a frame is shown
+ * @note the lane should be running (e.g. with `DEBUG_SPEED`). every phase logs the histograms of the frame time
+ *       and the jitter of its own, from `metrics`. Build it with and without `HOT_PATH_IN_FLASH` to compare
+ *       the placement. does nothing without `BENCH_NVS_STALL`
+ */
+void start_nvs_stall(lane::Lane &lane);
+}
+
+#endif // TRACK_SHORT_BENCH_H
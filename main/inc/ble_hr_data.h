@@ -5,7 +5,7 @@
 #ifndef TRACK_SHORT_BLE_HR_DATA_H
 #define TRACK_SHORT_BLE_HR_DATA_H
 #include <array>
-#include <string>
+#include <string_view>
 #include <etl/optional.h>
 
 namespace ble {
@@ -16,7 +16,8 @@ using addr_t                    = std::array<uint8_t, BLE_ADDR_SIZE>;
 struct hr_data {
   struct t {
     using module = hr_data;
-    std::string name{};
+    /// not owned. a view of the buffer after `unmarshal`
+    std::string_view name{};
     uint8_t hr = 0;
   };
   static size_t size_needed(const t &data) {
@@ -41,7 +42,7 @@ struct hr_data {
     }
     t data;
     size_t sz = buffer[0];
-    data.name = std::string(reinterpret_cast<const char *>(buffer + BLE_ADDR_SIZE + 1), sz);
+    data.name = std::string_view(reinterpret_cast<const char *>(buffer + BLE_ADDR_SIZE + 1), sz);
     data.hr   = buffer[BLE_ADDR_SIZE + 1 + sz];
     return data;
   }
@@ -0,0 +1,86 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_BOOT_H
+#define TRACK_SHORT_BOOT_H
+
+#include <chrono>
+#include <cstdint>
+#include <esp_timer.h>
+
+/**
+ * @brief the timing of the boot phases, some of which run at the same time
+ * @note the time is `esp_timer_get_time`, which starts in the startup code after the bootloader.
+ *       a phase could be recorded from any task
+ */
+namespace boot {
+enum class phase_t : uint8_t {
+  /// from the esp_timer init to `app_main`
+  STARTUP,
+  ARDUINO,
+  /// reading the config from NVS
+  CONFIG,
+  /// `Lane::begin` and the ready frame, in the lane task
+  STRIP,
+  /// `LLCC68::begin` and the DIO1 interrupt, in the radio init task
+  RADIO,
+  /// `NimBLEDevice::init`
+  BLE_STACK,
+  /// the GATT services and the callbacks
+  BLE_SERVICES,
+  ADVERTISING,
+  COUNT,
+};
+
+/// the lane should be lit within it after the reset
+constexpr auto FIRST_FRAME_TARGET = std::chrono::milliseconds(500);
+
+constexpr const char *phaseToStr(phase_t phase) {
+  switch (phase) {
+    case phase_t::STARTUP:
+      return "startup";
+    case phase_t::ARDUINO:
+      return "arduino";
+    case phase_t::CONFIG:
+      return "config";
+    case phase_t::STRIP:
+      return "strip";
+    case phase_t::RADIO:
+      return "radio";
+    case phase_t::BLE_STACK:
+      return "ble_stack";
+    case phase_t::BLE_SERVICES:
+      return "ble_services";
+    case phase_t::ADVERTISING:
+      return "advertising";
+    default:
+      return "unknown";
+  }
+}
+
+/// @param start_us, end_us `esp_timer_get_time`
+void record(phase_t phase, int64_t start_us, int64_t end_us);
+
+/// record the lifetime of the scope as `phase`
+class scope_t {
+  phase_t phase;
+  int64_t start_us;
+
+public:
+  explicit scope_t(phase_t phase) : phase(phase), start_us(esp_timer_get_time()) {}
+  ~scope_t() {
+    record(phase, start_us, esp_timer_get_time());
+  }
+  scope_t(const scope_t &)            = delete;
+  scope_t &operator=(const scope_t &) = delete;
+};
+
+/**
+ * @brief log the recorded phases, and the time to the first frame (the end of `STRIP`)
+ * @note a warning if the first frame is later than `FIRST_FRAME_TARGET`
+ */
+void report();
+}
+
+#endif // TRACK_SHORT_BOOT_H
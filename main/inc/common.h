@@ -4,7 +4,25 @@
 
 #ifndef TRACK_SHORT_COMMON_H
 #define TRACK_SHORT_COMMON_H
+#include <array>
 #include <driver/gpio.h>
+#include <sdkconfig.h>
+#include <esp_attr.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <Adafruit_NeoPixel.h>
+#include "utils.h"
+
+// keep the render hot path in flash, to compare with `BENCH_NVS_STALL`.
+// the ISRs are always in IRAM, since the GPIO ISR service is installed with `ESP_INTR_FLAG_IRAM`
+// #define HOT_PATH_IN_FLASH
+
+/// the render hot path, which runs once per frame and would miss the flash cache every time
+#ifdef HOT_PATH_IN_FLASH
+#define HOT_ATTR
+#else
+#define HOT_ATTR IRAM_ATTR
+#endif
 
 namespace common {
 constexpr auto BLE_NAME = "lane";
@@ -15,11 +33,16 @@ constexpr auto BLE_CHAR_HR_SERVICE_UUID = "180d";
 constexpr auto BLE_CHAR_CONTROL_UUID    = "24207642-0d98-40cd-84bb-910008579114";
 constexpr auto BLE_CHAR_CONFIG_UUID     = "e89cf8f0-7b7e-4a2e-85f4-85c814ab5cab";
 constexpr auto BLE_CHAR_HEARTBEAT_UUID  = "048b8928-d0a5-43e2-ada9-b925ec62ba27";
+constexpr auto BLE_CHAR_HR_HISTORY_UUID = "bfa15407-538e-49ca-891d-bc1f3c6180d3";
 
 
 constexpr auto BLE_CHAR_WHITE_LIST_UUID = "12a481f0-9384-413d-b002-f8660566d3b0";
 constexpr auto BLE_CHAR_DEVICE_UUID     = "a2f05114-fdb6-4549-ae2a-845b4be1ac48";
 
+constexpr auto BLE_DIAG_SERVICE_UUID    = "583c9b75-d6ba-41b7-b7bb-520f46847eb0";
+constexpr auto BLE_CHAR_METRICS_UUID    = "56c06378-c269-4d85-8a32-9644b6556cbf";
+constexpr auto BLE_CHAR_TRACE_UUID      = "0748d5c4-5492-4d04-ac92-66508380155d";
+
 /**
  * @brief some common *constant* definitions for `lane`
  * @note it's called `lanely` since `lane` the namespace has been taken in global namespace
@@ -33,15 +56,16 @@ namespace lanely {
   constexpr auto PREF_LINE_LEDs_NUM_NAME = "ln";
   constexpr auto PREF_TOTAL_LENGTH_NAME  = "to"; // float
   constexpr auto PREF_COLOR_NAME         = "co"; // uint32_t
+  constexpr auto PREF_CONFIG_BLOB_NAME   = "cfg"; // config_store::blob_t
 
   constexpr auto DEFAULT_ACTIVE_LENGTH  = meter(0.6);  // the line would be active for this length
   constexpr auto DEFAULT_LINE_LENGTH    = meter(50);   // line... it would wrap around
   constexpr auto DEFAULT_TARGET_LENGTH  = meter(1000); // like shift
   constexpr auto DEFAULT_LINE_LEDs_NUM  = static_cast<uint32_t>(DEFAULT_LINE_LENGTH.count() * (100 / 3.3));
   constexpr auto DEFAULT_FPS            = 10;
-  constexpr size_t DECODE_BUFFER_SIZE   = 2048;
   constexpr auto BLUE_TRANSMIT_INTERVAL = std::chrono::milliseconds(1000);
-  constexpr auto HALT_INTERVAL          = std::chrono::milliseconds(500);
+  /// lit at the start of the strip once the lane is ready, until it runs
+  constexpr auto READY_LEDs_NUM         = 3;
   constexpr neoPixelType PIXEL_TYPE     = NEO_RGB + NEO_KHZ800;
 }
 
@@ -57,6 +81,55 @@ namespace pin {
   constexpr auto DIO2     = GPIO_NUM_33;
   constexpr auto DIO3     = GPIO_NUM_26;
 }
+
+/**
+ * @brief where the tasks run
+ * @note the render core only runs the lane loop, so a frame is never preempted by the radio,
+ *       BLE or logging, which all live on the other core (with esp_timer and the timer service).
+ *       The data crossing the cores goes through the lock-free command queue and the seqlock
+ *       snapshots of `lane::Lane`.
+ */
+namespace topology {
+  struct task_t {
+    const char *name;
+    uint32_t stack;
+    UBaseType_t priority;
+    BaseType_t core;
+  };
+
+  constexpr BaseType_t RADIO_CORE  = 0;
+  constexpr BaseType_t RENDER_CORE = 1;
+  static_assert(CONFIG_BT_NIMBLE_PINNED_TO_CORE == RADIO_CORE, "NimBLE host should be pinned to the radio core");
+  // the DIO1 interrupt is attached by `RADIO_INIT`, and is served by the core running it
+  static_assert(CONFIG_ESP_MAIN_TASK_AFFINITY == RADIO_CORE, "app_main should be pinned to the radio core");
+
+  constexpr auto LANE         = task_t{"lane", 8192, 5, RENDER_CORE};
+  /// brings up the radio while app_main brings up BLE, and exits
+  constexpr auto RADIO_INIT   = task_t{"radio_init", 4096, 2, RADIO_CORE};
+  constexpr auto RECV         = task_t{"recv", 4096, 1, RADIO_CORE};
+  constexpr auto CONNECT      = task_t{"connect", 4096, 1, RADIO_CORE};
+  constexpr auto CONFIG_STORE = task_t{"config_store", 3072, 1, RADIO_CORE};
+  constexpr auto TASK_STATS   = task_t{"task_stats", 3072, 1, RADIO_CORE};
+  constexpr auto DEFER_LOG    = task_t{"defer_log", 3072, 1, RADIO_CORE};
+  /// only with `BENCH_NVS_STALL`
+  constexpr auto BENCH        = task_t{"bench", 3072, 1, RADIO_CORE};
+
+  /**
+   * @brief the stack and the TCB of a task in `T`, so that nothing is taken from the heap
+   * @note should have static storage duration, and be created only once
+   */
+  template <const task_t &T>
+  class static_task_t {
+    StaticTask_t tcb{};
+    std::array<StackType_t, T.stack> stack{};
+
+  public:
+    /// @return nullptr if failed
+    TaskHandle_t create(TaskFunction_t fn, void *param) {
+      return xTaskCreateStaticPinnedToCore(fn, T.name, T.stack, param, T.priority, stack.data(), &tcb, T.core);
+    }
+  };
+}
 };
 
 #endif // TRACK_SHORT_COMMON_H
@@ -0,0 +1,92 @@
+//
+// Created by Kurosu Chan on 2023/11/25.
+//
+
+#ifndef TRACK_SHORT_CONFIG_STORE_H
+#define TRACK_SHORT_CONFIG_STORE_H
+
+#include <chrono>
+#include <mutex>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <Preferences.h>
+#include <etl/delegate.h>
+
+/**
+ * @brief write-behind persistence of the lane config
+ * @note the whole config is a single versioned blob with CRC, written by a background task.
+ *       `save` only copies the config and wakes the task up, so it's cheap enough for the BLE callbacks.
+ *       A burst of `save` calls within `DEBOUNCE` results in a single flash write, and a burst
+ *       that never settles down is still written every `MAX_DEBOUNCE`.
+ */
+namespace config_store {
+struct config_t {
+  uint32_t color;
+  float line_length_m;
+  float active_length_m;
+  float total_length_m;
+  uint32_t line_LEDs_num;
+};
+
+/// what's actually in the flash
+struct blob_t {
+  uint32_t magic;
+  /// the version of the layout of `config`
+  uint16_t version;
+  /// `sizeof(config_t)`
+  uint16_t size;
+  config_t config;
+  /// CRC32 (little endian) of everything above
+  uint32_t crc;
+};
+
+class Store {
+public:
+  static constexpr uint32_t MAGIC    = 0x656e616c; // "lane"
+  static constexpr uint16_t VERSION  = 1;
+  static constexpr auto DEBOUNCE     = std::chrono::milliseconds(500);
+  static constexpr auto MAX_DEBOUNCE = std::chrono::milliseconds(2000);
+
+private:
+  Preferences pref;
+  /// guards `pending` and `dirty`
+  std::mutex mutex{};
+  config_t pending{};
+  bool dirty          = false;
+  TaskHandle_t handle = nullptr;
+  /// called by the writer task right before a flash write. could be unset
+  etl::delegate<void()> write_gate;
+
+  [[noreturn]] void run();
+  bool write(const config_t &cfg);
+
+public:
+  /**
+   * @brief read the config blob
+   * @note the old per-field keys would be used if there's no valid blob,
+   *       and missing fields would be taken from `defaults`.
+   *       should be called before `begin`
+   */
+  config_t load(const config_t &defaults);
+
+  /**
+   * @brief start the writer task
+   */
+  esp_err_t begin();
+
+  /**
+   * @brief persist the config in background. never blocks on flash
+   */
+  void save(const config_t &cfg);
+
+  /**
+   * @brief block the writer task until it's a good time to write, e.g. `Lane::waitForShown`
+   * @note a flash write disables the cache and stalls both cores. should be set before the first `save`
+   */
+  void setWriteGate(etl::delegate<void()> gate) {
+    write_gate = gate;
+  }
+};
+}
+
+#endif // TRACK_SHORT_CONFIG_STORE_H
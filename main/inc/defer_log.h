@@ -0,0 +1,262 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_DEFER_LOG_H
+#define TRACK_SHORT_DEFER_LOG_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+/**
+ * @brief deferred logging for the hot paths
+ * @note a call site only copies the pointer of the format string (which is the id of the message),
+ *       the tag and the raw arguments into a ring buffer. The formatting and the printing happen in
+ *       a low priority task on the radio core.
+ *
+ *       The format string and the tag should be literals. A `%s` argument is copied (truncated to
+ *       `MAX_STR_LEN`), so it could be a temporary. `str_t` and `hex_t` could be used with `%s` for a
+ *       `std::string_view` and raw bytes. `*` width and precision are not supported.
+ *
+ *       The messages are dropped (and counted) if the ring is full or `start` is not called yet.
+ *       Should not be called from an ISR.
+ *
+ *       Without ESP-IDF, `DLOGx` formats in place with `render` and prints with `LOGx` in `simple_log.h`.
+ */
+namespace defer_log {
+constexpr size_t MAX_ARGS = 8;
+/// a `%s` argument longer than this is truncated
+constexpr size_t MAX_STR_LEN = 48;
+/// `hex_t` longer than this is truncated
+constexpr size_t MAX_HEX_LEN = 255;
+/// the longest message after formatting, truncated
+constexpr size_t MAX_MESSAGE_LEN = 256;
+
+enum class kind_t : uint8_t {
+  I32,
+  U32,
+  I64,
+  U64,
+  F64,
+  PTR,
+  /// length(1) | chars
+  STR,
+  /// length(1) | bytes, printed as lower case hex
+  HEX,
+};
+
+/// a string view for `%s`
+struct str_t {
+  std::string_view s;
+};
+
+/// bytes printed as lower case hex for `%s`
+struct hex_t {
+  const uint8_t *data;
+  size_t size;
+};
+
+template <typename>
+constexpr bool dependent_false = false;
+
+template <typename T>
+constexpr kind_t kind_of() {
+  using U = std::decay_t<T>;
+  if constexpr (std::is_same_v<U, str_t> || std::is_same_v<U, const char *> || std::is_same_v<U, char *>) {
+    return kind_t::STR;
+  } else if constexpr (std::is_same_v<U, hex_t>) {
+    return kind_t::HEX;
+  } else if constexpr (std::is_enum_v<U>) {
+    return kind_of<std::underlying_type_t<U>>();
+  } else if constexpr (std::is_floating_point_v<U>) {
+    return kind_t::F64;
+  } else if constexpr (std::is_pointer_v<U>) {
+    return kind_t::PTR;
+  } else if constexpr (std::is_integral_v<U>) {
+    if constexpr (sizeof(U) <= 4) {
+      return std::is_signed_v<U> ? kind_t::I32 : kind_t::U32;
+    } else {
+      return std::is_signed_v<U> ? kind_t::I64 : kind_t::U64;
+    }
+  } else {
+    static_assert(dependent_false<U>, "unsupported argument for a deferred log");
+  }
+}
+
+struct header_t {
+  /// the id of the message
+  const char *fmt;
+  const char *tag;
+  /// `esp_log_timestamp`
+  uint32_t ts_ms;
+  /// `esp_log_level_t`
+  uint8_t level;
+  uint8_t nargs;
+  kind_t kinds[MAX_ARGS];
+};
+
+/// the bytes of `s` to copy, `MAX_STR_LEN` at most
+inline std::string_view view_of(const char *s) {
+  return s == nullptr ? std::string_view{} : std::string_view(s, strnlen(s, MAX_STR_LEN));
+}
+inline std::string_view view_of(const str_t &s) {
+  return s.s.substr(0, MAX_STR_LEN);
+}
+
+template <typename T>
+size_t size_of(const T &arg) {
+  constexpr auto kind = kind_of<T>();
+  if constexpr (kind == kind_t::STR) {
+    return 1 + view_of(arg).size();
+  } else if constexpr (kind == kind_t::HEX) {
+    return 1 + std::min(arg.size, MAX_HEX_LEN);
+  } else if constexpr (kind == kind_t::I64 || kind == kind_t::U64 || kind == kind_t::F64) {
+    return 8;
+  } else if constexpr (kind == kind_t::PTR) {
+    return sizeof(uintptr_t);
+  } else {
+    return 4;
+  }
+}
+
+/// @return the end of the written argument
+template <typename T>
+uint8_t *put(uint8_t *p, const T &arg) {
+  constexpr auto kind = kind_of<T>();
+  auto raw            = [&p](const auto &v) {
+    std::memcpy(p, &v, sizeof(v));
+    p += sizeof(v);
+  };
+  if constexpr (kind == kind_t::STR) {
+    const auto v = view_of(arg);
+    *p++         = static_cast<uint8_t>(v.size());
+    std::memcpy(p, v.data(), v.size());
+    p += v.size();
+  } else if constexpr (kind == kind_t::HEX) {
+    const auto n = std::min(arg.size, MAX_HEX_LEN);
+    *p++         = static_cast<uint8_t>(n);
+    std::memcpy(p, arg.data, n);
+    p += n;
+  } else if constexpr (kind == kind_t::F64) {
+    raw(static_cast<double>(arg));
+  } else if constexpr (kind == kind_t::I64) {
+    raw(static_cast<int64_t>(arg));
+  } else if constexpr (kind == kind_t::U64) {
+    raw(static_cast<uint64_t>(arg));
+  } else if constexpr (kind == kind_t::I32) {
+    raw(static_cast<int32_t>(arg));
+  } else if constexpr (kind == kind_t::U32) {
+    raw(static_cast<uint32_t>(arg));
+  } else {
+    raw(reinterpret_cast<uintptr_t>(arg));
+  }
+  return p;
+}
+
+/// the size of the record of `args`
+template <typename... Args>
+size_t record_size(const Args &...args) {
+  return sizeof(header_t) + (size_t{0} + ... + size_of(args));
+}
+
+/**
+ * @brief write the header and the arguments
+ * @param record should be `record_size(args...)` long at least
+ */
+template <typename... Args>
+void encode(uint8_t *record, uint8_t level, uint32_t ts_ms, const char *tag, const char *fmt, const Args &...args) {
+  static_assert(sizeof...(Args) <= MAX_ARGS, "too many arguments for a deferred log");
+  auto header = header_t{fmt, tag, ts_ms, level, sizeof...(Args), {kind_of<Args>()...}};
+  std::memcpy(record, &header, sizeof(header));
+  [[maybe_unused]] auto *p = record + sizeof(header);
+  ((p = put(p, args)), ...);
+}
+
+/**
+ * @brief format a record written by `encode`
+ * @note a `hex_t` ignores the width and the precision. A conversion without an argument is printed as is
+ * @return the length of the message in `out`, which is always null terminated
+ */
+size_t render(const uint8_t *record, size_t size, char *out, size_t out_size);
+
+/**
+ * @brief reserve the space in the ring. nullptr if it's full
+ * @note should be followed by `commit`
+ */
+uint8_t *acquire(size_t size);
+void commit(uint8_t *record);
+
+/**
+ * @brief create the ring and the printing task
+ */
+bool start();
+
+/// `esp_log_timestamp`
+uint32_t timestamp();
+
+/// the messages dropped since boot
+uint32_t dropped();
+
+/**
+ * @brief drop the messages above `level` (`esp_log_level_t`) at the call site, without counting them
+ * @note the compile time `LOG_LOCAL_LEVEL` still applies. it's `ESP_LOG_VERBOSE` by default
+ */
+void set_level(uint8_t level);
+uint8_t level();
+
+/// how full the ring is, in percent
+uint8_t usage_percent();
+
+template <typename... Args>
+void write(uint8_t level, const char *tag, const char *fmt, const Args &...args) {
+  if (level > defer_log::level()) {
+    return;
+  }
+  auto *record = acquire(record_size(args...));
+  if (record == nullptr) {
+    return;
+  }
+  encode(record, level, timestamp(), tag, fmt, args...);
+  commit(record);
+}
+
+/// format in place, the same way as the printing task. the record takes about 2 KiB of the stack
+template <typename... Args>
+std::array<char, MAX_MESSAGE_LEN> format(const char *fmt, const Args &...args) {
+  uint8_t record[sizeof(header_t) + MAX_ARGS * (1 + MAX_HEX_LEN)];
+  encode(record, 0, 0, nullptr, fmt, args...);
+  auto out = std::array<char, MAX_MESSAGE_LEN>{};
+  render(record, record_size(args...), out.data(), out.size());
+  return out;
+}
+}
+
+#ifdef ESP_PLATFORM
+#include <esp_log.h>
+#define DLOG_LEVEL(level, tag, fmt, ...)                       \
+  do {                                                         \
+    if constexpr (LOG_LOCAL_LEVEL >= (level)) {                \
+      defer_log::write((level), tag, fmt, ##__VA_ARGS__);      \
+    }                                                          \
+  } while (0)
+#define DLOGE(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define DLOGW(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define DLOGI(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define DLOGD(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define DLOGV(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+#elif defined(SIMPLE_LOG)
+#include "simple_log.h"
+// `str_t` and `hex_t` can't go through the varargs of `LOGx`
+#define DLOGE(tag, fmt, ...) LOGE(tag, "%s", defer_log::format(fmt, ##__VA_ARGS__).data())
+#define DLOGW(tag, fmt, ...) LOGW(tag, "%s", defer_log::format(fmt, ##__VA_ARGS__).data())
+#define DLOGI(tag, fmt, ...) LOGI(tag, "%s", defer_log::format(fmt, ##__VA_ARGS__).data())
+#define DLOGD(tag, fmt, ...) LOGD(tag, "%s", defer_log::format(fmt, ##__VA_ARGS__).data())
+#define DLOGV(tag, fmt, ...) LOGT(tag, "%s", defer_log::format(fmt, ##__VA_ARGS__).data())
+#endif
+
+#endif // TRACK_SHORT_DEFER_LOG_H
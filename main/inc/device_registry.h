@@ -0,0 +1,327 @@
+//
+// Created by Kurosu Chan on 2023/11/24.
+//
+
+#ifndef TRACK_SHORT_DEVICE_REGISTRY_H
+#define TRACK_SHORT_DEVICE_REGISTRY_H
+
+#include <atomic>
+#include <mutex>
+#include <array>
+#include <etl/array.h>
+#include <etl/optional.h>
+#include "name_table.h"
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+class NimBLEClient;
+
+/**
+ * @brief the connected (or once connected) HR bands, shared by the scan callback,
+ *        the connect tasks and the client disconnect callbacks
+ * @note a fixed open addressing table keyed by MAC.
+ *       Every slot is published with a sequence lock, so `find` doesn't take the lock (it retries
+ *       if it races with a writer, see `utils::seqlock_t`), and all writers are serialized by `write_mutex`.
+ *       The client of a band is kept after disconnection so that it could be reused by the
+ *       next connection, which is the only safe way to not delete a client under someone's feet.
+ *       A band without a client (a failed connection, or its client taken over by another band)
+ *       is removed, leaving a tombstone so that the probe of the others goes on. NimBLE caps the
+ *       clients, so the bands kept are bounded by that rather than the bands ever seen.
+ *       The name of a band is held (see `name_table`) from `claim` until it's disconnected.
+ */
+namespace device_registry {
+constexpr auto BLE_MAC_ADDR_SIZE = 6;
+/// should be a power of 2
+constexpr size_t SLOTS        = 32;
+constexpr size_t MAX_ENTRIES  = 24;
+using addr_t                  = etl::array<uint8_t, BLE_MAC_ADDR_SIZE>;
+static_assert(MAX_ENTRIES < SLOTS, "keep some empty slots to end the probe");
+
+enum class state_t : uint8_t {
+  DISCONNECTED = 0,
+  /// a connect task is working on it
+  CONNECTING,
+  CONNECTED,
+};
+
+struct entry_t {
+  addr_t addr{};
+  NimBLEClient *client = nullptr;
+  state_t state        = state_t::DISCONNECTED;
+};
+
+class Registry {
+  // meta layout: addr[4] | addr[5] << 8 | state << 16 | flags << 24
+  static constexpr uint32_t FLAG_USED    = 0x01;
+  /// disconnected while the connect task is still working on it
+  static constexpr uint32_t FLAG_DROPPED = 0x02;
+  /// a removed entry. free for an insert, but a probe should go on
+  static constexpr uint32_t FLAG_TOMB    = 0x04;
+
+  struct slot_t {
+    std::atomic<uint32_t> seq{0};
+    std::atomic<uint32_t> addr_lo{0};
+    std::atomic<uint32_t> meta{0};
+    std::atomic<NimBLEClient *> client{nullptr};
+    /// only touched with `write_mutex` held
+    name_table::handle_t name = name_table::INVALID;
+  };
+
+  std::array<slot_t, SLOTS> slots{};
+  std::mutex write_mutex{};
+  std::atomic<size_t> _size{0};
+
+  static uint32_t lo_of(const addr_t &addr) {
+    return addr[0] | (addr[1] << 8) | (addr[2] << 16) | (static_cast<uint32_t>(addr[3]) << 24);
+  }
+  static uint32_t meta_of(const addr_t &addr, state_t state, uint32_t flags) {
+    return addr[4] | (addr[5] << 8) | (static_cast<uint32_t>(state) << 16) | (flags << 24);
+  }
+  static bool same_addr(uint32_t lo, uint32_t meta, const addr_t &addr) {
+    return lo == lo_of(addr) && (meta & 0xffff) == static_cast<uint32_t>(addr[4] | (addr[5] << 8));
+  }
+  static state_t state_of(uint32_t meta) {
+    return static_cast<state_t>((meta >> 16) & 0xff);
+  }
+  static uint32_t flags_of(uint32_t meta) {
+    return meta >> 24;
+  }
+  static size_t slot_of(const addr_t &addr) {
+    uint32_t h = 2166136261u;
+    for (auto b : addr) {
+      h ^= b;
+      h *= 16777619u;
+    }
+    return h & (SLOTS - 1);
+  }
+
+  struct snapshot_t {
+    uint32_t addr_lo;
+    uint32_t meta;
+    NimBLEClient *client;
+  };
+
+  /// seqlock read. backs off for a tick if it keeps racing with a writer preempted on the same core
+  static snapshot_t read(const slot_t &s) {
+#ifdef ESP_PLATFORM
+    constexpr auto MAX_SPINS = 16;
+#endif
+    for ([[maybe_unused]] auto spins = 0;; ++spins) {
+#ifdef ESP_PLATFORM
+      if (spins >= MAX_SPINS) {
+        vTaskDelay(1);
+        spins = 0;
+      }
+#endif
+      const auto s1 = s.seq.load(std::memory_order_acquire);
+      if (s1 & 1) {
+        continue;
+      }
+      auto snap = snapshot_t{
+          s.addr_lo.load(std::memory_order_relaxed),
+          s.meta.load(std::memory_order_relaxed),
+          s.client.load(std::memory_order_relaxed),
+      };
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (s.seq.load(std::memory_order_relaxed) == s1) {
+        return snap;
+      }
+    }
+  }
+
+  /// should be called with `write_mutex` held
+  static void write(slot_t &s, uint32_t addr_lo, uint32_t meta, NimBLEClient *client) {
+    const auto seq = s.seq.load(std::memory_order_relaxed);
+    s.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.addr_lo.store(addr_lo, std::memory_order_relaxed);
+    s.meta.store(meta, std::memory_order_relaxed);
+    s.client.store(client, std::memory_order_relaxed);
+    s.seq.store(seq + 2, std::memory_order_release);
+  }
+
+  /// should be called with `write_mutex` held. returns nullptr if not found
+  slot_t *find_slot(const addr_t &addr) {
+    const auto start = slot_of(addr);
+    for (size_t i = 0; i < SLOTS; ++i) {
+      auto &s          = slots[(start + i) & (SLOTS - 1)];
+      const auto meta  = s.meta.load(std::memory_order_relaxed);
+      const auto flags = flags_of(meta);
+      if (flags & FLAG_TOMB) {
+        continue;
+      }
+      if (!(flags & FLAG_USED)) {
+        return nullptr;
+      }
+      if (same_addr(s.addr_lo.load(std::memory_order_relaxed), meta, addr)) {
+        return &s;
+      }
+    }
+    return nullptr;
+  }
+
+  /// should be called with `write_mutex` held, and `addr` should not be in the table. returns nullptr if full
+  slot_t *insert_slot(const addr_t &addr, state_t state, NimBLEClient *client) {
+    if (_size.load(std::memory_order_relaxed) >= MAX_ENTRIES) {
+      return nullptr;
+    }
+    const auto start = slot_of(addr);
+    for (size_t i = 0; i < SLOTS; ++i) {
+      auto &s = slots[(start + i) & (SLOTS - 1)];
+      // an empty slot or a tombstone
+      if (!(flags_of(s.meta.load(std::memory_order_relaxed)) & FLAG_USED)) {
+        write(s, lo_of(addr), meta_of(addr, state, FLAG_USED), client);
+        _size.fetch_add(1, std::memory_order_relaxed);
+        return &s;
+      }
+    }
+    return nullptr;
+  }
+
+  /// should be called with `write_mutex` held
+  static void release_name(slot_t &s) {
+    name_table::table.release(s.name);
+    s.name = name_table::INVALID;
+  }
+
+  /// should be called with `write_mutex` held
+  void remove_slot(slot_t &s) {
+    release_name(s);
+    write(s, 0, FLAG_TOMB << 24, nullptr);
+    _size.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+public:
+  /**
+   * @brief lookup without locking. O(1) on average
+   * @note only a hint, the entry could have changed when it returns
+   */
+  [[nodiscard]] etl::optional<entry_t> find(const addr_t &addr) const {
+    const auto start = slot_of(addr);
+    for (size_t i = 0; i < SLOTS; ++i) {
+      const auto snap  = read(slots[(start + i) & (SLOTS - 1)]);
+      const auto flags = flags_of(snap.meta);
+      if (flags & FLAG_TOMB) {
+        continue;
+      }
+      if (!(flags & FLAG_USED)) {
+        return etl::nullopt;
+      }
+      if (same_addr(snap.addr_lo, snap.meta, addr)) {
+        return entry_t{addr, snap.client, state_of(snap.meta)};
+      }
+    }
+    return etl::nullopt;
+  }
+
+  [[nodiscard]] size_t size() const {
+    return _size.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief claim the band for a connect task
+   * @param name a handle of `name_table::table`, whose reference is taken over if it's claimed
+   * @return the entry before claiming (the client might be reused),
+   *         or nullopt if it's connecting/connected already or the registry is full
+   */
+  etl::optional<entry_t> claim(const addr_t &addr, name_table::handle_t name) {
+    std::lock_guard<std::mutex> lk(write_mutex);
+    if (auto *s = find_slot(addr); s != nullptr) {
+      const auto meta = s->meta.load(std::memory_order_relaxed);
+      if (state_of(meta) != state_t::DISCONNECTED) {
+        return etl::nullopt;
+      }
+      auto *client = s->client.load(std::memory_order_relaxed);
+      write(*s, lo_of(addr), meta_of(addr, state_t::CONNECTING, FLAG_USED), client);
+      s->name = name;
+      return entry_t{addr, client, state_t::DISCONNECTED};
+    }
+    auto *s = insert_slot(addr, state_t::CONNECTING, nullptr);
+    if (s == nullptr) {
+      return etl::nullopt;
+    }
+    s->name = name;
+    return entry_t{addr, nullptr, state_t::DISCONNECTED};
+  }
+
+  /**
+   * @brief take over `client` from whichever disconnected band owns it and give it to `addr`
+   * @note the band losing its client is removed
+   * @return false if the client is owned by a band that is not disconnected
+   */
+  bool attach_client(const addr_t &addr, NimBLEClient *client) {
+    std::lock_guard<std::mutex> lk(write_mutex);
+    auto *target = find_slot(addr);
+    if (target == nullptr) {
+      return false;
+    }
+    for (auto &s : slots) {
+      const auto meta = s.meta.load(std::memory_order_relaxed);
+      if (&s == target || !(flags_of(meta) & FLAG_USED) || s.client.load(std::memory_order_relaxed) != client) {
+        continue;
+      }
+      if (state_of(meta) != state_t::DISCONNECTED) {
+        return false;
+      }
+      remove_slot(s);
+    }
+    write(*target, target->addr_lo.load(std::memory_order_relaxed), target->meta.load(std::memory_order_relaxed), client);
+    return true;
+  }
+
+  /**
+   * @brief the connect task is done with the band
+   * @param ok whether the band is connected and subscribed
+   * @note the band is removed if it's not connected and has no client to reuse
+   */
+  void finish_connect(const addr_t &addr, bool ok) {
+    std::lock_guard<std::mutex> lk(write_mutex);
+    auto *s = find_slot(addr);
+    if (s == nullptr) {
+      return;
+    }
+    const auto meta = s->meta.load(std::memory_order_relaxed);
+    if (state_of(meta) != state_t::CONNECTING) {
+      return;
+    }
+    const bool dropped = flags_of(meta) & FLAG_DROPPED;
+    const auto state   = ok && !dropped ? state_t::CONNECTED : state_t::DISCONNECTED;
+    auto *client       = s->client.load(std::memory_order_relaxed);
+    if (state == state_t::DISCONNECTED) {
+      if (client == nullptr) {
+        remove_slot(*s);
+        return;
+      }
+      release_name(*s);
+    }
+    write(*s, s->addr_lo.load(std::memory_order_relaxed), meta_of(addr, state, FLAG_USED), client);
+  }
+
+  /**
+   * @brief should be called when the client of the band is disconnected
+   * @note if a connect task is working on it, the task would decide the final state
+   */
+  void on_disconnected(const addr_t &addr) {
+    std::lock_guard<std::mutex> lk(write_mutex);
+    auto *s = find_slot(addr);
+    if (s == nullptr) {
+      return;
+    }
+    const auto meta = s->meta.load(std::memory_order_relaxed);
+    const auto lo   = s->addr_lo.load(std::memory_order_relaxed);
+    auto *client    = s->client.load(std::memory_order_relaxed);
+    if (state_of(meta) == state_t::CONNECTING) {
+      write(*s, lo, meta_of(addr, state_t::CONNECTING, FLAG_USED | FLAG_DROPPED), client);
+    } else if (client == nullptr) {
+      remove_slot(*s);
+    } else {
+      release_name(*s);
+      write(*s, lo, meta_of(addr, state_t::DISCONNECTED, FLAG_USED), client);
+    }
+  }
+};
+}
+
+#endif // TRACK_SHORT_DEVICE_REGISTRY_H
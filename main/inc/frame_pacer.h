@@ -0,0 +1,72 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_FRAME_PACER_H
+#define TRACK_SHORT_FRAME_PACER_H
+
+#include <cstdint>
+
+namespace lane {
+/**
+ * @brief the frame boundaries of `Lane::loop`, on the `esp_timer_get_time` clock
+ * @note a boundary that can't be made anymore is skipped instead of being shown late,
+ *       and the next frame covers the skipped ones, so the motion keeps up with the wall clock
+ */
+class pacer_t {
+  /// the boundary the prepared frame would be shown at
+  int64_t _next_us = 0;
+  /// 0 if not running
+  int64_t _period_us = 0;
+  /// the periods the prepared frame covers since the last one shown
+  uint32_t _frames = 1;
+
+public:
+  /// the first boundary is `now_us`
+  void start(int64_t now_us, int64_t period_us) {
+    _next_us   = now_us;
+    _period_us = period_us;
+    _frames    = 1;
+  }
+
+  void stop() {
+    _period_us = 0;
+  }
+
+  [[nodiscard]] bool running() const {
+    return _period_us != 0;
+  }
+
+  [[nodiscard]] int64_t period_us() const {
+    return _period_us;
+  }
+
+  [[nodiscard]] int64_t next_us() const {
+    return _next_us;
+  }
+
+  /// the time the prepared frame covers, in seconds
+  [[nodiscard]] float frame_s() const {
+    return static_cast<float>(_frames * _period_us) / 1'000'000.f;
+  }
+
+  /**
+   * @brief move to the next boundary once the frame is shown
+   * @param now_us after the frame is shown
+   * @return the boundaries skipped, which are covered by the next frame
+   */
+  uint32_t advance(int64_t now_us) {
+    _next_us += _period_us;
+    _frames = 1;
+    if (now_us <= _next_us) {
+      return 0;
+    }
+    const auto behind = static_cast<uint32_t>((now_us - _next_us) / _period_us + 1);
+    _next_us += behind * _period_us;
+    _frames += behind;
+    return behind;
+  }
+};
+}
+
+#endif // TRACK_SHORT_FRAME_PACER_H
@@ -0,0 +1,83 @@
+//
+// Created by Kurosu Chan on 2023/11/20.
+//
+
+#ifndef TRACK_SHORT_GATT_CACHE_H
+#define TRACK_SHORT_GATT_CACHE_H
+
+#include <mutex>
+#include <functional>
+#include <NimBLEDevice.h>
+#include <etl/array.h>
+#include <etl/flat_map.h>
+#include <etl/optional.h>
+#include <etl/vector.h>
+
+/**
+ * @brief cache of the GATT attribute handles of the heart rate bands
+ * @note a band keeps its attribute table between connections, so once we have discovered
+ *       the HR measurement characteristic we could subscribe it directly by handle
+ *       (a single CCCD write) instead of running the service/characteristic/descriptor discovery again.
+ */
+namespace gatt_cache {
+constexpr auto BLE_MAC_ADDR_SIZE = 6;
+constexpr auto MAX_ENTRIES       = 24;
+constexpr auto PREF_RECORD_NAME  = "gatt";
+
+using addr_t = etl::array<uint8_t, BLE_MAC_ADDR_SIZE>;
+
+struct handles_t {
+  /// value handle of the HR measurement characteristic (2A37)
+  uint16_t hr_value = 0;
+  /// handle of the Client Characteristic Configuration Descriptor (2902) of 2A37
+  uint16_t hr_cccd = 0;
+  [[nodiscard]] bool valid() const {
+    return hr_value != 0 && hr_cccd != 0;
+  }
+};
+
+/**
+ * @brief a fixed size MAC to handles map in RAM, optionally backed by NVS
+ */
+class HandleCache {
+  etl::flat_map<addr_t, handles_t, MAX_ENTRIES> entries{};
+  std::mutex mutex{};
+  bool persist = false;
+
+  void persist_put(const addr_t &addr, const handles_t &handles);
+  etl::optional<handles_t> persist_get(const addr_t &addr);
+  void persist_remove(const addr_t &addr);
+
+public:
+  /**
+   * @param persist whether to write the handles to NVS, so that they survive a reboot
+   */
+  explicit HandleCache(bool persist = false) : persist(persist) {}
+  etl::optional<handles_t> get(const addr_t &addr);
+  void put(const addr_t &addr, const handles_t &handles);
+  /// should be called when the cached handles turn out to be stale
+  void invalidate(const addr_t &addr);
+};
+
+using notify_fn = std::function<void(const uint8_t *data, size_t size)>;
+
+/**
+ * @brief subscribe the notification of `handles.hr_value` by writing the CCCD directly
+ * @note NimBLEClient would drop the notification of a characteristic it hasn't discovered,
+ *       so the notification is routed with a GAP event listener instead.
+ *       The route would be removed by `unroute` or when the connection is gone.
+ * @param client a connected client
+ * @param handles the cached handles
+ * @param addr the address of the peer, used to remove the route
+ * @param notify the callback when a notification of `hr_value` is received
+ * @return true if the CCCD is written successfully
+ */
+bool subscribe_by_handles(NimBLEClient &client, const handles_t &handles, const addr_t &addr, notify_fn notify);
+
+/**
+ * @brief remove the notification route of the peer (if any)
+ */
+void unroute(const addr_t &addr);
+}
+
+#endif // TRACK_SHORT_GATT_CACHE_H
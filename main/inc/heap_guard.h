@@ -0,0 +1,32 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_HEAP_GUARD_H
+#define TRACK_SHORT_HEAP_GUARD_H
+
+#include <chrono>
+#include <esp_err.h>
+
+// replace the global `operator new` to count the allocations after `arm`
+// #define HEAP_GUARD
+
+/**
+ * @brief report the heap usage after the initialization
+ * @note nothing should be allocated in the steady state, otherwise a long session
+ *       would fragment the heap. The free heap (and the largest free block) is always watched.
+ *       With `HEAP_GUARD`, the C++ allocations are counted and the last caller is logged,
+ *       which could be resolved with `addr2line`. The C allocations (NimBLE, lwIP, etc.)
+ *       only show up in the free heap.
+ */
+namespace heap_guard {
+constexpr auto DEFAULT_INTERVAL = std::chrono::seconds(30);
+
+/**
+ * @brief mark the end of the initialization, and report periodically from now on
+ * @note the report is a warning if anything is allocated since the last one
+ */
+esp_err_t arm(std::chrono::seconds interval);
+}
+
+#endif // TRACK_SHORT_HEAP_GUARD_H
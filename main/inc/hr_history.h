@@ -0,0 +1,377 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_HR_HISTORY_H
+#define TRACK_SHORT_HR_HISTORY_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "name_table.h"
+
+class NimBLEService;
+
+/**
+ * @brief the HR history of every device in the session, so that a phone reconnecting
+ *        in the middle of it could fetch what it has missed
+ * @note the samples are averaged into buckets of `PERIOD_MS`. The buckets are compressed into
+ *       a ring of fixed size blocks, and the oldest block is dropped when the ring is full.
+ *       A block starts with an absolute bucket and HR, and every code after it is one byte:
+ *         - `0b0xxxxxxx` the next bucket, whose HR is the last one plus the zigzag decoded `x`
+ *         - `0b1xxxxxxx` skip `x + 1` buckets without any sample
+ *       The time deltas are implicit (a delta-of-delta of 0), so only the gaps are written.
+ *       A new block is started for a jump of the HR that doesn't fit, or a gap longer than `MAX_GAP_CODES` codes.
+ *
+ *       The statistics are updated with every sample instead of the buckets, and cover the whole
+ *       session even if the oldest blocks are dropped.
+ */
+namespace hr_history {
+constexpr uint32_t PERIOD_MS = 2000;
+constexpr size_t BLOCK_CODES = 58;
+constexpr size_t BLOCKS      = 64;
+/// the least recently updated device is dropped for a new one
+constexpr size_t MAX_DEVICES = 8;
+/// the time between two samples further apart is not counted in any zone
+constexpr uint32_t MAX_GAP_MS = 5000;
+/// in bpm, 60/70/80/90% of a max HR of 190. below the first bound is zone 1
+constexpr std::array<uint8_t, 4> ZONE_BOUNDS = {114, 133, 152, 171};
+constexpr size_t ZONES                       = ZONE_BOUNDS.size() + 1;
+
+constexpr uint8_t GAP_FLAG     = 0x80;
+/// the buckets skipped by a gap code at most
+constexpr uint32_t MAX_GAP     = 0x80;
+constexpr int MAX_DELTA        = 63;
+constexpr size_t MAX_GAP_CODES = 4;
+constexpr auto SESSION         = std::chrono::hours(2);
+static_assert(BLOCKS * BLOCK_CODES * std::chrono::milliseconds(PERIOD_MS) >= SESSION,
+              "a session should fit in the ring without any gap");
+
+struct block_t {
+  /// in `PERIOD_MS` since boot
+  uint32_t start_bucket;
+  uint8_t hr0;
+  /// the codes in use
+  uint8_t len;
+  std::array<uint8_t, BLOCK_CODES> codes;
+};
+static_assert(sizeof(block_t) == 64, "keep a block 64 bytes");
+
+struct stats_t {
+  uint32_t samples = 0;
+  uint32_t sum     = 0;
+  uint8_t min      = 0;
+  uint8_t max      = 0;
+  /// `metrics::now_ms`
+  uint32_t first_ms = 0;
+  uint32_t last_ms  = 0;
+  std::array<uint32_t, ZONES> zone_ms{};
+
+  /// in 0.1 bpm
+  [[nodiscard]] uint16_t mean_x10() const {
+    return samples == 0 ? 0 : static_cast<uint16_t>(sum * 10 / samples);
+  }
+};
+
+constexpr size_t zone_of(uint8_t hr) {
+  size_t zone = 0;
+  while (zone < ZONE_BOUNDS.size() && hr >= ZONE_BOUNDS[zone]) {
+    ++zone;
+  }
+  return zone;
+}
+
+constexpr uint8_t zigzag(int v) {
+  return static_cast<uint8_t>(v >= 0 ? v * 2 : -v * 2 - 1);
+}
+
+constexpr int unzigzag(uint8_t v) {
+  return (v & 1) ? -static_cast<int>(v >> 1) - 1 : static_cast<int>(v >> 1);
+}
+
+/**
+ * @brief call `f(bucket, hr)` for every bucket in the block
+ */
+template <typename F>
+void decode(const block_t &block, F &&f) {
+  auto bucket = block.start_bucket;
+  int hr      = block.hr0;
+  f(bucket, static_cast<uint8_t>(hr));
+  for (size_t i = 0; i < block.len; ++i) {
+    const auto code = block.codes[i];
+    if (code & GAP_FLAG) {
+      bucket += (code & ~GAP_FLAG) + 1;
+      continue;
+    }
+    bucket += 1;
+    hr += unzigzag(code);
+    f(bucket, static_cast<uint8_t>(hr));
+  }
+}
+
+/// 'H' | period_s(1) | samples(4) | min(1) | max(1) | mean_x10(2) | first_ms(4) | last_ms(4) | zone_ms(4 * ZONES) | blocks(1)
+constexpr size_t SUMMARY_SIZE = 1 + 1 + 4 + 1 + 1 + 2 + 4 + 4 + 4 * ZONES + 1;
+/// start_bucket(4) | hr0(1) | len(1)
+constexpr size_t BLOCK_HEADER_SIZE = 6;
+/// the summary and every block, plus one for the bucket being averaged
+constexpr size_t MAX_EXPORT_SIZE = SUMMARY_SIZE + (BLOCKS + 1) * (BLOCK_HEADER_SIZE + BLOCK_CODES);
+constexpr uint8_t SUMMARY_MAGIC  = 'H';
+
+/**
+ * @brief the history of a device
+ * @note not thread safe
+ */
+class series_t {
+  stats_t _stats{};
+  std::array<block_t, BLOCKS> blocks{};
+  /// the oldest block
+  size_t head  = 0;
+  size_t count = 0;
+  /// the last bucket in the newest block
+  uint32_t last_bucket = 0;
+  uint8_t last_hr      = 0;
+  /// the bucket being averaged
+  uint32_t pending_bucket = 0;
+  uint32_t pending_sum    = 0;
+  uint16_t pending_n      = 0;
+  /// for the time in zone
+  uint8_t last_sample_hr = 0;
+
+  [[nodiscard]] uint8_t pending_hr() const {
+    return static_cast<uint8_t>((pending_sum + pending_n / 2) / pending_n);
+  }
+
+  void start_block(uint32_t bucket, uint8_t hr) {
+    if (count == BLOCKS) {
+      head = (head + 1) % BLOCKS;
+    } else {
+      ++count;
+    }
+    auto &b        = blocks[(head + count - 1) % BLOCKS];
+    b.start_bucket = bucket;
+    b.hr0          = hr;
+    b.len          = 0;
+    last_bucket    = bucket;
+    last_hr        = hr;
+  }
+
+  void append(uint32_t bucket, uint8_t hr) {
+    if (count == 0) {
+      start_block(bucket, hr);
+      return;
+    }
+    auto &b          = blocks[(head + count - 1) % BLOCKS];
+    const auto gap   = bucket - last_bucket - 1;
+    const auto delta = static_cast<int>(hr) - last_hr;
+    const auto codes = (gap + MAX_GAP - 1) / MAX_GAP + 1;
+    if (bucket <= last_bucket || delta > MAX_DELTA || delta < -MAX_DELTA - 1 ||
+        codes > MAX_GAP_CODES + 1 || b.len + codes > BLOCK_CODES) {
+      start_block(bucket, hr);
+      return;
+    }
+    for (auto left = gap; left > 0;) {
+      const auto n     = std::min<uint32_t>(left, MAX_GAP);
+      b.codes[b.len++] = GAP_FLAG | static_cast<uint8_t>(n - 1);
+      left -= n;
+    }
+    b.codes[b.len++] = zigzag(delta);
+    last_bucket      = bucket;
+    last_hr          = hr;
+  }
+
+  static void put_u16(uint8_t *&p, uint16_t v) {
+    std::memcpy(p, &v, sizeof(v));
+    p += sizeof(v);
+  }
+  static void put_u32(uint8_t *&p, uint32_t v) {
+    std::memcpy(p, &v, sizeof(v));
+    p += sizeof(v);
+  }
+  static void put_block(uint8_t *&p, uint32_t start_bucket, uint8_t hr0, const uint8_t *codes, uint8_t len) {
+    put_u32(p, start_bucket);
+    *p++ = hr0;
+    *p++ = len;
+    std::memcpy(p, codes, len);
+    p += len;
+  }
+
+public:
+  void add(uint32_t now_ms, uint8_t hr) {
+    if (hr == 0) {
+      return;
+    }
+    auto &s = _stats;
+    if (s.samples == 0) {
+      s.min      = hr;
+      s.max      = hr;
+      s.first_ms = now_ms;
+    } else {
+      const auto elapsed = now_ms - s.last_ms;
+      if (elapsed <= MAX_GAP_MS) {
+        s.zone_ms[zone_of(last_sample_hr)] += elapsed;
+      }
+      s.min = std::min(s.min, hr);
+      s.max = std::max(s.max, hr);
+    }
+    s.samples += 1;
+    s.sum += hr;
+    s.last_ms      = now_ms;
+    last_sample_hr = hr;
+
+    const auto bucket = now_ms / PERIOD_MS;
+    // a sample a little out of order (from another task) goes to the current bucket
+    if (pending_n != 0 && bucket > pending_bucket) {
+      append(pending_bucket, pending_hr());
+      pending_sum = 0;
+      pending_n   = 0;
+    }
+    if (pending_n == 0) {
+      pending_bucket = bucket;
+    }
+    pending_sum += hr;
+    pending_n += 1;
+  }
+
+  /// in place, since a series is too large for the stack of the tasks calling it
+  void clear() {
+    _stats         = stats_t{};
+    head           = 0;
+    count          = 0;
+    last_bucket    = 0;
+    last_hr        = 0;
+    pending_bucket = 0;
+    pending_sum    = 0;
+    pending_n      = 0;
+    last_sample_hr = 0;
+  }
+
+  [[nodiscard]] const stats_t &stats() const {
+    return _stats;
+  }
+
+  /// the blocks in use, without the bucket being averaged
+  [[nodiscard]] size_t blocks_count() const {
+    return count;
+  }
+
+  /// the blocks from the oldest
+  [[nodiscard]] const block_t &block(size_t i) const {
+    return blocks[(head + i) % BLOCKS];
+  }
+
+  /**
+   * @brief the summary and the blocks from the oldest, see `SUMMARY_SIZE` and `BLOCK_HEADER_SIZE`
+   * @note the bucket being averaged is a block without any code at the end
+   * @return the bytes written, 0 if `size` is less than `MAX_EXPORT_SIZE`
+   */
+  size_t serialize(uint8_t *out, size_t size) const {
+    if (size < MAX_EXPORT_SIZE) {
+      return 0;
+    }
+    const auto &s = _stats;
+    auto *p       = out;
+    *p++          = SUMMARY_MAGIC;
+    *p++          = PERIOD_MS / 1000;
+    put_u32(p, s.samples);
+    *p++ = s.min;
+    *p++ = s.max;
+    put_u16(p, s.mean_x10());
+    put_u32(p, s.first_ms);
+    put_u32(p, s.last_ms);
+    for (const auto ms : s.zone_ms) {
+      put_u32(p, ms);
+    }
+    *p++ = static_cast<uint8_t>(count + (pending_n != 0 ? 1 : 0));
+    for (size_t i = 0; i < count; ++i) {
+      const auto &b = block(i);
+      put_block(p, b.start_bucket, b.hr0, b.codes.data(), b.len);
+    }
+    if (pending_n != 0) {
+      put_block(p, pending_bucket, pending_hr(), nullptr, 0);
+    }
+    return p - out;
+  }
+};
+
+/**
+ * @brief the histories of the `MAX_DEVICES` most recently updated devices
+ * @note not thread safe. ~4 KB for each device
+ */
+class store_t {
+  struct slot_t {
+    name_table::handle_t name = name_table::INVALID;
+    /// `metrics::now_ms` of the last sample
+    uint32_t last_ms = 0;
+    series_t series{};
+  };
+  std::array<slot_t, MAX_DEVICES> slots{};
+
+public:
+  /// nullptr if the device is unknown
+  [[nodiscard]] const series_t *find(name_table::handle_t name) const {
+    if (name == name_table::INVALID) {
+      return nullptr;
+    }
+    for (const auto &slot : slots) {
+      if (slot.name == name) {
+        return &slot.series;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief add a sample of the device. a new device takes a free slot, or the least recently updated one
+   * @return the device dropped for a new one, `INVALID` if none
+   */
+  name_table::handle_t add(name_table::handle_t name, uint32_t now_ms, uint8_t hr) {
+    auto dropped = name_table::INVALID;
+    auto *slot   = static_cast<slot_t *>(nullptr);
+    for (auto &s : slots) {
+      if (s.name == name) {
+        slot = &s;
+        break;
+      }
+    }
+    if (slot == nullptr) {
+      slot = &slots[0];
+      for (auto &s : slots) {
+        if (s.name == name_table::INVALID) {
+          slot = &s;
+          break;
+        }
+        if (now_ms - s.last_ms > now_ms - slot->last_ms) {
+          slot = &s;
+        }
+      }
+      dropped    = slot->name;
+      slot->name = name;
+      slot->series.clear();
+    }
+    slot->last_ms = now_ms;
+    slot->series.add(now_ms, hr);
+    return dropped;
+  }
+};
+
+/**
+ * @brief add a sample of the device to its history
+ * @param name a handle of `name_table::table` held by the caller. the history takes its own reference,
+ *        which is given back when the device is dropped
+ * @note safe to call from any task
+ */
+void record(name_table::handle_t name, uint8_t hr);
+
+/**
+ * @brief add the history characteristic to the HR service
+ * @note write the name of a device to take a snapshot of its history, which is returned by the
+ *       following reads in chunks of the MTU, and an empty value at the end (or if the device is unknown).
+ *       The chunks concatenated are the output of `series_t::serialize`.
+ */
+void initBLE(NimBLEService &service);
+}
+
+#endif // TRACK_SHORT_HR_HISTORY_H
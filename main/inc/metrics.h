@@ -0,0 +1,159 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_METRICS_H
+#define TRACK_SHORT_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "diag.pb.h"
+
+class NimBLEService;
+
+/**
+ * @brief the runtime metrics, served as a single `Metrics` snapshot over BLE
+ * @note every metric is a relaxed atomic, so it could be updated from any task (or the NimBLE host)
+ *       without a lock. A snapshot is not consistent across the metrics, which is fine for diagnostics.
+ *       All the counters wrap around.
+ */
+namespace metrics {
+/// should match the `max_count` of `Histogram.bounds` in `diag.options`
+constexpr size_t HISTOGRAM_BUCKETS = 8;
+
+class counter_t {
+  std::atomic<uint32_t> value{0};
+
+public:
+  void inc(uint32_t n = 1) {
+    value.fetch_add(n, std::memory_order_relaxed);
+  }
+  [[nodiscard]] uint32_t load() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+/// the last value written
+class gauge_t {
+  std::atomic<uint32_t> value{0};
+
+public:
+  void set(uint32_t v) {
+    value.store(v, std::memory_order_relaxed);
+  }
+  [[nodiscard]] uint32_t load() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+/**
+ * @brief fixed bucket histogram
+ * @note a sample goes to the first bucket whose upper bound (inclusive) is not less than it,
+ *       or the overflow bucket
+ */
+class histogram_t {
+public:
+  using bounds_t = std::array<uint32_t, HISTOGRAM_BUCKETS>;
+
+private:
+  bounds_t bounds;
+  std::array<std::atomic<uint32_t>, HISTOGRAM_BUCKETS + 1> counts{};
+  std::atomic<uint32_t> sum{0};
+  std::atomic<uint32_t> max{0};
+
+public:
+  /// @param bounds ascending
+  constexpr explicit histogram_t(bounds_t bounds) : bounds(bounds) {}
+
+  void record(uint32_t sample) {
+    size_t i = 0;
+    while (i < bounds.size() && sample > bounds[i]) {
+      ++i;
+    }
+    counts[i].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(sample, std::memory_order_relaxed);
+    auto m = max.load(std::memory_order_relaxed);
+    while (sample > m && !max.compare_exchange_weak(m, sample, std::memory_order_relaxed)) {}
+  }
+
+  void snapshot(::Histogram &out) const;
+};
+
+/**
+ * @brief events per second, counted in whole second windows
+ * @note `tick` should only be called by a single task. the rate could be read from any task.
+ */
+class rate_t {
+  std::atomic<uint32_t> last{0};
+  /// in ms
+  std::atomic<uint32_t> window_start{0};
+  uint32_t count = 0;
+
+public:
+  void tick(uint32_t now_ms) {
+    const auto elapsed = now_ms - window_start.load(std::memory_order_relaxed);
+    if (elapsed >= 1000) {
+      // a window followed by an idle one is not "per second" anymore
+      last.store(elapsed < 2000 ? count : 0, std::memory_order_relaxed);
+      window_start.store(now_ms, std::memory_order_relaxed);
+      count = 0;
+    }
+    ++count;
+  }
+  /// 0 if nothing is ticked in the last whole second
+  [[nodiscard]] uint32_t per_second(uint32_t now_ms) const {
+    const auto elapsed = now_ms - window_start.load(std::memory_order_relaxed);
+    return elapsed < 2000 ? last.load(std::memory_order_relaxed) : 0;
+  }
+};
+
+struct registry_t {
+  /********* lane *********/
+  counter_t frames;
+  counter_t frame_misses;
+  /// `iterate` + `show` of a frame, in us. the frame period is 100 ms at the default FPS
+  histogram_t frame_us{{2'000, 5'000, 10'000, 20'000, 30'000, 50'000, 75'000, 100'000}};
+  /// how late `show` starts after the frame boundary, in us
+  histogram_t frame_jitter_us{{50, 100, 250, 500, 1'000, 2'000, 5'000, 10'000}};
+
+  /********* LoRa *********/
+  counter_t rx_packets;
+  /// could not be read, or unknown magic
+  counter_t rx_dropped;
+  /// known magic but failed to unmarshal
+  counter_t rx_malformed;
+  counter_t tx_packets;
+  counter_t tx_failed;
+  /// wraps every ~71 minutes of airtime
+  counter_t tx_airtime_us;
+
+  /********* BLE *********/
+  counter_t hr_notify_sent;
+  counter_t hr_notify_failed;
+  counter_t hr_notify_skipped;
+  counter_t scan_results;
+  /// ticked by the NimBLE host task
+  rate_t scan_rate;
+
+  /********* QoS *********/
+  /// `qos::level_t`
+  gauge_t qos_level;
+};
+
+extern registry_t registry;
+
+/// the lower 32 bits of `esp_timer_get_time` in ms, for `rate_t`
+uint32_t now_ms();
+
+void snapshot(::Metrics &out);
+
+/**
+ * @brief add the read-only `Metrics` characteristic to the diagnostics service
+ * @note the snapshot is taken on every read
+ */
+void initBLE(NimBLEService &service);
+}
+
+#endif // TRACK_SHORT_METRICS_H
@@ -0,0 +1,166 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_NAME_TABLE_H
+#define TRACK_SHORT_NAME_TABLE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <etl/string.h>
+
+/**
+ * @brief the names of the HR devices, interned once when a device is learned
+ *        (a LoRa repeater status, a band to connect, or a watch advertising its HR),
+ *        so that the hot paths pass a one byte handle instead of a string
+ * @note every `intern` takes a reference to the name, which should be given back by `release`.
+ *       A name without any reference is kept (and found again by `intern`) until its slot is
+ *       taken by a new name once the table is full, so a handle is only stable while it's held.
+ *       `view` never blocks, and the others are serialized by `mutex`.
+ *       A name longer than `MAX_NAME_LENGTH` is truncated, and `intern` fails if every name is held.
+ *       It takes `CAPACITY * (MAX_NAME_LENGTH + 1)` bytes and a little more.
+ */
+namespace name_table {
+/// the same as the fixed white list
+constexpr size_t MAX_NAME_LENGTH = 31;
+constexpr size_t CAPACITY        = 64;
+using handle_t                   = uint8_t;
+using name_t                     = etl::string<MAX_NAME_LENGTH>;
+constexpr handle_t INVALID       = 0xff;
+static_assert(CAPACITY < INVALID, "INVALID should not be a valid handle");
+
+class Table {
+  std::array<name_t, CAPACITY> names{};
+  /// compared before the names
+  std::array<uint32_t, CAPACITY> hashes{};
+  /// the holders of each name
+  std::array<uint16_t, CAPACITY> refs{};
+  /// the slots ever used
+  std::atomic<size_t> _size{0};
+  /// where to look for a slot to reclaim next, so that a released name is kept as long as possible
+  size_t reclaim_cursor = 0;
+  std::mutex mutex{};
+
+  static std::string_view truncate(std::string_view name) {
+    return name.substr(0, MAX_NAME_LENGTH);
+  }
+
+  static uint32_t hash_of(std::string_view name) {
+    uint32_t h = 2166136261u;
+    for (auto c : name) {
+      h ^= static_cast<uint8_t>(c);
+      h *= 16777619u;
+    }
+    return h;
+  }
+
+  /// should be called with `mutex` held. @param name truncated already
+  [[nodiscard]] handle_t find(std::string_view name, uint32_t hash) const {
+    const auto n = _size.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i) {
+      if (hashes[i] == hash && std::string_view(names[i].data(), names[i].size()) == name) {
+        return static_cast<handle_t>(i);
+      }
+    }
+    return INVALID;
+  }
+
+  /// should be called with `mutex` held. an unused slot, or one whose name is not held by anyone
+  handle_t take_slot() {
+    const auto n = _size.load(std::memory_order_relaxed);
+    if (n < CAPACITY) {
+      _size.store(n + 1, std::memory_order_release);
+      return static_cast<handle_t>(n);
+    }
+    for (size_t i = 0; i < CAPACITY; ++i) {
+      const auto slot = (reclaim_cursor + i) % CAPACITY;
+      if (refs[slot] == 0) {
+        reclaim_cursor = (slot + 1) % CAPACITY;
+        return static_cast<handle_t>(slot);
+      }
+    }
+    return INVALID;
+  }
+
+public:
+  /**
+   * @brief take a reference to `name`, which is added if it's not in the table
+   * @return `INVALID` if every name in the table is held
+   */
+  handle_t intern(std::string_view name) {
+    name         = truncate(name);
+    const auto h = hash_of(name);
+    std::lock_guard<std::mutex> lk(mutex);
+    auto handle = find(name, h);
+    if (handle == INVALID) {
+      handle = take_slot();
+      if (handle == INVALID) {
+        return INVALID;
+      }
+      names[handle].assign(name.data(), name.size());
+      hashes[handle] = h;
+    }
+    refs[handle] += 1;
+    return handle;
+  }
+
+  /**
+   * @brief take another reference to a name held by the caller
+   * @return false if `handle` is not held by anyone
+   */
+  bool acquire(handle_t handle) {
+    std::lock_guard<std::mutex> lk(mutex);
+    if (handle >= CAPACITY || refs[handle] == 0) {
+      return false;
+    }
+    refs[handle] += 1;
+    return true;
+  }
+
+  /// give back a reference taken by `intern` or `acquire`. `INVALID` is ignored
+  void release(handle_t handle) {
+    std::lock_guard<std::mutex> lk(mutex);
+    if (handle >= CAPACITY || refs[handle] == 0) {
+      return;
+    }
+    refs[handle] -= 1;
+  }
+
+  /**
+   * @return `INVALID` if `name` is not in the table
+   * @note no reference is taken, so the handle could be taken by another name at any time
+   */
+  [[nodiscard]] handle_t lookup(std::string_view name) {
+    name = truncate(name);
+    std::lock_guard<std::mutex> lk(mutex);
+    return find(name, hash_of(name));
+  }
+
+  /**
+   * @return empty if the handle is invalid
+   * @note the view is only stable while the handle is held
+   */
+  [[nodiscard]] std::string_view view(handle_t handle) const {
+    if (handle >= _size.load(std::memory_order_acquire)) {
+      return {};
+    }
+    const auto &name = names[handle];
+    return {name.data(), name.size()};
+  }
+
+  /// the names held by anyone
+  [[nodiscard]] size_t held() {
+    std::lock_guard<std::mutex> lk(mutex);
+    return std::count_if(refs.begin(), refs.end(), [](auto r) { return r != 0; });
+  }
+};
+
+/// shared by the LoRa, the scan and the BLE paths
+extern Table table;
+}
+
+#endif // TRACK_SHORT_NAME_TABLE_H
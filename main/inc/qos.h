@@ -0,0 +1,165 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_QOS_H
+#define TRACK_SHORT_QOS_H
+
+#include <chrono>
+#include <cstdint>
+#include <etl/delegate.h>
+
+/**
+ * @brief step down the less important work when the lane can't keep its frame rate, and back up once it can
+ * @note the load is sampled every `SAMPLE_INTERVAL`: the frame boundaries missed by the lane, and how full
+ *       the queues are (the lane commands, the connect queue and the deferred log ring).
+ *       Every overloaded window goes one level down, and `recover_windows` calm windows in a row go one level up.
+ *       The levels are cumulative.
+ *
+ *       A missed boundary is skipped by `Lane::loop` and the next frame covers it (see `lane::pacer_t`),
+ *       so the lane keeps its distance but stutters. The governor makes the skips rare.
+ */
+namespace qos {
+constexpr auto SAMPLE_INTERVAL = std::chrono::seconds(1);
+
+enum class level_t : uint8_t {
+  NORMAL = 0,
+  /// the lane shows every `FPS_DIVIDER`th frame
+  REDUCED_FPS,
+  /// the lane state every `NOTIFY_DIVIDER` notify periods, and the HR records `HR_NOTIFY_MIN_INTERVAL` apart
+  SLOW_NOTIFY,
+  /**
+   * @brief the scan duty cycle is `SLOW_SCAN_WINDOW_MS / SLOW_SCAN_INTERVAL_MS`
+   * @note the scan started by `app_main` is restarted with the new parameters
+   */
+  SLOW_SCAN,
+  /// only the warnings and the errors are logged
+  QUIET_LOG,
+};
+constexpr auto MAX_LEVEL = level_t::QUIET_LOG;
+
+constexpr uint8_t FPS_DIVIDER            = 2;
+constexpr uint8_t NOTIFY_DIVIDER         = 4;
+constexpr auto HR_NOTIFY_MIN_INTERVAL    = std::chrono::milliseconds(100);
+constexpr uint16_t SLOW_SCAN_INTERVAL_MS = 400;
+constexpr uint16_t SLOW_SCAN_WINDOW_MS   = 40;
+
+/// the load of a sample window
+struct sample_t {
+  uint32_t frames;
+  uint32_t frame_misses;
+  /// the fullest queue, in percent of its capacity
+  uint8_t queue_percent;
+};
+
+struct thresholds_t {
+  /// overloaded if more than this percent of the frame boundaries are missed
+  uint8_t overload_miss_percent = 5;
+  /// calm if no more than this percent of the frame boundaries are missed
+  uint8_t calm_miss_percent = 0;
+  uint8_t overload_queue_percent = 75;
+  uint8_t calm_queue_percent     = 25;
+  /// the calm windows in a row to go one level up
+  uint8_t recover_windows = 5;
+};
+
+/**
+ * @brief the levels without the side effects
+ * @note between the overload and the calm thresholds, the level is kept
+ */
+class governor_t {
+  thresholds_t th;
+  level_t _level       = level_t::NORMAL;
+  uint8_t calm_windows = 0;
+
+  /// whether `part` is more than `percent` of `total`
+  static bool above(uint32_t part, uint32_t total, uint8_t percent) {
+    return static_cast<uint64_t>(part) * 100 > static_cast<uint64_t>(total) * percent;
+  }
+
+public:
+  explicit governor_t(thresholds_t th = {}) : th(th) {}
+
+  [[nodiscard]] level_t level() const {
+    return _level;
+  }
+
+  [[nodiscard]] bool overloaded(const sample_t &s) const {
+    return above(s.frame_misses, s.frames + s.frame_misses, th.overload_miss_percent) ||
+           s.queue_percent >= th.overload_queue_percent;
+  }
+
+  [[nodiscard]] bool calm(const sample_t &s) const {
+    return !above(s.frame_misses, s.frames + s.frame_misses, th.calm_miss_percent) &&
+           s.queue_percent <= th.calm_queue_percent;
+  }
+
+  /// @return the level for the next window
+  level_t update(const sample_t &s) {
+    if (overloaded(s)) {
+      calm_windows = 0;
+      if (_level != MAX_LEVEL) {
+        _level = static_cast<level_t>(static_cast<uint8_t>(_level) + 1);
+      }
+      return _level;
+    }
+    if (!calm(s) || _level == level_t::NORMAL) {
+      calm_windows = 0;
+      return _level;
+    }
+    if (++calm_windows >= th.recover_windows) {
+      calm_windows = 0;
+      _level       = static_cast<level_t>(static_cast<uint8_t>(_level) - 1);
+    }
+    return _level;
+  }
+};
+
+/**
+ * @brief what the governor adjusts outside of this module
+ * @note called by the timer task
+ */
+struct hooks_t {
+  /// `Lane::setFpsDivider`
+  etl::delegate<void(uint8_t divider)> set_fps_divider;
+  /// `Lane::setNotifyDivider`
+  etl::delegate<void(uint8_t divider)> set_notify_divider;
+  /// the fullest queue in percent, besides the deferred log ring. could be unset
+  etl::delegate<uint8_t()> queue_percent;
+};
+
+constexpr const char *levelToStr(level_t level) {
+  switch (level) {
+    case level_t::NORMAL:
+      return "NORMAL";
+    case level_t::REDUCED_FPS:
+      return "REDUCED_FPS";
+    case level_t::SLOW_NOTIFY:
+      return "SLOW_NOTIFY";
+    case level_t::SLOW_SCAN:
+      return "SLOW_SCAN";
+    case level_t::QUIET_LOG:
+      return "QUIET_LOG";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+/**
+ * @brief start sampling every `SAMPLE_INTERVAL`
+ * @return false if it's started already, or the timer can't be started
+ */
+bool start(hooks_t hooks);
+
+/// the current level. safe to call from any task
+level_t level();
+
+/**
+ * @brief whether an HR record should be notified now
+ * @note rate limited from `SLOW_NOTIFY` on, and the skipped ones are counted in `metrics`.
+ *       safe to call from any task
+ */
+bool admit_hr_notify();
+}
+
+#endif // TRACK_SHORT_QOS_H
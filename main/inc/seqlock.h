@@ -0,0 +1,69 @@
+//
+// Created by Kurosu Chan on 2023/11/26.
+//
+
+#ifndef TRACK_SHORT_SEQLOCK_H
+#define TRACK_SHORT_SEQLOCK_H
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+namespace utils {
+/**
+ * @brief a value published by a single writer and read by any number of readers
+ * @note the writer never waits. a reader retries if it races with the writer,
+ *       so it never sees a torn value.
+ *       A reader with a higher priority than the writer on the same core would back off
+ *       for a tick, otherwise it could spin forever on a preempted write.
+ */
+template <typename T>
+class seqlock_t {
+  static_assert(std::is_trivially_copyable_v<T>, "T should be trivially copyable");
+  std::atomic<uint32_t> seq{0};
+  T value{};
+
+public:
+  seqlock_t() = default;
+  explicit seqlock_t(const T &v) : value(v) {}
+
+  /// should only be called by the writer
+  void write(const T &v) {
+    const auto s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&value, &v, sizeof(T));
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+  [[nodiscard]] T read() const {
+#ifdef ESP_PLATFORM
+    constexpr auto MAX_SPINS = 16;
+#endif
+    T v;
+    for ([[maybe_unused]] auto spins = 0;; ++spins) {
+#ifdef ESP_PLATFORM
+      if (spins >= MAX_SPINS) {
+        vTaskDelay(1);
+        spins = 0;
+      }
+#endif
+      const auto s1 = seq.load(std::memory_order_acquire);
+      if (s1 & 1) {
+        continue;
+      }
+      std::memcpy(&v, &value, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq.load(std::memory_order_relaxed) == s1) {
+        return v;
+      }
+    }
+  }
+};
+}
+
+#endif // TRACK_SHORT_SEQLOCK_H
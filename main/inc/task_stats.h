@@ -0,0 +1,52 @@
+//
+// Created by Kurosu Chan on 2023/11/28.
+//
+
+#ifndef TRACK_SHORT_TASK_STATS_H
+#define TRACK_SHORT_TASK_STATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+
+/**
+ * @brief log the CPU share, the core and the free stack of every task periodically,
+ *        to check the task topology (see `common::topology`)
+ * @note needs `CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS`. Otherwise `start` does nothing.
+ *       The minimum free stack of each task is kept for the whole session, and a sizing report
+ *       recommends the stack size from it. With `CONFIG_HEAP_TASK_TRACKING`, the peak heap
+ *       usage of each task is kept and reported as well. Otherwise the heap is left out of the report.
+ */
+namespace task_stats {
+constexpr auto DEFAULT_INTERVAL = std::chrono::seconds(10);
+/// the sizing report is logged every this many reports
+constexpr auto SIZING_EVERY = 6;
+/// the tasks beyond it are not reported
+constexpr size_t MAX_TASKS = 32;
+/// the recommended stack is the worst usage plus this share of it (but at least `MIN_STACK_HEADROOM`)
+constexpr uint32_t STACK_HEADROOM_PERCENT = 25;
+constexpr uint32_t MIN_STACK_HEADROOM     = 512;
+
+/**
+ * @brief start a task that logs the share of each task since the last report
+ */
+esp_err_t start(std::chrono::seconds interval);
+
+/**
+ * @brief keep the worst stack usage of the calling task
+ * @note should be called by a task right before deleting itself, which would be missed by
+ *       the periodic reports otherwise
+ */
+void record_self();
+
+/**
+ * @brief log the worst stack usage since boot and the recommended size of every task
+ * @note the size of a task is only known if it's in `common::topology` or configured by sdkconfig.
+ *       should be called after a session that covers the worst case (BLE connections, LoRa
+ *       traffic, a running lane)
+ */
+void report_sizing();
+}
+
+#endif // TRACK_SHORT_TASK_STATS_H
@@ -0,0 +1,137 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#ifndef TRACK_SHORT_TRACE_H
+#define TRACK_SHORT_TRACE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+// record the trace events into the rings. costs 2 * RING_SIZE * 8 bytes of RAM
+// #define TRACE
+
+class NimBLEService;
+
+/**
+ * @brief binary trace events in a lock-free ring per core
+ * @note a record is 8 bytes: `ts_us(4) | id(1) | flags(1) | arg(2)`, little endian.
+ *       A slot is reserved with a `fetch_add`, so the tasks and the ISRs of the same core
+ *       could write at the same time. The rings are frozen before dumping them.
+ *       See `docs/trace/trace2json.py` for the dump format, which converts it to a Chrome trace.
+ */
+namespace trace {
+/// should be a power of 2
+constexpr size_t RING_SIZE = 512;
+static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE should be a power of 2");
+
+/// keep in sync with `EVENTS` in `trace2json.py`
+enum class event_t : uint8_t {
+  ITERATE = 1,
+  SHOW,
+  /// arg is the size of the packet
+  TX,
+  /// arg is the size of the packet
+  RX,
+  DIO1,
+  BLE_CONTROL,
+  BLE_CONFIG,
+  BLE_WHITE_LIST,
+  BLE_SCAN_RESULT,
+  NVS_WRITE,
+};
+
+enum phase_t : uint8_t {
+  INSTANT = 0,
+  BEGIN   = 1,
+  END     = 2,
+};
+/// set in `flags` if the event is emitted from an ISR
+constexpr uint8_t FLAG_ISR = 0x80;
+
+struct record_t {
+  /// the lower 32 bits of `esp_timer_get_time`
+  uint32_t ts_us;
+  event_t id;
+  /// phase | FLAG_ISR
+  uint8_t flags;
+  uint16_t arg;
+};
+static_assert(sizeof(record_t) == 8, "the dump format expects 8 bytes records");
+
+struct ring_t {
+  std::atomic<uint32_t> head{0};
+  std::array<record_t, RING_SIZE> records{};
+};
+
+#ifdef TRACE
+extern std::array<ring_t, portNUM_PROCESSORS> rings;
+extern std::atomic<bool> recording;
+
+/// safe to be called from an ISR. always inlined, so that it's in IRAM with an IRAM ISR
+[[gnu::always_inline]] inline void emit(event_t id, phase_t phase, uint16_t arg = 0) {
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // the task could be moved to the other core right after, which only makes the record out of order
+  auto &ring       = rings[xPortGetCoreID()];
+  const auto flags = static_cast<uint8_t>(phase | (xPortInIsrContext() ? FLAG_ISR : 0));
+  const auto i     = ring.head.fetch_add(1, std::memory_order_relaxed);
+  ring.records[i & (RING_SIZE - 1)] = record_t{static_cast<uint32_t>(esp_timer_get_time()), id, flags, arg};
+}
+#else
+inline void emit(event_t, phase_t, uint16_t = 0) {}
+#endif
+
+/// emit `BEGIN` on construction and `END` on destruction
+class scope_t {
+  event_t id;
+  uint16_t arg;
+
+public:
+  explicit scope_t(event_t id, uint16_t arg = 0) : id(id), arg(arg) {
+    emit(id, BEGIN, arg);
+  }
+  ~scope_t() {
+    emit(id, END, arg);
+  }
+  scope_t(const scope_t &)            = delete;
+  scope_t &operator=(const scope_t &) = delete;
+};
+
+/// where `read_chunk` continues from
+struct cursor_t {
+  uint8_t core  = 0;
+  uint32_t next = 0;
+  bool started  = false;
+};
+
+/**
+ * @brief stop recording, and wait for the writers in flight
+ * @note the rings are kept until `resume`
+ */
+void freeze();
+/// clear the rings and start recording again
+void resume();
+/**
+ * @brief copy the frozen rings into `out` as frames of `'T' | core(1) | count(2) | record * count`
+ * @return the bytes written, 0 if everything has been read
+ */
+size_t read_chunk(cursor_t &cursor, uint8_t *out, size_t size);
+/// freeze, print all the frames as hex lines prefixed with `trace: `, and resume
+void dump_serial();
+
+/**
+ * @brief add the trace characteristic to the diagnostics service
+ * @note write `0x00` to resume, `0x01` to freeze and read from the beginning, `0x02` to dump it to serial.
+ *       every read returns the next chunk, and an empty value at the end.
+ *       does nothing without `TRACE`
+ */
+void initBLE(NimBLEService &service);
+}
+
+#endif // TRACK_SHORT_TRACE_H
@@ -0,0 +1,80 @@
+//
+// Created by Kurosu Chan on 2023/11/22.
+//
+
+#ifndef TRACK_SHORT_WATCH_INFO_H
+#define TRACK_SHORT_WATCH_INFO_H
+
+#include <algorithm>
+#include <etl/optional.h>
+#include "ad_parser.h"
+
+/**
+ * @brief the broadcast data of the "Y" watches
+ * @note all multibyte fields are big endian
+ */
+struct WatchInfo {
+  static constexpr auto TIME_WIDTH = 5;
+  /// the minimal size of the data we could decode
+  static constexpr size_t SIZE_NEEDED = 20;
+  uint8_t time[TIME_WIDTH]            = {0};
+  uint16_t steps                      = 0;
+  uint16_t kcal                       = 0;
+  uint8_t hr                          = 0;
+  // mm/Hg
+  uint8_t SBP = 0;
+  // mm/Hg
+  uint8_t DBP     = 0;
+  uint8_t battery = 0;
+  // uint16_t / 10 in Celsius
+  float temperature = 0;
+  uint8_t SpO2      = 0;
+
+  /**
+   * @brief decode the data straight from the advertisement payload
+   * @return nullopt if `data` is too short
+   */
+  static etl::optional<WatchInfo> from_span(ad::bytes_t data) {
+    if (data.size() < SIZE_NEEDED) {
+      return etl::nullopt;
+    }
+    const auto *p  = data.data();
+    WatchInfo info = {};
+    size_t offset  = 0;
+    std::copy(p, p + TIME_WIDTH, info.time);
+    offset += TIME_WIDTH;
+    info.steps = ad::read_u16_be(p + offset);
+    offset += 2;
+    info.kcal = ad::read_u16_be(p + offset);
+    offset += 2;
+    info.hr = p[offset];
+    offset += 1;
+    info.SBP = p[offset];
+    offset += 1;
+    info.DBP = p[offset];
+    offset += 1;
+    info.battery = p[offset];
+    offset += 1;
+    offset += 2; // ignore
+    info.temperature = static_cast<float>(ad::read_u16_be(p + offset)) / 10.0f;
+    offset += 2;
+    offset += 2; // ignore
+    info.SpO2 = p[offset];
+    // ignore rest
+    return info;
+  }
+
+  /**
+   * @brief locate the watch data in the advertisement
+   * @note the watch puts its data in the structure right after its name.
+   *       the manufacturer specific data is used if it can't be found.
+   */
+  static ad::bytes_t locate(const ad::fields_t &fields) {
+    if (!fields.after_name.empty()) {
+      return fields.after_name;
+    }
+    return fields.manufacturer_data;
+  }
+};
+
+#endif // TRACK_SHORT_WATCH_INFO_H
@@ -7,8 +7,11 @@
 
 #include <variant>
 #include <string>
+#include <string_view>
 #include <regex>
 #include <etl/optional.h>
+#include <etl/vector.h>
+#include <etl/string.h>
 #include "ble.pb.h"
 
 #ifdef SIMPLE_LOG
@@ -32,7 +35,33 @@ using list_t       = std::vector<item_t>;
 using error_code_t = ::WhiteListErrorCode;
 using command_t    = ::WhiteListCommand;
 using response_t   = std::variant<list_t, error_code_t>;
-using request_t    = std::variant<list_t, command_t>;
+
+/// add one item to the list
+struct add_t {
+  item_t item;
+};
+
+/// remove one item from the list
+struct remove_t {
+  item_t item;
+};
+
+/**
+ * @note the `version` the change is based on is left in `WhiteListRequest::version`
+ * (or `WhiteListRequestFixed::version`) after decoding
+ */
+using request_t = std::variant<list_t, command_t, add_t, remove_t>;
+
+/**
+ * @brief whether two items are the same
+ * @note a name decoded by the dynamic decoder might carry the trailing 0x00, which is ignored
+ */
+bool same_item(const item_t &a, const item_t &b);
+
+/**
+ * @brief encode the response with the version of the list
+ */
+bool marshal_white_list_response(pb_ostream_t *ostream, ::WhiteListResponse &pb_response, response_t &response, uint32_t version);
 
 bool marshal_white_list_response(pb_ostream_t *ostream, ::WhiteListResponse &pb_response, response_t &response);
 
@@ -43,6 +72,113 @@ bool marshal_white_list(pb_ostream_t *ostream, ::WhiteList &pb_list, list_t &lis
 
 etl::optional<list_t>
 unmarshal_white_list(pb_istream_t *istream, ::WhiteList &pb_list);
+
+//****************************** fixed ************************************/
+
+/// the capacity is decided by `ble.options`
+constexpr size_t MAX_FIXED_ITEMS = sizeof(::WhiteListFixed::items) / sizeof(::WhiteItemFixed);
+/// without the null terminator
+constexpr size_t MAX_FIXED_NAME_LENGTH = sizeof(::WhiteItemFixed{}.item.name) - 1;
+
+struct FixedName {
+  etl::string<MAX_FIXED_NAME_LENGTH> name;
+};
+
+using fixed_item_t    = std::variant<FixedName, Addr>;
+using fixed_list_t    = etl::vector<fixed_item_t, MAX_FIXED_ITEMS>;
+/// `add`/`remove` carry a single item, which only falls back to the dynamic decoder for a long name
+using fixed_request_t = std::variant<fixed_list_t, command_t, add_t, remove_t>;
+
+/**
+ * @brief decode the request into a fixed capacity list. no heap allocation and no callback
+ * @note the wire format is the same as `WhiteListRequest`.
+ *       It fails if the list is longer than `MAX_FIXED_ITEMS` or a name is longer than `MAX_FIXED_NAME_LENGTH`,
+ *       in which case the caller should retry with `unmarshal_while_list_request` on a fresh stream.
+ * @param request would be used as the decode buffer. It's large, don't put it on a small stack.
+ */
+etl::optional<fixed_request_t>
+unmarshal_white_list_request_fixed(pb_istream_t *istream, ::WhiteListRequestFixed &request);
+
+etl::optional<fixed_list_t>
+unmarshal_white_list_fixed(pb_istream_t *istream, ::WhiteListFixed &pb_list);
+
+/**
+ * @brief convert to the dynamic item, which is what `matcher_t` takes
+ * @note a name within the small string optimization of `std::string` is not allocated
+ */
+item_t to_item(const fixed_item_t &item);
+
+/**
+ * @brief a compiled white list, which should be built once when the list is set
+ * @note the matching is tiered from the cheapest to the most expensive:
+ *       1. address, binary search in a sorted array
+ *       2. name without regex meta character, plain string comparison
+ *       3. name regex, rejected early by its literal prefix, then the precompiled regex
+ */
+class matcher_t {
+public:
+  using addr_t = std::array<uint8_t, BLE_MAC_ADDR_SIZE>;
+
+private:
+  struct name_matcher_t {
+    static etl::optional<name_matcher_t> from(const Name &name);
+    std::string pattern;
+    /// the literal characters the regex must start with (could be empty)
+    std::string prefix;
+    /// no regex meta character at all, could be compared directly
+    bool is_literal = false;
+    std::regex re;
+  };
+  std::vector<addr_t> addrs{};
+  std::vector<name_matcher_t> names{};
+
+public:
+  matcher_t() = default;
+  explicit matcher_t(const list_t &list);
+
+  /**
+   * @brief add the item in place, without rebuilding the others
+   * @return false if it's there already
+   */
+  bool add(const item_t &item);
+  /**
+   * @return false if it's not found
+   */
+  bool remove(const item_t &item);
+  void clear() {
+    addrs.clear();
+    names.clear();
+  }
+
+  /**
+   * @param addr 6 bytes (48 bits) of mac address, in the same order as `Addr`
+   */
+  [[nodiscard]] bool match_addr(const uint8_t *addr) const;
+  [[nodiscard]] bool match_name(std::string_view name) const;
+  [[nodiscard]] bool match(const uint8_t *addr, std::string_view name) const {
+    return match_addr(addr) || match_name(name);
+  }
+  /// sorted addresses of the list
+  [[nodiscard]] const std::vector<addr_t> &addresses() const {
+    return addrs;
+  }
+  /// whether there's any name item, which can't be handled by the controller
+  [[nodiscard]] bool has_names() const {
+    return !names.empty();
+  }
+  [[nodiscard]] bool empty() const {
+    return addrs.empty() && names.empty();
+  }
+};
+
+/**
+ * @brief whether the controller accept list could take over the filtering of `m`
+ * @param broadcasts whether the HR broadcasts of the watches (see `ad_decoder`) are wanted,
+ *        which come from the devices not in the list and would be dropped by the controller
+ */
+inline bool controller_filterable(const matcher_t &m, bool broadcasts) {
+  return !broadcasts && !m.has_names() && !m.empty();
+}
 }
 
 #ifdef ESP32
@@ -16,6 +16,8 @@
 #include "set_name_map_key.tpp"
 #include "named_hr_data.tpp"
 #include "repeater_status.tpp"
+#include "start_at.tpp"
+#include "start_report.tpp"
 
 namespace HrLoRa::hr_lora_msg {
 using t = std::variant<
@@ -23,7 +25,9 @@ using t = std::variant<
     hr_data::t,
     query_device_by_mac::t,
     repeater_status::t,
-    set_name_map_key::t>;
+    set_name_map_key::t,
+    start_at::t,
+    start_report::t>;
 
 // https://en.cppreference.com/w/cpp/utility/variant/visit
 // helper constant for the visitor #3
@@ -55,6 +59,12 @@ size_t marshal(t &data, uint8_t *buffer, size_t size) {
                         [buffer, size](set_name_map_key::t &data) {
                           return set_name_map_key::marshal(data, buffer, size);
                         },
+                        [buffer, size](start_at::t &data) {
+                          return start_at::marshal(data, buffer, size);
+                        },
+                        [buffer, size](start_report::t &data) {
+                          return start_report::marshal(data, buffer, size);
+                        },
                     },
                     data);
 }
@@ -97,6 +107,12 @@ etl::optional<t> unmarshal(const uint8_t *buffer, size_t size) {
     case set_name_map_key::magic: {
       return unmarshal_helper<set_name_map_key>(buffer, size);
     }
+    case start_at::magic: {
+      return unmarshal_helper<start_at>(buffer, size);
+    }
+    case start_report::magic: {
+      return unmarshal_helper<start_report>(buffer, size);
+    }
     default:
       return etl::nullopt;
   }
@@ -9,14 +9,19 @@
  * @brief some common *constant* definitions for HRLoRA
  */
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <etl/optional.h>
+#include <etl/string.h>
 
 namespace HrLoRa {
 constexpr auto BLE_ADDR_SIZE  = 6;
 constexpr auto broadcast_addr = std::array<uint8_t, BLE_ADDR_SIZE>{0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 using name_map_key_t          = uint8_t;
 using addr_t                  = std::array<uint8_t, BLE_ADDR_SIZE>;
+/// a longer device name is truncated
+constexpr size_t MAX_DEVICE_NAME_LENGTH = 31;
 
 #if __cplusplus >= 202002L
 /**
@@ -10,8 +10,8 @@ struct hr_device {
   struct t {
     using module = hr_device;
     addr_t addr{};
-    // zero terminated string
-    std::string name{};
+    // zero terminated string on the wire
+    etl::string<MAX_DEVICE_NAME_LENGTH> name{};
   };
   static size_t size_needed(const t &data) {
     return BLE_ADDR_SIZE + data.name.size() + 1;
@@ -39,8 +39,11 @@ struct hr_device {
     for (int i = 0; i < BLE_ADDR_SIZE; ++i) {
       data.addr[i] = buffer[i];
     }
-    size_t offset = BLE_ADDR_SIZE;
-    data.name     = std::string(reinterpret_cast<const char *>(buffer + offset));
+    size_t offset   = BLE_ADDR_SIZE;
+    const auto *str = reinterpret_cast<const char *>(buffer + offset);
+    // the terminator might be missing in a malformed packet
+    const auto len = strnlen(str, buffer_size - offset);
+    data.name.assign(str, std::min(len, MAX_DEVICE_NAME_LENGTH));
     return data;
   }
 };
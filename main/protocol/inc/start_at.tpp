@@ -0,0 +1,81 @@
+//
+// Created by Kurosu Chan on 2023/11/27.
+//
+
+#ifndef BLE_LORA_ADAPTER_START_AT_H
+#define BLE_LORA_ADAPTER_START_AT_H
+
+#include <cstring>
+#include <etl/optional.h>
+#include "hr_lora_common.tpp"
+
+namespace HrLoRa {
+/**
+ * @brief start all the lanes at the same time
+ * @note the packet itself is the shared time base. every board starts `delay_ms` after the end
+ *       of the packet, which is the TX done interrupt on the sender and the RX done interrupt on
+ *       the receivers, so no clock offset needs to be exchanged.
+ *       `magic | seq(1) | status(1) | speed(4, float LE) | delay_ms(4, LE) | measure(1)`
+ */
+struct start_at {
+  static constexpr uint8_t magic = 0x5b;
+  struct t {
+    using module = start_at;
+    uint8_t seq  = 0;
+    /// `::LaneStatus`
+    uint8_t status = 0;
+    /// m/s
+    float speed       = 0;
+    uint32_t delay_ms = 0;
+    /// whether the receivers should reply with `start_report`
+    bool measure = false;
+  };
+#if __cpp_consteval >= 202002L
+  consteval
+#else
+  constexpr
+#endif
+  static size_t size_needed() {
+    return sizeof(magic) + sizeof(t::seq) + sizeof(t::status) + sizeof(t::speed) + sizeof(t::delay_ms) + 1;
+  }
+  static size_t marshal(const t &data, uint8_t *buffer, size_t buffer_size) {
+    if (buffer_size < size_needed()) {
+      return 0;
+    }
+    size_t offset    = 0;
+    buffer[offset++] = magic;
+    buffer[offset++] = data.seq;
+    buffer[offset++] = data.status;
+    std::memcpy(buffer + offset, &data.speed, sizeof(data.speed));
+    offset += sizeof(data.speed);
+    for (size_t i = 0; i < sizeof(data.delay_ms); ++i) {
+      buffer[offset++] = (data.delay_ms >> (8 * i)) & 0xff;
+    }
+    buffer[offset++] = data.measure ? 1 : 0;
+    return offset;
+  }
+  static etl::optional<t> unmarshal(const uint8_t *buffer, size_t size) {
+    if (size < size_needed()) {
+      return etl::nullopt;
+    }
+    if (buffer[0] != magic) {
+      return etl::nullopt;
+    }
+
+    t data;
+    size_t offset = 1;
+    data.seq      = buffer[offset++];
+    data.status   = buffer[offset++];
+    std::memcpy(&data.speed, buffer + offset, sizeof(data.speed));
+    offset += sizeof(data.speed);
+    data.delay_ms = 0;
+    for (size_t i = 0; i < sizeof(data.delay_ms); ++i) {
+      data.delay_ms |= static_cast<uint32_t>(buffer[offset++]) << (8 * i);
+    }
+    data.measure = buffer[offset++] != 0;
+    return data;
+  }
+};
+}
+
+#endif // BLE_LORA_ADAPTER_START_AT_H
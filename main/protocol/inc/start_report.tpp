@@ -0,0 +1,74 @@
+//
+// Created by Kurosu Chan on 2023/11/27.
+//
+
+#ifndef BLE_LORA_ADAPTER_START_REPORT_H
+#define BLE_LORA_ADAPTER_START_REPORT_H
+
+#include <etl/optional.h>
+#include "hr_lora_common.tpp"
+
+namespace HrLoRa {
+/**
+ * @brief how late a board started after the `start_at` with the same `seq`
+ * @note only sent when `start_at::t::measure` is set.
+ *       `magic | addr(6) | seq(1) | late_us(4, LE, signed)`
+ */
+struct start_report {
+  static constexpr uint8_t magic = 0x5c;
+  struct t {
+    using module = start_report;
+    addr_t addr{};
+    uint8_t seq = 0;
+    /// the first frame minus the scheduled time, in the clock of the reporter
+    int32_t late_us = 0;
+  };
+#if __cpp_consteval >= 202002L
+  consteval
+#else
+  constexpr
+#endif
+  static size_t size_needed() {
+    return sizeof(magic) + BLE_ADDR_SIZE + sizeof(t::seq) + sizeof(t::late_us);
+  }
+  static size_t marshal(const t &data, uint8_t *buffer, size_t buffer_size) {
+    if (buffer_size < size_needed()) {
+      return 0;
+    }
+    size_t offset    = 0;
+    buffer[offset++] = magic;
+    for (int i = 0; i < BLE_ADDR_SIZE; ++i) {
+      buffer[offset++] = data.addr[i];
+    }
+    buffer[offset++] = data.seq;
+    const auto late  = static_cast<uint32_t>(data.late_us);
+    for (size_t i = 0; i < sizeof(late); ++i) {
+      buffer[offset++] = (late >> (8 * i)) & 0xff;
+    }
+    return offset;
+  }
+  static etl::optional<t> unmarshal(const uint8_t *buffer, size_t size) {
+    if (size < size_needed()) {
+      return etl::nullopt;
+    }
+    if (buffer[0] != magic) {
+      return etl::nullopt;
+    }
+
+    t data;
+    size_t offset = 1;
+    for (int i = 0; i < BLE_ADDR_SIZE; ++i) {
+      data.addr[i] = buffer[offset++];
+    }
+    data.seq      = buffer[offset++];
+    uint32_t late = 0;
+    for (size_t i = 0; i < sizeof(late); ++i) {
+      late |= static_cast<uint32_t>(buffer[offset++]) << (8 * i);
+    }
+    data.late_us = static_cast<int32_t>(late);
+    return data;
+  }
+};
+}
+
+#endif // BLE_LORA_ADAPTER_START_REPORT_H
@@ -4,6 +4,9 @@
 
 #include "Lane.h"
 #include "Strip.hpp"
+#include "metrics.h"
+#include "trace.h"
+#include "defer_log.h"
 #include <esp_check.h>
 
 static const auto TAG = "lane";
@@ -25,13 +28,26 @@ static inline float LEDsCountToMeter(const uint32_t count, const float LEDs_per_
 
 namespace lane {
 static constexpr auto TIMER_TIMEOUT_TICKS = 100;
-std::string statusToStr(LaneStatus status) {
-  static const std::map<LaneStatus, std::string> LANE_STATUS_STR = {
-      {LaneStatus::FORWARD, "FORWARD"},
-      {LaneStatus::BACKWARD, "BACKWARD"},
-      {LaneStatus::STOP, "STOP"},
-  };
-  return LANE_STATUS_STR.at(status);
+/// how early `start_timer` wakes the loop up, to absorb the latency of the timer and the scheduler
+static constexpr int64_t START_WAKE_MARGIN_US = 2'000;
+/// below this, `waitUntil` busy waits instead of sleeping
+static constexpr int64_t FRAME_SPIN_US = 200;
+template <class>
+inline constexpr bool always_false_v = false;
+
+const char *statusToStr(LaneStatus status) {
+  switch (status) {
+    case LaneStatus::FORWARD:
+      return "FORWARD";
+    case LaneStatus::BACKWARD:
+      return "BACKWARD";
+    case LaneStatus::STOP:
+      return "STOP";
+    case LaneStatus::BLINK:
+      return "BLINK";
+    default:
+      return "UNKNOWN";
+  }
 }
 
 inline LaneStatus revert_state(LaneStatus state) {
@@ -50,10 +66,11 @@ inline LaneStatus revert_state(LaneStatus state) {
  * @param [in]last_state
  * @param [in]cfg
  * @param [in]input param
+ * @param [in]dt_s the time since the last state, in seconds. more than a frame if the frames are skipped
  * @return the next state and the param (external input/state)
  */
-static std::tuple<LaneState, LaneParams>
-nextState(const LaneState &last_state, const LaneConfig &cfg, const LaneParams &input) {
+static std::tuple<LaneState, LaneParams> HOT_ATTR
+nextState(const LaneState &last_state, const LaneConfig &cfg, const LaneParams &input, float dt_s) {
   constexpr auto TAG = "lane::nextState";
   auto zero_state    = LaneState::zero();
   auto stop_case     = [=]() {
@@ -85,17 +102,17 @@ nextState(const LaneState &last_state, const LaneConfig &cfg, const LaneParams &
         return {zero_state, input};
       }
       if (input.status != last_state.status) {
-        ESP_LOGW(TAG, "Invalid status changed from %s to %s", statusToStr(last_state.status).c_str(), statusToStr(input.status).c_str());
+        ESP_LOGW(TAG, "Invalid status changed from %s to %s", statusToStr(last_state.status), statusToStr(input.status));
         auto param   = input;
         param.status = last_state.status;
         return {last_state, param};
       }
       auto ret  = last_state;
       ret.speed = input.speed;
-      // I assume every time call this function the time interval is 1/fps
-      ret.shift      = last_state.shift + meter(ret.speed / cfg.fps);
-      auto temp_head = last_state._head + meter(ret.speed / cfg.fps);
-      auto err       = meter(ret.speed / cfg.fps);
+      const auto step = meter(ret.speed * dt_s);
+      ret.shift       = last_state.shift + step;
+      auto temp_head  = last_state._head + step;
+      auto err        = step;
       if (temp_head >= (cfg.active_length + cfg.line_length - err)) {
         ret.status = revert_state(last_state.status);
         ret.head   = meter(0);
@@ -126,21 +143,94 @@ void Lane::stop() const {
   strip->show();
 }
 
-struct UpdateTaskParam {
-  std::function<void()> *fn;
-  TaskHandle_t handle;
-  ~UpdateTaskParam() {
-    delete fn;
-    fn = nullptr;
-    if (handle != nullptr) {
-      vTaskDelete(handle);
+void Lane::applyCommands(int64_t &status_changed_us) {
+  bool cfg_changed = false;
+  bool persist     = false;
+  auto cmd         = command_t{};
+  auto apply       = [&](const auto &c) {
+    using T = std::decay_t<decltype(c)>;
+    if constexpr (std::is_same_v<T, set_status_t>) {
+      params.status     = c.status;
+      status_changed_us = cmd.timestamp_us;
+      // the latest request wins, so a STOP after `start_at` cancels the start
+      scheduled_start = std::nullopt;
+      if (start_timer != nullptr) {
+        esp_timer_stop(start_timer);
+      }
+    } else if constexpr (std::is_same_v<T, set_speed_t>) {
+      params.speed = c.speed;
+    } else if constexpr (std::is_same_v<T, set_color_t>) {
+      cfg.color   = c.color;
+      cfg_changed = true;
+      persist     = true;
+    } else if constexpr (std::is_same_v<T, set_length_t>) {
+      if (state.status != LaneStatus::STOP) {
+        ESP_LOGE(TAG, "Can't change the length while the lane is running");
+        return;
+      }
+      cfg.line_length   = c.line_length;
+      cfg.active_length = c.active_length;
+      cfg.finish_length = c.finish_length;
+      cfg.line_LEDs_num = c.line_LEDs_num;
+      setMaxLEDs(c.line_LEDs_num);
+      cfg_changed = true;
+      persist     = true;
+    } else if constexpr (std::is_same_v<T, set_config_t>) {
+      cfg         = c.cfg;
+      cfg_changed = true;
+    } else if constexpr (std::is_same_v<T, set_fps_divider_t>) {
+      // the pacing is restarted by `loop` if the period changes
+      fps_divider = c.divider;
+    } else if constexpr (std::is_same_v<T, start_at_t>) {
+      scheduled_start = c;
+      if (start_timer == nullptr) {
+        return;
+      }
+      esp_timer_stop(start_timer);
+      const auto timeout = c.at_us - START_WAKE_MARGIN_US - esp_timer_get_time();
+      if (timeout > 0) {
+        esp_timer_start_once(start_timer, timeout);
+      }
+    } else {
+      static_assert(always_false_v<T>, "non-exhaustive visitor");
     }
+  };
+  while (commands.pop(cmd)) {
+    std::visit(apply, cmd.payload);
+    ESP_LOGD(TAG, "command %u applied in %lld us", static_cast<unsigned>(cmd.payload.index()), esp_timer_get_time() - cmd.timestamp_us);
   }
-};
+  if (cfg_changed) {
+    cfg_snapshot.write(cfg);
+  }
+  if (persist) {
+    persistConfig();
+  }
+}
+
+std::optional<int64_t> Lane::tryScheduledStart(int64_t &status_changed_us) {
+  if (!scheduled_start.has_value()) {
+    return std::nullopt;
+  }
+  const auto s = *scheduled_start;
+  if (esp_timer_get_time() < s.at_us - START_WAKE_MARGIN_US) {
+    return std::nullopt;
+  }
+  // the last stretch is too short for the scheduler
+  while (esp_timer_get_time() < s.at_us) {}
+  const auto late   = esp_timer_get_time() - s.at_us;
+  params.status     = s.status;
+  params.speed      = s.speed;
+  status_changed_us = s.at_us;
+  scheduled_start   = std::nullopt;
+  return late;
+}
 
 [[noreturn]] void Lane::loop() {
   auto instant                  = Instant();
   auto constexpr DEBUG_INTERVAL = std::chrono::seconds(1);
+  loop_handle                   = xTaskGetCurrentTaskHandle();
+  auto last_status              = LaneStatus::STOP;
+  int64_t status_changed_us     = 0;
   ESP_LOGI(TAG, "loop");
   for (;;) {
     if (strip == nullptr) {
@@ -149,89 +239,97 @@ struct UpdateTaskParam {
       continue;
     }
 
-    // TODO: use xTimerCreateStatic to avoid heap allocation repeatedly
-    auto delete_timer = [this]() {
-      if (this->timer_handle != nullptr) {
-        ESP_LOGI(TAG, "delete timer");
-        auto ok = xTimerStop(this->timer_handle, TIMER_TIMEOUT_TICKS);
-        if (!ok) {
-          ESP_LOGE(TAG, "Failed to stop timer");
-          return;
-        }
-        ok = xTimerDelete(this->timer_handle, TIMER_TIMEOUT_TICKS);
-        if (!ok) {
-          ESP_LOGE(TAG, "Failed to delete timer");
-          return;
-        }
-        this->timer_handle = nullptr;
-      } else {
+    // the frame boundary; nothing else touches `cfg`, `params` or `state`
+    applyCommands(status_changed_us);
+    const auto started_late = tryScheduledStart(status_changed_us);
+    const auto status       = params.status;
+    const auto from_status  = last_status;
+    // from the request (BLE write, or the scheduled time) to the first frame of the new status
+    const auto changed_in = esp_timer_get_time() - status_changed_us;
+    last_status           = status;
+    // writing the log is slow, so it's done after the first frame
+    auto report = [&]() {
+      if (status != from_status) {
+        DLOGI(TAG, "%s -> %s in %lld us", statusToStr(from_status), statusToStr(status), changed_in);
       }
-    };
-    /**
-     * @brief try to create a timer if there is no timer running.
-     */
-    auto try_create_timer = [this]() {
-      // https://www.nextptr.com/tutorial/ta1430524603/capture-this-in-lambda-expression-timeline-of-change
-      auto notify_fn = [this]() {
-        ESP_LOGI(TAG, "head=%.2f; tail=%.2f; shift=%.2f; speed=%.2f; status=%s; color=%0x06x; fps=%f",
-                 state.head.count(), state.tail.count(), state.shift.count(), state.speed,
-                 statusToStr(state.status).c_str(), cfg.color, this->cfg.fps);
-        this->notifyState(this->state);
-        xTimerReset(this->timer_handle, TIMER_TIMEOUT_TICKS);
-      };
-
-      auto run_notify_fn = [](TimerHandle_t handle) {
-        const auto &param = *static_cast<notify_timer_param *>(pvTimerGetTimerID(handle));
-        param.fn();
-      };
-
-      // otherwise a timer is running
-      if (this->timer_handle == nullptr) {
-        this->timer_param.fn = notify_fn;
-        this->timer_handle   = xTimerCreate("notify_timer",
-                                            pdMS_TO_TICKS(common::lanely::BLUE_TRANSMIT_INTERVAL.count()),
-                                            pdFALSE,
-                                            &this->timer_param,
-                                            run_notify_fn);
-        [[unlikely]] if (this->timer_handle == nullptr) {
-          ESP_LOGE(TAG, "Failed to create timer");
-          abort();
+      if (started_late.has_value()) {
+        DLOGI(TAG, "scheduled start late by %lld us", *started_late);
+        if (onStartedCb.is_valid()) {
+          onStartedCb(static_cast<int32_t>(*started_late));
         }
-        xTimerStart(this->timer_handle, TIMER_TIMEOUT_TICKS);
       }
     };
-
-    switch (params.status) {
+    switch (status) {
       case LaneStatus::FORWARD:
       case LaneStatus::BACKWARD: {
-        instant.reset();
-        iterate();
-        try_create_timer();
-        const auto diff  = std::chrono::duration_cast<std::chrono::milliseconds>(instant.elapsed());
-        const auto delay = std::chrono::milliseconds(static_cast<uint16_t>(1000 / cfg.fps)) - diff;
-        if (delay < std::chrono::milliseconds(0)) [[unlikely]] {
-          ESP_LOGW(TAG, "timeout %lld", delay.count());
-        } else {
-          const auto ticks = pdMS_TO_TICKS(delay.count());
-          vTaskDelay(ticks);
+        // the motion is deterministic, so the next frame is prepared in the idle time
+        // right after the last one is shown, and only `show` is left at the boundary
+        const auto iterate_start = esp_timer_get_time();
+        const auto ready         = iterate();
+        const auto iterate_us    = esp_timer_get_time() - iterate_start;
+        if (pacer.period_us() != static_cast<int64_t>(1'000'000 / pacedFps())) {
+          startPacing();
+          instant.reset();
+        }
+        waitUntil(pacer.next_us());
+        const auto show_start = esp_timer_get_time();
+        const auto jitter     = show_start - pacer.next_us();
+        if (ready) {
+          const auto _ = trace::scope_t(trace::event_t::SHOW);
+          strip->show();
+        }
+        shown_frames.fetch_add(1, std::memory_order_relaxed);
+        metrics::registry.frames.inc();
+        metrics::registry.frame_us.record(static_cast<uint32_t>(iterate_us + esp_timer_get_time() - show_start));
+        metrics::registry.frame_jitter_us.record(static_cast<uint32_t>(std::max<int64_t>(jitter, 0)));
+        state_snapshot.write(state);
+        frame_stats.max_jitter_us = std::max(frame_stats.max_jitter_us, jitter);
+        frame_stats.sum_jitter_us += jitter;
+        frame_stats.frames += 1;
+        report();
+        startNotify();
+        // skip the boundaries that can't be made anymore. the next frame covers them
+        if (const auto behind = pacer.advance(esp_timer_get_time()); behind != 0) [[unlikely]] {
+          frame_stats.missed += behind;
+          metrics::registry.frame_misses.inc(behind);
+        }
+        if (instant.elapsed() >= DEBUG_INTERVAL) {
+          worst_jitter_us = std::max(worst_jitter_us, frame_stats.max_jitter_us);
+          DLOGI(TAG, "frame jitter max=%lld us; mean=%lld us; missed=%lu in %lu frames; worst=%lld us;",
+                frame_stats.max_jitter_us, frame_stats.sum_jitter_us / frame_stats.frames,
+                frame_stats.missed, frame_stats.frames, worst_jitter_us);
+          frame_stats = frame_stats_t{};
+          instant.reset();
         }
         break;
       }
       case LaneStatus::STOP: {
         this->state = LaneState::zero();
-        delete_timer();
-        stop();
-        vTaskDelay(pdMS_TO_TICKS(common::lanely::HALT_INTERVAL.count()));
+        state_snapshot.write(state);
+        stopPacing();
+        stopNotify();
+        // keep the ready frame until the lane runs
+        if (status != from_status) {
+          stop();
+        }
+        report();
+        // nothing to do until the input changes
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         break;
       }
       case LaneStatus::BLINK: {
         constexpr auto BLINK_INTERVAL = std::chrono::milliseconds(500);
         constexpr auto delay          = pdMS_TO_TICKS(BLINK_INTERVAL.count());
-        delete_timer();
+        stopPacing();
+        stopNotify();
         stop();
-        vTaskDelay(delay);
+        report();
+        // leave the blink as soon as the input changes
+        if (ulTaskNotifyTake(pdTRUE, delay) != 0) {
+          break;
+        }
         strip->fill_and_show_forward(0, cfg.line_LEDs_num, cfg.color);
-        vTaskDelay(delay);
+        ulTaskNotifyTake(pdTRUE, delay);
         break;
       }
       default:
@@ -240,6 +338,95 @@ struct UpdateTaskParam {
   }
 }
 
+void Lane::notifyTimerCb(TimerHandle_t timer) {
+  // runs in the timer task, so only the snapshots are touched
+  auto &self = *static_cast<Lane *>(pvTimerGetTimerID(timer));
+  if (++self.notify_ticks < self.notify_divider.load(std::memory_order_relaxed)) {
+    return;
+  }
+  self.notify_ticks = 0;
+  const auto state  = self.getState();
+  const auto cfg    = self.getConfig();
+  DLOGI(TAG, "head=%.2f; tail=%.2f; shift=%.2f; speed=%.2f; status=%s; color=0x%06lx; fps=%.1f",
+        state.head.count(), state.tail.count(), state.shift.count(), state.speed,
+        statusToStr(state.status), cfg.color, cfg.fps);
+  self.notifyState(state);
+}
+
+void Lane::startNotify() {
+  if (notifying || notify_timer == nullptr) {
+    return;
+  }
+  if (xTimerStart(notify_timer, TIMER_TIMEOUT_TICKS) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start notify timer");
+    return;
+  }
+  notifying = true;
+}
+
+void Lane::stopNotify() {
+  if (!notifying) {
+    return;
+  }
+  if (xTimerStop(notify_timer, TIMER_TIMEOUT_TICKS) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to stop notify timer");
+    return;
+  }
+  notifying = false;
+}
+
+void Lane::startPacing() {
+  stopPacing();
+  pacer.start(esp_timer_get_time(), static_cast<int64_t>(1'000'000 / pacedFps()));
+  frame_stats = frame_stats_t{};
+  if (frame_timer != nullptr) {
+    esp_timer_start_periodic(frame_timer, pacer.period_us());
+  }
+  pacing.store(true, std::memory_order_relaxed);
+}
+
+void Lane::stopPacing() {
+  if (!pacer.running()) {
+    return;
+  }
+  if (frame_timer != nullptr) {
+    esp_timer_stop(frame_timer);
+  }
+  pacer.stop();
+  pacing.store(false, std::memory_order_relaxed);
+}
+
+bool Lane::waitForShown(TickType_t timeout) const {
+  if (!pacing.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  const auto last  = shown_frames.load(std::memory_order_relaxed);
+  const auto start = xTaskGetTickCount();
+  while (shown_frames.load(std::memory_order_relaxed) == last) {
+    if (xTaskGetTickCount() - start >= timeout || !pacing.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    vTaskDelay(1);
+  }
+  return true;
+}
+
+void HOT_ATTR Lane::waitUntil(int64_t t) {
+  for (;;) {
+    const auto remaining = t - esp_timer_get_time();
+    if (remaining <= 0) {
+      return;
+    }
+    if (remaining <= FRAME_SPIN_US) {
+      while (esp_timer_get_time() < t) {}
+      return;
+    }
+    // woken by `frame_timer` at the boundary, or earlier by a command.
+    // the timeout is only a fallback in case there's no timer
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(remaining / 1000) + 1);
+  }
+}
+
 void Lane::setMaxLEDs(uint32_t new_max_LEDs) {
   if (strip == nullptr) {
     ESP_LOGE(TAG, "strip is null");
@@ -256,10 +443,45 @@ esp_err_t Lane::begin() {
   if (strip == nullptr) {
     return ESP_ERR_INVALID_STATE;
   }
+  const auto wake_fn = [](void *arg) {
+    static_cast<Lane *>(arg)->wake();
+  };
+  const auto start_args = esp_timer_create_args_t{
+      .callback              = wake_fn,
+      .arg                   = this,
+      .dispatch_method       = ESP_TIMER_TASK,
+      .name                  = "start",
+      .skip_unhandled_events = false,
+  };
+  ESP_RETURN_ON_ERROR(esp_timer_create(&start_args, &start_timer), TAG, "failed to create start timer");
+  // a late frame is skipped by `loop` instead of being made up
+  const auto frame_args = esp_timer_create_args_t{
+      .callback              = wake_fn,
+      .arg                   = this,
+      .dispatch_method       = ESP_TIMER_TASK,
+      .name                  = "frame",
+      .skip_unhandled_events = true,
+  };
+  ESP_RETURN_ON_ERROR(esp_timer_create(&frame_args, &frame_timer), TAG, "failed to create frame timer");
+  notify_timer = xTimerCreateStatic("notify",
+                                    pdMS_TO_TICKS(common::lanely::BLUE_TRANSMIT_INTERVAL.count()),
+                                    pdTRUE, this, notifyTimerCb, &notify_timer_buf);
+  ESP_RETURN_ON_FALSE(notify_timer != nullptr, ESP_FAIL, TAG, "failed to create notify timer");
   strip->begin();
   return ESP_OK;
 }
 
+void Lane::showReady() {
+  if (strip == nullptr) {
+    ESP_LOGE(TAG, "strip is null");
+    return;
+  }
+  int64_t status_changed_us = 0;
+  applyCommands(status_changed_us);
+  const auto n = std::min<uint32_t>(common::lanely::READY_LEDs_NUM, cfg.line_LEDs_num);
+  strip->fill_and_show_forward(0, n, cfg.color);
+}
+
 void Lane::notifyState(LaneState st) {
   const auto TAG = "Lane::notifyState";
   if (this->ble.ctrl_char == nullptr) {
@@ -279,7 +501,6 @@ void Lane::notifyState(LaneState st) {
     ESP_LOGE(TAG, "Failed to encode the state");
     return;
   }
-  auto h = utils::toHex(buf.cbegin(), stream.bytes_written);
   notify_char.setValue(buf.cbegin(), stream.bytes_written);
   notify_char.notify();
 }
@@ -290,24 +511,23 @@ meter Lane::lengthPerLED() const {
   return l / n;
 }
 
-float Lane::LEDsPerMeter() const {
+float HOT_ATTR Lane::LEDsPerMeter() const {
   auto l = this->cfg.line_length.count();
   auto n = this->cfg.line_LEDs_num;
   return n / l;
 }
 
 /**
- * @brief iterate the strip to the next state and set the corresponding LEDs.
- * @note this function will block the current task for a short time (for the strip to show the LEDs).
- *       To make the strip to run with certain FPS, please add a delay outside this function
- *       (minus the time used in this function).
+ * @brief iterate the strip to the next state and fill the corresponding LEDs into the buffer.
+ * @note the LEDs are not shown. `loop` calls `show` at the frame boundary.
  */
-void Lane::iterate() {
+bool HOT_ATTR Lane::iterate() {
+  const auto _ = trace::scope_t(trace::event_t::ITERATE);
   if (strip == nullptr) {
     ESP_LOGE(TAG, "strip is null");
-    return;
+    return false;
   }
-  auto [next_state, params] = nextState(this->state, this->cfg, this->params);
+  auto [next_state, params] = nextState(this->state, this->cfg, this->params, pacer.frame_s());
   // meter
   const auto head       = this->state.head.count();
   const auto tail       = this->state.tail.count();
@@ -317,17 +537,12 @@ void Lane::iterate() {
   this->params          = params;
   this->state           = next_state;
   switch (next_state.status) {
-    case LaneStatus::FORWARD: {
-      strip->fill_and_show_forward(tail_index, count, cfg.color);
-      break;
-    }
-    case LaneStatus::BACKWARD: {
-      strip->fill_and_show_backward(tail_index, count, cfg.color);
-      break;
-    }
+    case LaneStatus::FORWARD:
+      return strip->fill_forward(tail_index, count, cfg.color);
+    case LaneStatus::BACKWARD:
+      return strip->fill_backward(tail_index, count, cfg.color);
     default:
-      break;
-      ;
+      return false;
   }
 }
 
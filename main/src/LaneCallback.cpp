@@ -6,16 +6,18 @@
 #include <pb_decode.h>
 #include "Lane.h"
 #include "utils.h"
+#include "trace.h"
 
 //****************************** Callback ************************************/
 
 namespace lane {
 void Lane::ControlCharCallback::onWrite(NimBLECharacteristic *characteristic, NimBLEConnInfo &connInfo) {
+  const auto _              = trace::scope_t(trace::event_t::BLE_CONTROL);
   auto TAG                  = "control";
-  auto data                 = characteristic->getValue();
+  const auto value          = characteristic->getValue();
   ::LaneControl control_msg = LaneControl_init_zero;
-  auto ostream              = pb_istream_from_buffer(data.data(), data.size());
-  auto ok                   = pb_decode(&ostream, LaneControl_fields, &control_msg);
+  auto istream              = pb_istream_from_buffer(value.data(), value.size());
+  auto ok                   = pb_decode(&istream, LaneControl_fields, &control_msg);
   if (!ok) {
     ESP_LOGE(TAG, "Failed to decode the control message");
     return;
@@ -29,6 +31,22 @@ void Lane::ControlCharCallback::onWrite(NimBLECharacteristic *characteristic, Ni
       ESP_LOGI(TAG, "Set status to %d", control_msg.msg.set_status.status);
       lane.setStatus(control_msg.msg.set_status.status);
       break;
+    case LaneControl_start_at_tag: {
+      const auto &msg = control_msg.msg.start_at;
+      // the other lanes count the delay from the end of the broadcast too
+      auto base = esp_timer_get_time();
+      if (lane.broadcastStartCb.is_valid()) {
+        if (const auto t = lane.broadcastStartCb(msg); t.has_value()) {
+          base = *t;
+        } else {
+          ESP_LOGW(TAG, "start is not broadcast; only this lane would start");
+        }
+      }
+      ESP_LOGI(TAG, "Start %d at %f m/s in %lu ms", msg.status, msg.speed, msg.delay_ms);
+      lane.startAt(static_cast<LaneStatus>(msg.status), static_cast<float>(msg.speed),
+                   base + static_cast<int64_t>(msg.delay_ms) * 1000);
+      break;
+    }
     default:
       ESP_LOGE(TAG, "Unknown message type");
       break;
@@ -36,61 +54,53 @@ void Lane::ControlCharCallback::onWrite(NimBLECharacteristic *characteristic, Ni
 }
 
 void Lane::ConfigCharCallback::onWrite(NimBLECharacteristic *characteristic, NimBLEConnInfo &connInfo) {
+  const auto _ = trace::scope_t(trace::event_t::BLE_CONFIG);
   using namespace common::lanely;
   const auto TAG          = "config::write";
-  auto data               = characteristic->getValue();
+  const auto value        = characteristic->getValue();
   ::LaneConfig config_msg = LaneConfig_init_zero;
-  auto ostream            = pb_istream_from_buffer(data.data(), data.size());
-  auto ok                 = pb_decode(&ostream, LaneConfig_fields, &config_msg);
+  auto istream            = pb_istream_from_buffer(value.data(), value.size());
+  auto ok                 = pb_decode(&istream, LaneConfig_fields, &config_msg);
   if (!ok) {
     ESP_LOGE("LANE", "Failed to decode the config message");
     return;
   }
-  lane.pref.begin(PREF_RECORD_NAME, false);
+  // applied by the loop at the next frame, which also persists it
   switch (config_msg.which_msg) {
     case LaneConfig_color_cfg_tag:
-      lane.pref.putULong(PREF_COLOR_NAME, config_msg.msg.color_cfg.rgb);
       ESP_LOGI(TAG, "Set color to 0x%06lx", config_msg.msg.color_cfg.rgb);
       lane.setColor(config_msg.msg.color_cfg.rgb);
       break;
     case LaneConfig_length_cfg_tag: {
-      if (lane.state.status != LaneStatus::STOP) {
-        ESP_LOGE(TAG, "Can't change the length while the lane is running");
-        return;
-      }
       ESP_LOGI(TAG, "line length=%.2f; active length=%.2f; total length=%.2f; line LEDs=%ld;",
                config_msg.msg.length_cfg.line_length_m,
                config_msg.msg.length_cfg.active_length_m,
                config_msg.msg.length_cfg.total_length_m,
                config_msg.msg.length_cfg.line_leds_num);
-      lane.pref.putFloat(PREF_LINE_LENGTH_NAME, config_msg.msg.length_cfg.line_length_m);
-      lane.pref.putFloat(PREF_ACTIVE_LENGTH_NAME, config_msg.msg.length_cfg.active_length_m);
-      lane.pref.putFloat(PREF_TOTAL_LENGTH_NAME, config_msg.msg.length_cfg.total_length_m);
-      lane.pref.putULong(PREF_LINE_LEDs_NUM_NAME, config_msg.msg.length_cfg.line_leds_num);
-      lane.cfg.line_length   = meter(config_msg.msg.length_cfg.line_length_m);
-      lane.cfg.active_length = meter(config_msg.msg.length_cfg.active_length_m);
-      lane.cfg.finish_length = meter(config_msg.msg.length_cfg.total_length_m);
-      lane.cfg.line_LEDs_num = config_msg.msg.length_cfg.line_leds_num;
-      lane.setMaxLEDs(config_msg.msg.length_cfg.line_leds_num);
+      lane.setLength(meter(config_msg.msg.length_cfg.line_length_m),
+                     meter(config_msg.msg.length_cfg.active_length_m),
+                     meter(config_msg.msg.length_cfg.total_length_m),
+                     config_msg.msg.length_cfg.line_leds_num);
       break;
     }
+    default:
+      ESP_LOGE(TAG, "Unknown config type");
+      break;
   }
-  lane.pref.end();
 }
 void Lane::ConfigCharCallback::onRead(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) {
-  const auto TAG        = "config::read";
-  constexpr size_t size = LaneConfigRO_size + 16;
-  uint8_t data[size];
+  const auto TAG            = "config::read";
   ::LaneConfigRO config_msg = LaneConfigRO_init_zero;
-  auto ostream              = pb_ostream_from_buffer(data, size);
+  const auto cfg            = lane.getConfig();
+  auto ostream              = pb_ostream_from_buffer(encode_buffer.data(), encode_buffer.size());
   // https://stackoverflow.com/questions/56661663/nanopb-encode-always-size-0-but-no-encode-failure
   config_msg.has_color_cfg              = true;
   config_msg.has_length_cfg             = true;
-  config_msg.length_cfg.line_length_m   = lane.cfg.line_length.count();
-  config_msg.length_cfg.active_length_m = lane.cfg.active_length.count();
-  config_msg.length_cfg.total_length_m  = lane.cfg.finish_length.count();
-  config_msg.length_cfg.line_leds_num   = lane.cfg.line_LEDs_num;
-  config_msg.color_cfg.rgb              = lane.cfg.color;
+  config_msg.length_cfg.line_length_m   = cfg.line_length.count();
+  config_msg.length_cfg.active_length_m = cfg.active_length.count();
+  config_msg.length_cfg.total_length_m  = cfg.finish_length.count();
+  config_msg.length_cfg.line_leds_num   = cfg.line_LEDs_num;
+  config_msg.color_cfg.rgb              = cfg.color;
   ESP_LOGI(TAG, "line length=%.2f; active length=%.2f; total length=%.2f; line LEDs=%ld; Color=0x%06lx",
            config_msg.length_cfg.line_length_m, config_msg.length_cfg.active_length_m,
            config_msg.length_cfg.total_length_m, config_msg.length_cfg.line_leds_num,
@@ -100,8 +110,8 @@ void Lane::ConfigCharCallback::onRead(NimBLECharacteristic *pCharacteristic, Nim
     return;
   }
 
-  ESP_LOGD(TAG, "encoded(%d): %s", ostream.bytes_written, utils::toHex(data, ostream.bytes_written).c_str());
+  ESP_LOGD(TAG, "encoded(%d): %s", ostream.bytes_written, utils::toHex(encode_buffer.data(), ostream.bytes_written).c_str());
 
-  pCharacteristic->setValue(data, ostream.bytes_written);
+  pCharacteristic->setValue(encode_buffer.data(), ostream.bytes_written);
 }
 };
@@ -10,32 +10,38 @@
 #include "etl/optional.h"
 #include "etl/span.h"
 #include "etl/algorithm.h"
+#include "etl/string.h"
 #include <esp_check.h>
-#include <lwip/def.h>
+#include <esp_log.h>
 #include "whitelist.h"
+#include "ad_parser.h"
+#include "ad_decoder.h"
 #include "pb_decode.h"
+#include "common.h"
+#include "metrics.h"
+#include "trace.h"
+#include "defer_log.h"
+#include "qos.h"
+#include "name_table.h"
+#include "hr_history.h"
 
 static auto TAG        = "AdCallback";
 static auto NOTIFY_TAG = "NotifyCallback";
 
-struct ScanCallbackParam {
-  std::function<void()> *cb;
-  TaskHandle_t handle;
-  ~ScanCallbackParam() {
-    if (handle != nullptr) {
-      vTaskDelete(handle);
-    }
-    delete cb;
-  }
-};
+using hr_pair_t = etl::pair<std::string_view, uint8_t>;
+/// name length (1) + name + hr (1). encoded on the stack, a longer name is not forwarded
+constexpr size_t MAX_HR_RECORD_SIZE = 64;
 
-using hr_pair_t = etl::pair<std::string, uint8_t>;
+size_t sizeNeeded(const hr_pair_t &pair) {
+  auto &[name, hr] = pair;
+  return name.size() + 2;
+}
 
 // see hr_data.ksy. would mutate the output
 etl::optional<size_t> encode(const hr_pair_t &pair, etl::span<uint8_t> &output) {
   auto &[name, hr] = pair;
   auto id_len      = name.size();
-  if (id_len > 255) {
+  if (id_len > 255 || output.size() < sizeNeeded(pair)) {
     return etl::nullopt;
   }
   auto offset    = 0;
@@ -50,250 +56,371 @@ etl::optional<size_t> encode(const hr_pair_t &pair, etl::span<uint8_t> &output)
   return offset;
 }
 
-size_t sizeNeeded(const hr_pair_t &pair) {
-  auto &[name, hr] = pair;
-  return name.size() + 2;
-}
-
-struct WatchInfo {
-  static constexpr auto TIME_WIDTH = 5;
-  uint8_t time[TIME_WIDTH]         = {0};
-  uint16_t steps                   = 0;
-  uint16_t kcal                    = 0;
-  uint8_t hr                       = 0;
-  // mm/Hg
-  uint8_t SBP = 0;
-  // mm/Hg
-  uint8_t DBP     = 0;
-  uint8_t battery = 0;
-  // uint16_t / 10 in Celsius
-  float temperature = 0;
-  uint8_t SpO2      = 0;
-  static WatchInfo from_bytes(const uint8_t *data, size_t size) {
-    WatchInfo info = {};
-    auto offset    = 0;
-    std::copy(data, data + TIME_WIDTH, info.time);
-    offset += TIME_WIDTH;
-    std::copy(data + offset, data + offset + 2, reinterpret_cast<uint8_t *>(&info.steps));
-    info.steps = ntohs(info.steps);
-    offset += 2;
-    std::copy(data + offset, data + offset + 2, reinterpret_cast<uint8_t *>(&info.kcal));
-    info.kcal = ntohs(info.kcal);
-    offset += 2;
-    info.hr = data[offset];
-    offset += 1;
-    info.SBP = data[offset];
-    offset += 1;
-    info.DBP = data[offset];
-    offset += 1;
-    info.battery = data[offset];
-    offset += 1;
-    offset += 2; // ignore
-    uint16_t temp;
-    std::copy(data + offset, data + offset + 2, reinterpret_cast<uint8_t *>(&temp));
-    temp             = ntohs(temp);
-    info.temperature = static_cast<float>(temp) / 10.0f;
-    offset += 2;
-    offset += 2; // ignore
-    info.SpO2 = data[offset];
-    offset += 1;
-    // ignore rest
-    return info;
+/**
+ * @brief send the record to the client with the HR characteristic
+ */
+static void sendHr(NimBLECharacteristic *hr_char, std::string_view name, uint8_t hr, const char *tag) {
+  if (!qos::admit_hr_notify()) {
+    return;
+  }
+  auto buf        = std::array<uint8_t, MAX_HR_RECORD_SIZE>{};
+  auto span       = etl::span<uint8_t>(buf.data(), buf.size());
+  const auto size = encode(hr_pair_t{name, hr}, span);
+  if (!size.has_value()) {
+    ESP_LOGE(tag, "Failed to encode the data");
+    return;
+  }
+  if (hr_char == nullptr) {
+    ESP_LOGE(tag, "HR characteristic is null");
+    return;
   }
-};
+  hr_char->setValue(span.data(), size.value());
+  if (hr_char->notify()) {
+    metrics::registry.hr_notify_sent.inc();
+  } else {
+    metrics::registry.hr_notify_failed.inc();
+  }
+}
 
-std::string to_string(const WatchInfo &info) {
-  std::stringstream ss;
-  // clang-format off
-  ss << "steps=" << info.steps <<
-      "; kcal=" << info.kcal <<
-      "; HR=" << static_cast<int>(info.hr) <<
-      "; SBP=" << static_cast<int>(info.SBP) <<
-      "; DBP=" << static_cast<int>(info.DBP) <<
-      "; Battery=" << static_cast<int>(info.battery) <<
-      "; Temperature=" << info.temperature <<
-      "; SpO2=" << static_cast<int>(info.SpO2);
-  // clang-format on
-  return ss.str();
+/**
+ * @brief add the record to the history, and send it to the client with the HR characteristic
+ * @param name a handle of `name_table::table` held by the caller
+ */
+static void notifyHr(NimBLECharacteristic *hr_char, name_table::handle_t name, uint8_t hr, const char *tag) {
+  // kept even if the notification is skipped
+  hr_history::record(name, hr);
+  sendHr(hr_char, name_table::table.view(name), hr, tag);
 }
 
-void ScanCallback::handleHrWhiteListConnection(BLEAdvertisedDevice *advertisedDevice) {
-  auto name    = advertisedDevice->getName();
-  auto pp      = advertisedDevice->getPayload();
-  auto l       = advertisedDevice->getPayloadLength();
-  auto pHrChar = this->hr_char;
-  ESP_LOGI(TAG, "Name: %s, Data: %s, RSSI: %d", name.c_str(),
-           utils::toHex(pp, l).c_str(),
-           advertisedDevice->getRSSI());
-  auto &device_map = this->devices;
-  auto native_addr = advertisedDevice->getAddress().getNative();
-  auto addr        = DeviceAddr{};
+void ScanCallback::handleHrWhiteListConnection(BLEAdvertisedDevice *advertisedDevice, std::string_view name) {
+  const auto &address    = advertisedDevice->getAddress();
+  const auto native_addr = address.getNative();
+  auto addr              = DeviceAddr{};
   std::copy(native_addr, native_addr + BLE_MAC_ADDR_SIZE, addr.begin());
+  // skip the bands being connected without taking the lock, which is held by the connect task
+  if (const auto known = devices.find(addr); known.has_value() && known->state != device_registry::state_t::DISCONNECTED) {
+    return;
+  }
+  // the name is interned once here, and the notify callback only keeps the handle.
+  // the registry holds it until the band is disconnected
+  const auto handle = name_table::table.intern(name);
+  if (handle == name_table::INVALID) {
+    ESP_LOGW(TAG, "full name table; drop %.*s", static_cast<int>(name.size()), name.data());
+    return;
+  }
+  // only one connection attempt for a band at a time
+  const auto claimed = devices.claim(addr, handle);
+  if (!claimed.has_value()) {
+    ESP_LOGD(TAG, "%.*s is connecting/connected or the registry is full", static_cast<int>(name.size()), name.data());
+    name_table::table.release(handle);
+    return;
+  }
+  ESP_LOGI(TAG, "Name: %.*s, RSSI: %d", static_cast<int>(name.size()), name.data(), advertisedDevice->getRSSI());
+  ESP_LOG_BUFFER_HEX_LEVEL(TAG, advertisedDevice->getPayload(), advertisedDevice->getPayloadLength(), ESP_LOG_DEBUG);
+  if (!startConnectTask()) {
+    devices.finish_connect(addr, false);
+    return;
+  }
+  auto req          = connect_req_t{};
+  req.ble_addr.type = address.getType();
+  std::copy(native_addr, native_addr + BLE_MAC_ADDR_SIZE, req.ble_addr.val);
+  req.prev_client = claimed->client;
+  req.name        = handle;
+  // never block the scanning thread with the connection
+  if (xQueueSend(connect_queue, &req, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "too many bands waiting for connection; drop %.*s", static_cast<int>(name.size()), name.data());
+    devices.finish_connect(addr, false);
+  }
+}
 
-  auto connect_task = [advertisedDevice, pHrChar, &device_map, addr]() {
-    /// user should check the return value of this function
-    auto configClient = [advertisedDevice](BLEClient &client) -> NimBLERemoteCharacteristic * {
-      auto name                = advertisedDevice->getName();
-      const auto serviceUUID   = "180D";
-      const auto heartRateUUID = "2A37";
-      // TODO: handle `device_map` at `onConnect` and `onDisconnect`
-      // with `setClientCallbacks` (which is a client callback)
-      client.connect(advertisedDevice);
-      auto *pService = client.getService(serviceUUID);
-      if (pService == nullptr) {
-        ESP_LOGE(TAG, "Failed to find service UUID: %s for %s", serviceUUID, name.c_str());
-        client.disconnect();
-        return nullptr;
-      }
-      auto *pCharacteristic = pService->getCharacteristic(heartRateUUID);
-      if (pCharacteristic == nullptr) {
-        ESP_LOGE(TAG, "Failed to find HR characteristic UUID: %s for %s", heartRateUUID, name.c_str());
-        client.disconnect();
-        return nullptr;
+bool ScanCallback::startConnectTask() {
+  static_assert(std::is_trivially_copyable_v<connect_req_t>, "copied by the queue");
+  if (connect_queue != nullptr) {
+    return true;
+  }
+  connect_queue = xQueueCreateStatic(CONNECT_QUEUE_SIZE, sizeof(connect_req_t), connect_queue_storage.data(), &connect_queue_buf);
+  auto task     = [](void *param) {
+    auto &self = *static_cast<ScanCallback *>(param);
+    auto req   = connect_req_t{};
+    for (;;) {
+      if (xQueueReceive(self.connect_queue, &req, portMAX_DELAY) == pdTRUE) {
+        self.connect(req);
       }
+    }
+  };
+  if (connect_task.create(task, this) == nullptr) {
+    ESP_LOGE(TAG, "Failed to create connect task");
+    connect_queue = nullptr;
+    return false;
+  }
+  return true;
+}
 
-      if (!pCharacteristic->canNotify()) {
-        ESP_LOGE(TAG, "HR Characteristic cannot notify for %s", name.c_str());
-        client.disconnect();
-        return nullptr;
-      }
-      ESP_LOGI(TAG, "Connected to %s", name.c_str());
-      return pCharacteristic;
-    };
-    auto name   = advertisedDevice->getName();
-    auto notify = [name, pHrChar](
-                      NimBLERemoteCharacteristic *pBLERemoteCharacteristic,
-                      const uint8_t *pData,
-                      size_t length,
-                      bool isNotify) {
-      if (length >= 2) {
-        // the first byte is always 0x04. the second byte is the heart rate.
-        auto hr = pData[1];
-        if (hr != 0) {
-          ESP_LOGI(NOTIFY_TAG, "%d bpm from %s", hr, name.c_str());
-          auto pair = hr_pair_t{name, hr};
-          auto sz   = sizeNeeded(pair);
-          auto buf  = new uint8_t[sz];
-          auto span = etl::span<uint8_t>(buf, sz);
+void ScanCallback::connect(const connect_req_t &req) {
+  auto addr = DeviceAddr{};
+  std::copy(req.ble_addr.val, req.ble_addr.val + BLE_MAC_ADDR_SIZE, addr.begin());
+  // only for the logs; the notify callback keeps the handle for the whole connection
+  const auto view   = name_table::table.view(req.name);
+  const auto name   = etl::string<name_table::MAX_NAME_LENGTH>(view.data(), view.size());
+  auto *pHrChar     = hr_char;
+  auto &device_map  = devices;
+  auto *prev_client = req.prev_client;
+  /// discover the HR characteristic of a connected client.
+  /// user should check the return value of this function
+  auto discover = [&name](BLEClient &client) -> NimBLERemoteCharacteristic * {
+    const auto serviceUUID   = "180D";
+    const auto heartRateUUID = "2A37";
+    auto *pService           = client.getService(serviceUUID);
+    if (pService == nullptr) {
+      ESP_LOGE(TAG, "Failed to find service UUID: %s for %s", serviceUUID, name.c_str());
+      client.disconnect();
+      return nullptr;
+    }
+    auto *pCharacteristic = pService->getCharacteristic(heartRateUUID);
+    if (pCharacteristic == nullptr) {
+      ESP_LOGE(TAG, "Failed to find HR characteristic UUID: %s for %s", heartRateUUID, name.c_str());
+      client.disconnect();
+      return nullptr;
+    }
 
-          auto size = encode(pair, span);
-          if (size.has_value()) {
-            if (pHrChar != nullptr) {
-              pHrChar->setValue(span.data(), size.value());
-              pHrChar->notify();
-            } else {
-              ESP_LOGE(NOTIFY_TAG, "HR characteristic is null");
-            }
-          } else {
-            ESP_LOGE(NOTIFY_TAG, "Failed to encode the data");
-          }
-          delete[] buf;
-        }
+    if (!pCharacteristic->canNotify()) {
+      ESP_LOGE(TAG, "HR Characteristic cannot notify for %s", name.c_str());
+      client.disconnect();
+      return nullptr;
+    }
+    ESP_LOGI(TAG, "Connected to %s", name.c_str());
+    return pCharacteristic;
+  };
+  auto on_hr = [handle = req.name, pHrChar](const uint8_t *pData, size_t length) {
+    if (length >= 2) {
+      // the first byte is always 0x04. the second byte is the heart rate.
+      auto hr = pData[1];
+      if (hr != 0) {
+        DLOGI(NOTIFY_TAG, "%d bpm from %s", hr, defer_log::str_t{name_table::table.view(handle)});
+        notifyHr(pHrChar, handle, hr, NOTIFY_TAG);
       }
-    };
+    }
+  };
+  auto notify = [on_hr](NimBLERemoteCharacteristic *pBLERemoteCharacteristic,
+                        const uint8_t *pData,
+                        size_t length,
+                        bool isNotify) {
+    on_hr(pData, length);
+  };
 
-    auto pInfo = etl::find_if(device_map.begin(), device_map.end(), [&addr](const DeviceInfo &info) {
-      return std::equal(addr.begin(), addr.end(), info.address.begin());
-    });
-    if (pInfo == device_map.end()) {
-      ESP_LOGI(TAG, "Configure new band %s", name.c_str());
-      // TODO: handle client deletion with `deleteClient` with `deleteClient`
-      auto &client = *NimBLEDevice::createClient();
-      /// Note, intended to be allocated in heap
-      auto info = DeviceInfo{
-          addr,
-          &client,
-      };
-      auto pChar = configClient(client);
-      if (pChar != nullptr) {
-        device_map.emplace_back(info);
-        pChar->subscribe(true, notify);
-        // it's a valid device. we could configure disconnect callback
-        auto cb = new HRClientCallbacks(&device_map, addr);
-        // Manually delete cb would cause a crash
-        // My guess is that the callback is deleted by the NimBLE library
-        // so deleting it again would cause a crash
-        client.setClientCallbacks(cb);
-      } else {
-        ESP_LOGE(TAG, "Failed to configure the band %s", name.c_str());
+  /**
+   * @brief connect and subscribe the HR characteristic with the cached handles,
+   *        fallback to the full discovery if there's no cache or the cache is stale
+   * @return if the HR characteristic is subscribed
+   */
+  auto subscribe = [&](BLEClient &client) -> bool {
+    if (!client.connect(NimBLEAddress(req.ble_addr))) {
+      ESP_LOGE(TAG, "Failed to connect to %s", name.c_str());
+      return false;
+    }
+    if (const auto cached = handle_cache.get(addr); cached.has_value()) {
+      if (gatt_cache::subscribe_by_handles(client, *cached, addr, on_hr)) {
+        ESP_LOGI(TAG, "Subscribed %s with cached handles (%d, %d)", name.c_str(), cached->hr_value, cached->hr_cccd);
+        return true;
       }
-    } else {
-      ESP_LOGI(TAG, "Reconfigure known band %s", name.c_str());
-      auto &info   = *pInfo;
-      auto &client = *info.client;
-      auto pChar   = configClient(client);
-      // What would happen to the old notify callback?
-      if (pChar != nullptr) {
-        pChar->subscribe(true, notify);
+      ESP_LOGW(TAG, "Stale handles of %s; fallback to discovery", name.c_str());
+      handle_cache.invalidate(addr);
+      if (!client.isConnected()) {
+        return false;
       }
     }
+    auto pChar = discover(client);
+    if (pChar == nullptr) {
+      return false;
+    }
+    // make sure there's no route left by the cached path, otherwise we would notify twice
+    gatt_cache::unroute(addr);
+    if (!pChar->subscribe(true, notify)) {
+      ESP_LOGE(TAG, "Failed to subscribe %s", name.c_str());
+      client.disconnect();
+      return false;
+    }
+    if (auto *cccd = pChar->getDescriptor(NimBLEUUID(static_cast<uint16_t>(0x2902))); cccd != nullptr) {
+      handle_cache.put(addr, gatt_cache::handles_t{
+                                 .hr_value = pChar->getHandle(),
+                                 .hr_cccd  = cccd->getHandle(),
+                             });
+    }
+    return true;
   };
 
-  auto param = new ScanCallbackParam{
-      new std::function<void()>(connect_task),
-      nullptr};
-  // You should run this in a new thread because the callback is blocking.
-  // Never block the scanning thread
-  auto res = xTaskCreate([](void *cb) {
-    auto &param = *reinterpret_cast<ScanCallbackParam *>(cb);
-    auto f      = param.cb;
-    (*f)();
-    // handled by the destructor
-    delete &param;
-  },
-                         "connect", 4096, param, 1, &param->handle);
-  if (res != pdPASS) {
-    ESP_LOGE(TAG, "Failed to create task");
-    delete param;
-    return;
+  auto *pClient = prev_client;
+  if (pClient == nullptr) {
+    ESP_LOGI(TAG, "Configure new band %s", name.c_str());
+    pClient = NimBLEDevice::createClient();
+    if (pClient == nullptr) {
+      // out of clients. take over the one of a band that has gone
+      pClient = NimBLEDevice::getDisconnectedClient();
+    }
+    if (pClient == nullptr || !device_map.attach_client(addr, pClient)) {
+      ESP_LOGE(TAG, "No client available for %s", name.c_str());
+      device_map.finish_connect(addr, false);
+      return;
+    }
+    // owned by us, NimBLE should never delete it
+    pClient->setClientCallbacks(&client_callbacks, false);
+  } else {
+    ESP_LOGI(TAG, "Reconfigure known band %s", name.c_str());
+  }
+  // What would happen to the old notify callback?
+  const bool ok = subscribe(*pClient) && pClient->isConnected();
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to configure the band %s", name.c_str());
+  }
+  device_map.finish_connect(addr, ok);
+  // NimBLE stops the scan to initiate the connection
+  if (auto *scan = NimBLEDevice::getScan(); !scan->isScanning()) {
+    scan->start(0, true);
   }
 }
 
-void ScanCallback::handleHrAdvertised(BLEAdvertisedDevice *advertisedDevice) {
+void ScanCallback::handleHrAdvertised(const ad_decoder::entry_t &decoder, const ad::fields_t &fields, const uint8_t *addr) {
   // https://bluetoothle.wiki/advertising
   static constexpr auto TAG = "handleHrAdvertised";
-  auto payload              = etl::span<uint8_t>(advertisedDevice->getPayload(), advertisedDevice->getPayloadLength());
-  auto name                 = advertisedDevice->getName();
-  auto pattern              = etl::search(payload.begin(), payload.end(), name.begin(), name.end());
-  if (pattern != payload.end()) {
-    auto msg = etl::span(pattern + name.size() + 2, payload.end());
-    ESP_LOGD(TAG, "(%s) %s", utils::toHex(msg.data(), msg.size()).c_str(), name.c_str());
-    auto info = WatchInfo::from_bytes(msg.data(), msg.size());
-    ESP_LOGI(TAG, "%s", to_string(info).c_str());
-    auto pair = hr_pair_t{name, info.hr};
-    auto sz   = sizeNeeded(pair);
-    auto buf  = new uint8_t[sz];
-    auto span = etl::span<uint8_t>(buf, sz);
-    auto size = encode(pair, span);
-    if (size.has_value()) {
-      if (hr_char != nullptr) {
-        hr_char->setValue(span.data(), size.value());
-        hr_char->notify();
-      } else {
-        ESP_LOGE(TAG, "HR characteristic is null");
-      }
-    } else {
-      ESP_LOGE(TAG, "Failed to encode the data");
-    }
-    delete[] buf;
+  if (fields.malformed) {
+    ESP_LOGD(TAG, "malformed payload from %02x%02x%02x%02x%02x%02x", addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+  }
+  const auto record = decoder.decode(fields);
+  if (!record.has_value()) {
+    return;
   }
+  // the address in hex is used as the name if the device has no name
+  char addr_str[BLE_MAC_ADDR_SIZE * 2];
+  auto name = std::string_view(reinterpret_cast<const char *>(fields.name.data()), fields.name.size());
+  if (name.empty()) {
+    name = std::string_view(addr_str, utils::sprintHex(addr_str, sizeof(addr_str), addr, BLE_MAC_ADDR_SIZE));
+  }
+  DLOGI(TAG, "[%s] %s HR=%d; Battery=%d; steps=%d; Temperature=%.1f; SpO2=%d",
+        decoder.vendor, defer_log::str_t{name}, record->hr,
+        record->battery.value_or(0), record->steps.value_or(0),
+        record->temperature.value_or(0), record->SpO2.value_or(0));
+  // a watch without a name is only kept in the history if its address is white listed,
+  // otherwise the passers-by would take over the name table and the history
+  if (fields.name.empty() && !_matcher.match_addr(addr)) {
+    sendHr(hr_char, name, record->hr, TAG);
+    return;
+  }
+  // a lookup once the watch is known. the history takes its own reference
+  const auto handle = name_table::table.intern(name);
+  if (handle == name_table::INVALID) {
+    DLOGW(TAG, "full name table; drop %s", defer_log::str_t{name});
+    return;
+  }
+  notifyHr(hr_char, handle, record->hr, TAG);
+  name_table::table.release(handle);
 }
 
 void ScanCallback::onResult(BLEAdvertisedDevice *advertisedDevice) {
-  auto name = advertisedDevice->getName();
+  const auto _           = trace::scope_t(trace::event_t::BLE_SCAN_RESULT);
+  const auto native_addr = advertisedDevice->getAddress().getNative();
+  const auto payload     = ad::bytes_t(advertisedDevice->getPayload(), advertisedDevice->getPayloadLength());
+  // the cheapest check goes first. most of the advertisements are just repeated
+  if (!ad_cache.should_forward(native_addr, payload.data(), payload.size(), esp_timer_get_time())) {
+    return;
+  }
+  metrics::registry.scan_results.inc();
+  metrics::registry.scan_rate.tick(metrics::now_ms());
+  // a view of the name in the payload. `getName` would return a copy
+  const auto fields = ad::parse(payload);
+  const auto name   = std::string_view(reinterpret_cast<const char *>(fields.name.data()), fields.name.size());
   // ESP_LOGI("onResult", "[%s] %s", name.c_str(), advertisedDevice->getAddress().toString().c_str());
-  if (onResultCb != nullptr) {
-    onResultCb(advertisedDevice->getName(), advertisedDevice->getAddress().getNative());
+  if (onResultCb.is_valid()) {
+    onResultCb(name, native_addr);
+  }
+  if (_matcher.match(native_addr, name)) {
+    handleHrWhiteListConnection(advertisedDevice, name);
   }
-  for (auto &item : _white_list) {
-    bool is_white = white_list::is_device_in_whitelist(item, *advertisedDevice);
-    if (is_white) {
-      handleHrWhiteListConnection(advertisedDevice);
+  if (const auto *decoder = ad_decoder::find(fields); decoder != nullptr) {
+    handleHrAdvertised(*decoder, fields, native_addr);
+  }
+}
+
+void ScanCallback::set_white_list(const white_list::fixed_list_t &list) {
+  _white_list.clear();
+  _matcher.clear();
+  for (const auto &fixed : list) {
+    auto item = white_list::to_item(fixed);
+    if (_matcher.add(item)) {
+      _white_list.push_back(std::move(item));
     }
   }
-  // starts with "Y"
-  if (advertisedDevice->getName().find('Y') == 0) {
-    handleHrAdvertised(advertisedDevice);
+  bump_white_list_version();
+  syncControllerWhiteList();
+}
+
+bool ScanCallback::add_white_item(const white_list::item_t &item) {
+  if (!_matcher.add(item)) {
+    return false;
+  }
+  _white_list.push_back(item);
+  bump_white_list_version();
+  // a name item would turn the controller filtering off
+  syncControllerWhiteList();
+  return true;
+}
+
+bool ScanCallback::remove_white_item(const white_list::item_t &item) {
+  if (!_matcher.remove(item)) {
+    return false;
+  }
+  auto it = std::find_if(_white_list.begin(), _white_list.end(), [&item](const auto &i) { return white_list::same_item(i, item); });
+  if (it != _white_list.end()) {
+    _white_list.erase(it);
+  }
+  bump_white_list_version();
+  syncControllerWhiteList();
+  return true;
+}
+
+void ScanCallback::syncControllerWhiteList() {
+  const auto TAG = "syncControllerWhiteList";
+  // address type is not recorded in the white list, so both of them are added
+  constexpr uint8_t addr_types[] = {BLE_ADDR_PUBLIC, BLE_ADDR_RANDOM};
+  auto to_address                = [](const white_list::matcher_t::addr_t &addr, uint8_t type) {
+    auto ble_addr = ble_addr_t{};
+    ble_addr.type = type;
+    std::copy(addr.begin(), addr.end(), ble_addr.val);
+    return NimBLEAddress(ble_addr);
+  };
+  const auto target_addrs = effective_filter_mode() == ScanFilterMode::CONTROLLER ? _matcher.addresses() : std::vector<white_list::matcher_t::addr_t>{};
+  if (target_addrs == controller_addrs) {
+    return;
+  }
+
+  auto *scan              = NimBLEDevice::getScan();
+  const bool was_scanning = scan->isScanning();
+  if (was_scanning) {
+    scan->stop();
+  }
+  for (const auto &addr : controller_addrs) {
+    for (const auto type : addr_types) {
+      NimBLEDevice::whiteListRemove(to_address(addr, type));
+    }
+  }
+  controller_addrs.clear();
+  bool ok = true;
+  for (const auto &addr : target_addrs) {
+    for (const auto type : addr_types) {
+      ok = ok && NimBLEDevice::whiteListAdd(to_address(addr, type));
+    }
+    controller_addrs.push_back(addr);
+  }
+  if (ok && !controller_addrs.empty()) {
+    ESP_LOGI(TAG, "%d address(es) in controller white list", controller_addrs.size());
+    scan->setFilterPolicy(BLE_HCI_SCAN_FILT_USE_WL);
+  } else {
+    if (!ok) {
+      ESP_LOGW(TAG, "controller white list is full; fallback to host filtering");
+    }
+    scan->setFilterPolicy(BLE_HCI_SCAN_FILT_NO_WL);
+  }
+  if (was_scanning) {
+    scan->start(0, true);
   }
 }
 
@@ -317,84 +444,150 @@ void ServerCallbacks::onMTUChange(uint16_t MTU, NimBLEConnInfo &connInfo) {
 }
 void HRClientCallbacks::onDisconnect(NimBLEClient *pClient, int reason) {
   const auto TAG = "HRClientCallbacks::onDisconnect";
+  auto addr      = DeviceAddr{};
+  std::copy_n(pClient->getPeerAddress().getNative(), addr.size(), addr.begin());
   ESP_LOGI(TAG, "Disconnected from %s", utils::toHex(addr.data(), addr.size()).c_str());
-  auto &addr = this->addr;
-  auto pInfo = etl::find_if(devices->begin(), devices->end(), [&addr](const DeviceInfo &info) {
-    return std::equal(addr.begin(), addr.end(), info.address.begin());
-  });
-  if (pInfo != devices->end()) {
-    devices->erase(pInfo);
-  } else {
-    ESP_LOGE(TAG, "Failed to find the device");
+  // the client is kept in the registry and would be reused by the next connection.
+  // deleting it here would race with the connect task
+  devices->on_disconnected(addr);
+}
+
+bool WhiteListCallback::decode(const uint8_t *data, size_t size, uint32_t &version) {
+  auto assign  = [this](auto &&r) { request = std::forward<decltype(r)>(r); };
+  auto istream = pb_istream_from_buffer(data, size);
+  if (auto fixed = white_list::unmarshal_white_list_request_fixed(&istream, fixed_request); fixed.has_value()) {
+    version = fixed_request.version;
+    std::visit(assign, std::move(fixed.value()));
+    return true;
+  }
+  ESP_LOGD(TAG, "fallback to the dynamic decoder");
+  istream                   = pb_istream_from_buffer(data, size);
+  ::WhiteListRequest pb_req = WhiteListRequest_init_zero;
+  auto req                  = white_list::unmarshal_while_list_request(&istream, pb_req);
+  version                   = pb_req.version;
+  if (!req.has_value()) {
+    return false;
   }
-  bool ok = NimBLEDevice::deleteClient(pClient);
+  std::visit(assign, std::move(req.value()));
+  return true;
+}
+
+void WhiteListCallback::respond(NimBLECharacteristic *pCharacteristic, white_list::response_t resp) {
+  const auto version          = getVersion.is_valid() ? getVersion() : 0;
+  auto ostream                = pb_ostream_from_buffer(encode_buffer.data(), encode_buffer.size());
+  ::WhiteListResponse pb_resp = WhiteListResponse_init_zero;
+  auto ok                     = white_list::marshal_white_list_response(&ostream, pb_resp, resp, version);
   if (!ok) {
-    ESP_LOGE(TAG, "Failed to delete client");
+    ESP_LOGE(TAG, "Failed to encode the response");
+    pCharacteristic->setValue(0);
     return;
   }
+  pCharacteristic->setValue(encode_buffer.data(), ostream.bytes_written);
+  pCharacteristic->notify();
 }
 
 void WhiteListCallback::onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) {
-  auto value                = pCharacteristic->getValue();
-  auto raw                  = const_cast<uint8_t *>(value.data());
-  auto istream              = pb_istream_from_buffer(raw, value.size());
-  ::WhiteListRequest pb_req = WhiteListRequest_init_zero;
-  auto req_opt              = white_list::unmarshal_while_list_request(&istream, pb_req);
-  if (!req_opt.has_value()) {
+  const auto _      = trace::scope_t(trace::event_t::BLE_WHITE_LIST);
+  const auto value  = pCharacteristic->getValue();
+  uint32_t based_on = 0;
+  if (!decode(value.data(), value.size(), based_on)) {
     ESP_LOGE(TAG, "Failed to decode the request");
     pCharacteristic->setValue(0);
     return;
   }
-  auto &req = req_opt.value();
-  if (std::holds_alternative<white_list::command_t>(req)) {
-    auto command = std::get<white_list::command_t>(req);
-    switch (command) {
-      case WhiteListCommand_REQUEST: {
-        white_list::response_t resp{};
-        if (getList != nullptr) {
-          auto list = getList();
-          resp      = white_list::response_t{std::move(list)};
+  auto &req = request;
+  if (const auto *command = std::get_if<white_list::command_t>(&req); command != nullptr && *command == WhiteListCommand_REQUEST) {
+    if (getList.is_valid()) {
+      respond(pCharacteristic, white_list::response_t{getList()});
+    } else {
+      ESP_LOGE(TAG, "callback getList is not set");
+      respond(pCharacteristic, white_list::response_t{WhiteListErrorCode_NULL});
+    }
+    return;
+  }
+
+  // the rest would change the list
+  if (based_on != 0 && getVersion.is_valid() && based_on != getVersion()) {
+    ESP_LOGW(TAG, "version mismatch: %lu (request) != %lu (current)", based_on, getVersion());
+    respond(pCharacteristic, white_list::response_t{WhiteListErrorCode_VERSION_MISMATCH});
+    return;
+  }
+  // either `white_list::item_t` or `white_list::fixed_item_t`
+  auto log_item = [](const char *action, const auto &item) {
+    auto log = [action](const auto &i) {
+      if constexpr (std::is_same_v<std::decay_t<decltype(i)>, white_list::Addr>) {
+        ESP_LOGI(TAG, "%s Addr: %s", action, utils::toHex(i.addr.data(), i.addr.size()).c_str());
+      } else {
+        ESP_LOGI(TAG, "%s Name: %s", action, i.name.c_str());
+      }
+    };
+    std::visit(log, item);
+  };
+  auto code = WhiteListErrorCode_OK;
+  if (const auto *command = std::get_if<white_list::command_t>(&req)) {
+    switch (*command) {
+      case WhiteListCommand_CLEAR: {
+        ESP_LOGI(TAG, "Clear");
+        if (clearList.is_valid()) {
+          clearList();
         } else {
-          ESP_LOGE(TAG, "callback getList is nullptr");
-          resp = white_list::response_t{WhiteListErrorCode_NULL};
+          ESP_LOGE(TAG, "callback clearList is not set");
+          code = WhiteListErrorCode_NULL;
         }
-        uint8_t buf[ScanCallback::MAX_OSTREAM_SIZE];
-        auto ostream                = pb_ostream_from_buffer(raw, sizeof(buf));
-        ::WhiteListResponse pb_resp = WhiteListResponse_init_zero;
-        auto ok                     = white_list::marshal_white_list_response(&ostream, pb_resp, resp);
-        if (!ok) {
-          ESP_LOGE(TAG, "Failed to encode the response");
-          pCharacteristic->setValue(0);
-          return;
-        }
-        pCharacteristic->setValue(buf, ostream.bytes_written);
-        pCharacteristic->notify();
         break;
       }
       default: {
-        ESP_LOGE(TAG, "Unknown command: %d", command);
-        break;
+        ESP_LOGE(TAG, "Unknown command: %d", *command);
+        return;
       }
     }
-  } else if (std::holds_alternative<white_list::list_t>(req)) {
-    auto list = std::get<white_list::list_t>(req);
-    if (list.empty()) {
+  } else if (const auto *fixed = std::get_if<white_list::fixed_list_t>(&req)) {
+    if (fixed->empty()) {
       ESP_LOGW(TAG, "Empty list");
+      code = WhiteListErrorCode_NOT_CHANGED;
     } else {
-      for (auto &item : list) {
-        if (std::holds_alternative<white_list::Name>(item)) {
-          auto &name = std::get<white_list::Name>(item);
-          ESP_LOGI(TAG, "Name: %s", name.name.c_str());
-        } else if (std::holds_alternative<white_list::Addr>(item)) {
-          auto &addr = std::get<white_list::Addr>(item);
-          ESP_LOGI(TAG, "Addr: %s", utils::toHex(addr.addr.data(), addr.addr.size()).c_str());
-        };
+      for (const auto &item : *fixed) {
+        log_item("Set", item);
       }
-      if (setList != nullptr) {
-        setList(list);
+      if (setFixedList.is_valid()) {
+        setFixedList(*fixed);
       } else {
-        ESP_LOGE(TAG, "callback setList is nullptr");
+        ESP_LOGE(TAG, "callback setFixedList is not set");
+        code = WhiteListErrorCode_NULL;
       }
     }
+  } else if (auto *list = std::get_if<white_list::list_t>(&req)) {
+    if (list->empty()) {
+      ESP_LOGW(TAG, "Empty list");
+      code = WhiteListErrorCode_NOT_CHANGED;
+    } else {
+      for (auto &item : *list) {
+        log_item("Set", item);
+      }
+      if (setList.is_valid()) {
+        setList(std::move(*list));
+      } else {
+        ESP_LOGE(TAG, "callback setList is not set");
+        code = WhiteListErrorCode_NULL;
+      }
+    }
+  } else if (const auto *add = std::get_if<white_list::add_t>(&req)) {
+    log_item("Add", add->item);
+    if (!addItem.is_valid()) {
+      ESP_LOGE(TAG, "callback addItem is not set");
+      code = WhiteListErrorCode_NULL;
+    } else if (!addItem(add->item)) {
+      code = WhiteListErrorCode_NOT_CHANGED;
+    }
+  } else if (const auto *remove = std::get_if<white_list::remove_t>(&req)) {
+    log_item("Remove", remove->item);
+    if (!removeItem.is_valid()) {
+      ESP_LOGE(TAG, "callback removeItem is not set");
+      code = WhiteListErrorCode_NULL;
+    } else if (!removeItem(remove->item)) {
+      code = WhiteListErrorCode_NOT_CHANGED;
+    }
   }
+  // let the client know the new version, so the next change could be based on it
+  respond(pCharacteristic, white_list::response_t{code});
 }
@@ -0,0 +1,129 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "bench.h"
+
+#ifdef BENCH_NVS_STALL
+#include <algorithm>
+#include <cstdio>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <Preferences.h>
+#include "Lane.h"
+#include "common.h"
+#include "metrics.h"
+
+namespace bench {
+static constexpr auto TAG = "bench";
+#ifdef HOT_PATH_IN_FLASH
+static constexpr auto HOT_PATH = "flash";
+#else
+static constexpr auto HOT_PATH = "IRAM";
+#endif
+
+enum class phase_t : uint8_t {
+  NO_WRITE,
+  ANY_TIME,
+  AFTER_FRAME,
+};
+
+static const char *phaseToStr(phase_t phase) {
+  switch (phase) {
+    case phase_t::NO_WRITE:
+      return "no write";
+    case phase_t::ANY_TIME:
+      return "write at any time";
+    case phase_t::AFTER_FRAME:
+      return "write after frame";
+    default:
+      return "unknown";
+  }
+}
+
+struct snapshot_t {
+  uint32_t frames;
+  uint32_t misses;
+  ::Histogram frame_us;
+  ::Histogram jitter_us;
+};
+
+static void take(snapshot_t &out) {
+  out.frames = metrics::registry.frames.load();
+  out.misses = metrics::registry.frame_misses.load();
+  metrics::registry.frame_us.snapshot(out.frame_us);
+  metrics::registry.frame_jitter_us.snapshot(out.jitter_us);
+}
+
+/// log the samples of every bucket between the two snapshots, as `<=bound:count`
+static void log_histogram(const char *name, const ::Histogram &before, const ::Histogram &after) {
+  char line[160];
+  size_t n         = 0;
+  const auto count = [&](size_t i) { return after.counts[i] - before.counts[i]; };
+  uint32_t samples = 0;
+  for (size_t i = 0; i < after.counts_count; ++i) {
+    samples += count(i);
+  }
+  for (size_t i = 0; i < after.bounds_count && n < sizeof(line); ++i) {
+    n += std::snprintf(line + n, sizeof(line) - n, "<=%lu:%lu ", after.bounds[i], count(i));
+  }
+  if (n < sizeof(line)) {
+    std::snprintf(line + n, sizeof(line) - n, ">%lu:%lu", after.bounds[after.bounds_count - 1], count(after.bounds_count));
+  }
+  const auto mean = samples == 0 ? 0 : (after.sum - before.sum) / samples;
+  ESP_LOGI(TAG, "%s mean=%lu us; %s", name, mean, line);
+}
+
+static void run_phase(lane::Lane &lane, Preferences &pref, phase_t phase) {
+  using namespace std::chrono;
+  auto before = snapshot_t{};
+  auto after  = snapshot_t{};
+  take(before);
+  const auto end    = esp_timer_get_time() + duration_cast<microseconds>(PHASE_DURATION).count();
+  uint32_t writes   = 0;
+  int64_t write_max = 0;
+  while (esp_timer_get_time() < end) {
+    vTaskDelay(pdMS_TO_TICKS(duration_cast<milliseconds>(WRITE_INTERVAL).count()));
+    if (phase == phase_t::NO_WRITE) {
+      continue;
+    }
+    if (phase == phase_t::AFTER_FRAME) {
+      lane.waitForShown(pdMS_TO_TICKS(250));
+    }
+    const auto start = esp_timer_get_time();
+    pref.putULong("n", writes++);
+    write_max = std::max(write_max, esp_timer_get_time() - start);
+  }
+  take(after);
+  ESP_LOGI(TAG, "%s: writes=%lu (max %lld us); frames=%lu; misses=%lu;",
+           phaseToStr(phase), writes, write_max, after.frames - before.frames, after.misses - before.misses);
+  log_histogram("frame", before.frame_us, after.frame_us);
+  log_histogram("jitter", before.jitter_us, after.jitter_us);
+}
+
+void start_nvs_stall(lane::Lane &lane) {
+  static auto task_mem = common::topology::static_task_t<common::topology::BENCH>{};
+  auto task            = [](void *param) {
+    auto &lane = *static_cast<lane::Lane *>(param);
+    // a namespace of its own, so the config is untouched
+    static auto pref = Preferences{};
+    pref.begin("bench", false);
+    ESP_LOGI(TAG, "NVS stall; hot path in %s", HOT_PATH);
+    for (;;) {
+      run_phase(lane, pref, phase_t::NO_WRITE);
+      run_phase(lane, pref, phase_t::ANY_TIME);
+      run_phase(lane, pref, phase_t::AFTER_FRAME);
+    }
+  };
+  if (task_mem.create(task, &lane) == nullptr) {
+    ESP_LOGE(TAG, "failed to create the bench task");
+  }
+}
+}
+#else
+namespace bench {
+void start_nvs_stall(lane::Lane &) {}
+}
+#endif
@@ -0,0 +1,60 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "boot.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <esp_log.h>
+
+namespace boot {
+static constexpr auto TAG = "boot";
+
+/// in us. the boot is far shorter than the wrap around of 32 bits
+struct span_t {
+  std::atomic<uint32_t> start{0};
+  std::atomic<uint32_t> end{0};
+  std::atomic<bool> recorded{false};
+};
+static std::array<span_t, static_cast<size_t>(phase_t::COUNT)> spans{};
+
+void record(phase_t phase, int64_t start_us, int64_t end_us) {
+  const auto i = static_cast<size_t>(phase);
+  if (i >= spans.size()) {
+    return;
+  }
+  auto &span = spans[i];
+  span.start.store(static_cast<uint32_t>(start_us), std::memory_order_relaxed);
+  span.end.store(static_cast<uint32_t>(end_us), std::memory_order_relaxed);
+  span.recorded.store(true, std::memory_order_release);
+}
+
+void report() {
+  uint32_t last_end = 0;
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const auto phase = static_cast<phase_t>(i);
+    const auto &span = spans[i];
+    if (!span.recorded.load(std::memory_order_acquire)) {
+      ESP_LOGI(TAG, "%-12s pending", phaseToStr(phase));
+      continue;
+    }
+    const auto start = span.start.load(std::memory_order_relaxed);
+    const auto end   = span.end.load(std::memory_order_relaxed);
+    last_end         = std::max(last_end, end);
+    ESP_LOGI(TAG, "%-12s %5lu..%5lu ms (%lu ms)", phaseToStr(phase), start / 1000, end / 1000, (end - start) / 1000);
+  }
+  const auto &strip = spans[static_cast<size_t>(phase_t::STRIP)];
+  if (!strip.recorded.load(std::memory_order_acquire)) {
+    ESP_LOGW(TAG, "no frame yet; ready in %lu ms", last_end / 1000);
+    return;
+  }
+  const auto first_frame_ms = strip.end.load(std::memory_order_relaxed) / 1000;
+  if (first_frame_ms > static_cast<uint32_t>(FIRST_FRAME_TARGET.count())) {
+    ESP_LOGW(TAG, "first frame at %lu ms, later than %lld ms; ready in %lu ms",
+             first_frame_ms, FIRST_FRAME_TARGET.count(), last_end / 1000);
+  } else {
+    ESP_LOGI(TAG, "first frame at %lu ms; ready in %lu ms", first_frame_ms, last_end / 1000);
+  }
+}
+}
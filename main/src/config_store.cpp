@@ -0,0 +1,122 @@
+//
+// Created by Kurosu Chan on 2023/11/25.
+//
+
+#include <algorithm>
+#include <cstddef>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include "utils.h"
+#include "common.h"
+#include "config_store.h"
+#include "trace.h"
+
+namespace config_store {
+static constexpr auto TAG = "config_store";
+
+static uint32_t crc_of(const blob_t &blob) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&blob), offsetof(blob_t, crc));
+}
+
+config_t Store::load(const config_t &defaults) {
+  using namespace common::lanely;
+  pref.begin(PREF_RECORD_NAME, true);
+  auto blob    = blob_t{};
+  const auto n = pref.getBytesLength(PREF_CONFIG_BLOB_NAME) == sizeof(blob) ? pref.getBytes(PREF_CONFIG_BLOB_NAME, &blob, sizeof(blob)) : 0;
+  if (n == sizeof(blob) && blob.magic == MAGIC && blob.version == VERSION &&
+      blob.size == sizeof(config_t) && blob.crc == crc_of(blob)) {
+    pref.end();
+    return blob.config;
+  }
+  if (n != 0) {
+    ESP_LOGW(TAG, "bad config blob (version=%d; size=%d); fallback", blob.version, blob.size);
+  }
+  // the firmware before the blob stores the fields one by one
+  const auto cfg = config_t{
+      .color           = pref.getULong(PREF_COLOR_NAME, defaults.color),
+      .line_length_m   = pref.getFloat(PREF_LINE_LENGTH_NAME, defaults.line_length_m),
+      .active_length_m = pref.getFloat(PREF_ACTIVE_LENGTH_NAME, defaults.active_length_m),
+      .total_length_m  = pref.getFloat(PREF_TOTAL_LENGTH_NAME, defaults.total_length_m),
+      .line_LEDs_num   = pref.getULong(PREF_LINE_LEDs_NUM_NAME, defaults.line_LEDs_num),
+  };
+  pref.end();
+  return cfg;
+}
+
+bool Store::write(const config_t &cfg) {
+  using namespace common::lanely;
+  auto blob    = blob_t{};
+  blob.magic   = MAGIC;
+  blob.version = VERSION;
+  blob.size    = sizeof(config_t);
+  blob.config  = cfg;
+  blob.crc     = crc_of(blob);
+  if (!pref.begin(PREF_RECORD_NAME, false)) {
+    ESP_LOGE(TAG, "failed to open NVS");
+    return false;
+  }
+  const auto _ = trace::scope_t(trace::event_t::NVS_WRITE);
+  const auto n = pref.putBytes(PREF_CONFIG_BLOB_NAME, &blob, sizeof(blob));
+  pref.end();
+  return n == sizeof(blob);
+}
+
+void Store::run() {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // wait for the burst to settle down, but not forever
+    const auto start = xTaskGetTickCount();
+    const auto limit = pdMS_TO_TICKS(MAX_DEBOUNCE.count());
+    for (;;) {
+      const auto elapsed = xTaskGetTickCount() - start;
+      if (elapsed >= limit ||
+          ulTaskNotifyTake(pdTRUE, std::min<TickType_t>(pdMS_TO_TICKS(DEBOUNCE.count()), limit - elapsed)) == 0) {
+        break;
+      }
+    }
+    config_t cfg;
+    {
+      std::lock_guard<std::mutex> lk(mutex);
+      if (!dirty) {
+        continue;
+      }
+      cfg   = pending;
+      dirty = false;
+    }
+    if (write_gate.is_valid()) {
+      write_gate();
+    }
+    if (write(cfg)) {
+      ESP_LOGI(TAG, "config saved");
+    } else {
+      ESP_LOGE(TAG, "failed to save config");
+    }
+  }
+}
+
+esp_err_t Store::begin() {
+  if (handle != nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  auto task = [](void *param) {
+    static_cast<Store *>(param)->run();
+  };
+  // NVS needs a fair amount of stack. there's only one store in the firmware
+  static auto task_mem = common::topology::static_task_t<common::topology::CONFIG_STORE>{};
+  handle               = task_mem.create(task, this);
+  return handle != nullptr ? ESP_OK : ESP_FAIL;
+}
+
+void Store::save(const config_t &cfg) {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    pending = cfg;
+    dirty   = true;
+  }
+  if (handle == nullptr) {
+    ESP_LOGE(TAG, "not started; config would not be saved");
+    return;
+  }
+  xTaskNotifyGive(handle);
+}
+}
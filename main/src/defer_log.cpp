@@ -0,0 +1,95 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "defer_log.h"
+#include <atomic>
+#include <cstdio>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include "common.h"
+
+namespace defer_log {
+static constexpr auto TAG = "defer_log";
+/// every record takes 8 more bytes of the ring as the item header
+constexpr size_t RING_SIZE = 4096;
+
+static RingbufHandle_t ring = nullptr;
+static std::atomic<uint32_t> dropped_count{0};
+static std::atomic<uint8_t> max_level{ESP_LOG_VERBOSE};
+
+uint32_t timestamp() {
+  return esp_log_timestamp();
+}
+
+uint32_t dropped() {
+  return dropped_count.load(std::memory_order_relaxed);
+}
+
+void set_level(uint8_t level) {
+  max_level.store(level, std::memory_order_relaxed);
+}
+
+uint8_t level() {
+  return max_level.load(std::memory_order_relaxed);
+}
+
+uint8_t usage_percent() {
+  if (ring == nullptr) {
+    return 0;
+  }
+  const auto free = xRingbufferGetCurFreeSize(ring);
+  return static_cast<uint8_t>((RING_SIZE - std::min(free, RING_SIZE)) * 100 / RING_SIZE);
+}
+
+uint8_t *acquire(size_t size) {
+  void *record = nullptr;
+  if (ring == nullptr || xRingbufferSendAcquire(ring, &record, size, 0) != pdTRUE) {
+    dropped_count.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  return static_cast<uint8_t *>(record);
+}
+
+void commit(uint8_t *record) {
+  xRingbufferSendComplete(ring, record);
+}
+
+static void print_task(void *) {
+  static char message[MAX_MESSAGE_LEN];
+  uint32_t reported_dropped = 0;
+  for (;;) {
+    size_t size  = 0;
+    auto *record = static_cast<uint8_t *>(xRingbufferReceive(ring, &size, portMAX_DELAY));
+    if (record == nullptr) {
+      continue;
+    }
+    auto header = header_t{};
+    std::memcpy(&header, record, sizeof(header));
+    render(record, size, message, sizeof(message));
+    vRingbufferReturnItem(ring, record);
+    const auto level = static_cast<esp_log_level_t>(header.level);
+    const auto c     = "NEWIDV"[std::min<uint8_t>(header.level, ESP_LOG_VERBOSE)];
+    esp_log_write(level, header.tag, "%c (%lu) %s: %s\n", c, header.ts_ms, header.tag, message);
+    if (const auto d = dropped(); d != reported_dropped) {
+      ESP_LOGW(TAG, "%lu messages dropped", d - reported_dropped);
+      reported_dropped = d;
+    }
+  }
+}
+
+bool start() {
+  if (ring != nullptr) {
+    return false;
+  }
+  static StaticRingbuffer_t ring_buf{};
+  alignas(4) static uint8_t ring_storage[RING_SIZE];
+  ring = xRingbufferCreateStatic(RING_SIZE, RINGBUF_TYPE_NOSPLIT, ring_storage, &ring_buf);
+  if (ring == nullptr) {
+    return false;
+  }
+  static auto task_mem = common::topology::static_task_t<common::topology::DEFER_LOG>{};
+  return task_mem.create(print_task, nullptr) != nullptr;
+}
+}
@@ -0,0 +1,143 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "defer_log.h"
+#include <cstdio>
+
+// free of ESP-IDF, since the host fallback of `DLOGx` and the tests format with it as well
+namespace defer_log {
+/// copy a conversion of `fmt` (from `%` to the conversion specifier) into `spec`
+static const char *read_spec(const char *fmt, char *spec, size_t spec_size) {
+  const auto *p = fmt + 1;
+  while (*p != '\0' && std::strchr("-+ #0", *p) != nullptr) {
+    ++p;
+  }
+  while (*p >= '0' && *p <= '9') {
+    ++p;
+  }
+  if (*p == '.') {
+    ++p;
+    while (*p >= '0' && *p <= '9') {
+      ++p;
+    }
+  }
+  while (*p != '\0' && std::strchr("hljztL", *p) != nullptr) {
+    ++p;
+  }
+  if (*p != '\0') {
+    ++p;
+  }
+  const auto len = std::min<size_t>(p - fmt, spec_size - 1);
+  std::memcpy(spec, fmt, len);
+  spec[len] = '\0';
+  return p;
+}
+
+size_t render(const uint8_t *record, size_t size, char *out, size_t out_size) {
+  if (out_size == 0) {
+    return 0;
+  }
+  auto header = header_t{};
+  if (size < sizeof(header)) {
+    out[0] = '\0';
+    return 0;
+  }
+  std::memcpy(&header, record, sizeof(header));
+  const auto *arg = record + sizeof(header);
+  const auto *end = record + size;
+  size_t n        = 0;
+  size_t i        = 0;
+  // `snprintf` returns the length it would have written
+  auto advance = [&](int written) {
+    if (written > 0) {
+      n = std::min(n + written, out_size - 1);
+    }
+  };
+  auto read = [&](auto &v) {
+    if (arg + sizeof(v) <= end) {
+      std::memcpy(&v, arg, sizeof(v));
+    }
+    arg += sizeof(v);
+  };
+  for (const char *f = header.fmt; *f != '\0' && n < out_size - 1;) {
+    if (*f != '%') {
+      out[n++] = *f++;
+      continue;
+    }
+    if (f[1] == '%') {
+      out[n++] = '%';
+      f += 2;
+      continue;
+    }
+    char spec[16];
+    f = read_spec(f, spec, sizeof(spec));
+    if (i >= header.nargs) {
+      advance(std::snprintf(out + n, out_size - n, "%s", spec));
+      continue;
+    }
+    switch (header.kinds[i++]) {
+      case kind_t::I32: {
+        int32_t v = 0;
+        read(v);
+        advance(std::snprintf(out + n, out_size - n, spec, v));
+        break;
+      }
+      case kind_t::U32: {
+        uint32_t v = 0;
+        read(v);
+        advance(std::snprintf(out + n, out_size - n, spec, v));
+        break;
+      }
+      case kind_t::I64: {
+        int64_t v = 0;
+        read(v);
+        advance(std::snprintf(out + n, out_size - n, spec, v));
+        break;
+      }
+      case kind_t::U64: {
+        uint64_t v = 0;
+        read(v);
+        advance(std::snprintf(out + n, out_size - n, spec, v));
+        break;
+      }
+      case kind_t::F64: {
+        double v = 0;
+        read(v);
+        advance(std::snprintf(out + n, out_size - n, spec, v));
+        break;
+      }
+      case kind_t::PTR: {
+        uintptr_t v = 0;
+        read(v);
+        advance(std::snprintf(out + n, out_size - n, spec, reinterpret_cast<void *>(v)));
+        break;
+      }
+      case kind_t::STR: {
+        const size_t len = arg < end ? *arg : 0;
+        char s[MAX_STR_LEN + 1];
+        const auto copied = std::min<size_t>({len, MAX_STR_LEN, static_cast<size_t>(end - std::min(end, arg + 1))});
+        std::memcpy(s, arg + 1, copied);
+        s[copied] = '\0';
+        arg += 1 + len;
+        advance(std::snprintf(out + n, out_size - n, spec, s));
+        break;
+      }
+      case kind_t::HEX: {
+        const size_t len = arg < end ? *arg : 0;
+        const auto *p    = arg + 1;
+        arg += 1 + len;
+        // the width and the precision are ignored
+        for (size_t j = 0; j < len && p + j < end && n + 2 < out_size; ++j) {
+          constexpr auto HEX = "0123456789abcdef";
+          out[n++]           = HEX[p[j] >> 4];
+          out[n++]           = HEX[p[j] & 0x0f];
+        }
+        break;
+      }
+    }
+  }
+  out[n] = '\0';
+  return n;
+}
+}
@@ -0,0 +1,223 @@
+//
+// Created by Kurosu Chan on 2023/11/20.
+//
+
+#include "gatt_cache.h"
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <host/ble_hs.h>
+#include "utils.h"
+
+static constexpr auto TAG = "gatt_cache";
+
+namespace gatt_cache {
+//****************************** HandleCache ************************************/
+
+etl::optional<handles_t> HandleCache::get(const addr_t &addr) {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    if (const auto it = entries.find(addr); it != entries.end()) {
+      return it->second;
+    }
+  }
+  if (!persist) {
+    return etl::nullopt;
+  }
+  auto h = persist_get(addr);
+  if (h.has_value()) {
+    std::lock_guard<std::mutex> lk(mutex);
+    if (!entries.full()) {
+      entries.insert({addr, *h});
+    }
+  }
+  return h;
+}
+
+void HandleCache::put(const addr_t &addr, const handles_t &handles) {
+  if (!handles.valid()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    if (const auto it = entries.find(addr); it != entries.end()) {
+      if (it->second.hr_value == handles.hr_value && it->second.hr_cccd == handles.hr_cccd) {
+        // nothing changed. don't bother the flash
+        return;
+      }
+      it->second = handles;
+    } else {
+      if (entries.full()) {
+        // evict an arbitrary one. the evicted band would just fallback to discovery
+        entries.erase(entries.begin());
+      }
+      entries.insert({addr, handles});
+    }
+  }
+  if (persist) {
+    persist_put(addr, handles);
+  }
+}
+
+void HandleCache::invalidate(const addr_t &addr) {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    entries.erase(addr);
+  }
+  if (persist) {
+    persist_remove(addr);
+  }
+}
+
+// NVS key is limited to 15 characters, and a hex string of MAC is 12
+static std::string pref_key(const addr_t &addr) {
+  return utils::toHex(addr.data(), addr.size());
+}
+
+void HandleCache::persist_put(const addr_t &addr, const handles_t &handles) {
+  Preferences pref;
+  pref.begin(PREF_RECORD_NAME, false);
+  pref.putBytes(pref_key(addr).c_str(), &handles, sizeof(handles));
+  pref.end();
+}
+
+etl::optional<handles_t> HandleCache::persist_get(const addr_t &addr) {
+  Preferences pref;
+  pref.begin(PREF_RECORD_NAME, true);
+  auto handles   = handles_t{};
+  const auto key = pref_key(addr);
+  const auto sz  = pref.getBytesLength(key.c_str()) == sizeof(handles) ? pref.getBytes(key.c_str(), &handles, sizeof(handles)) : 0;
+  pref.end();
+  if (sz != sizeof(handles) || !handles.valid()) {
+    return etl::nullopt;
+  }
+  return handles;
+}
+
+void HandleCache::persist_remove(const addr_t &addr) {
+  Preferences pref;
+  pref.begin(PREF_RECORD_NAME, false);
+  pref.remove(pref_key(addr).c_str());
+  pref.end();
+}
+
+//****************************** notification routing ************************************/
+
+struct route_t {
+  addr_t addr;
+  uint16_t conn_handle;
+  uint16_t value_handle;
+  notify_fn notify;
+};
+
+static std::mutex routes_mutex;
+static etl::vector<route_t, MAX_ENTRIES> routes;
+static ble_gap_event_listener gap_listener;
+
+static int on_gap_event(ble_gap_event *event, void *arg) {
+  switch (event->type) {
+    case BLE_GAP_EVENT_NOTIFY_RX: {
+      notify_fn notify = nullptr;
+      {
+        std::lock_guard<std::mutex> lk(routes_mutex);
+        const auto it = std::find_if(routes.begin(), routes.end(), [event](const route_t &r) {
+          return r.conn_handle == event->notify_rx.conn_handle &&
+                 r.value_handle == event->notify_rx.attr_handle;
+        });
+        if (it == routes.end()) {
+          // not ours. NimBLEClient would handle it
+          return 0;
+        }
+        notify = it->notify;
+      }
+      uint8_t buf[32];
+      uint16_t len = 0;
+      if (ble_hs_mbuf_to_flat(event->notify_rx.om, buf, sizeof(buf), &len) != 0) {
+        // truncated. the HR measurement we care is at the beginning anyway
+        len = std::min<uint16_t>(OS_MBUF_PKTLEN(event->notify_rx.om), sizeof(buf));
+      }
+      if (notify != nullptr) {
+        notify(buf, len);
+      }
+      break;
+    }
+    case BLE_GAP_EVENT_DISCONNECT: {
+      std::lock_guard<std::mutex> lk(routes_mutex);
+      const auto conn_handle = event->disconnect.conn.conn_handle;
+      routes.erase(std::remove_if(routes.begin(), routes.end(), [conn_handle](const route_t &r) {
+                     return r.conn_handle == conn_handle;
+                   }),
+                   routes.end());
+      break;
+    }
+    default:
+      break;
+  }
+  return 0;
+}
+
+struct write_result_t {
+  TaskHandle_t task;
+  int status;
+};
+
+bool subscribe_by_handles(NimBLEClient &client, const handles_t &handles, const addr_t &addr, notify_fn notify) {
+  if (!handles.valid() || !client.isConnected()) {
+    return false;
+  }
+  // BLE_HS_EALREADY if it has been registered
+  if (const auto rc = ble_gap_event_listener_register(&gap_listener, on_gap_event, nullptr);
+      rc != 0 && rc != BLE_HS_EALREADY) {
+    ESP_LOGE(TAG, "failed to register gap listener, rc=%d", rc);
+    return false;
+  }
+  const auto conn_handle = client.getConnHandle();
+  {
+    std::lock_guard<std::mutex> lk(routes_mutex);
+    // register the route before the CCCD write, the first notification could come right after it
+    routes.erase(std::remove_if(routes.begin(), routes.end(), [&addr](const route_t &r) {
+                   return r.addr == addr;
+                 }),
+                 routes.end());
+    if (routes.full()) {
+      ESP_LOGE(TAG, "notification routes are full");
+      return false;
+    }
+    routes.emplace_back(route_t{addr, conn_handle, handles.hr_value, std::move(notify)});
+  }
+
+  // 0x0001 for notification
+  constexpr uint8_t enable_notify[] = {0x01, 0x00};
+  auto result                       = write_result_t{xTaskGetCurrentTaskHandle(), BLE_HS_EUNKNOWN};
+  auto on_written                   = [](uint16_t, const ble_gatt_error *error, ble_gatt_attr *, void *arg) -> int {
+    auto &res  = *static_cast<write_result_t *>(arg);
+    res.status = error->status;
+    xTaskNotifyGive(res.task);
+    return 0;
+  };
+  auto rc = ble_gattc_write_flat(conn_handle, handles.hr_cccd,
+                                 enable_notify, sizeof(enable_notify),
+                                 on_written, &result);
+  if (rc == 0) {
+    // the GATT procedure would always finish (with a 30s timeout or disconnection at worst)
+    // so it's safe to wait forever with `result` on the stack
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    rc = result.status;
+  }
+  if (rc != 0) {
+    ESP_LOGW(TAG, "failed to write CCCD %d of %s, rc=%d", handles.hr_cccd,
+             utils::toHex(addr.data(), addr.size()).c_str(), rc);
+    unroute(addr);
+    return false;
+  }
+  return true;
+}
+
+void unroute(const addr_t &addr) {
+  std::lock_guard<std::mutex> lk(routes_mutex);
+  routes.erase(std::remove_if(routes.begin(), routes.end(), [&addr](const route_t &r) {
+                 return r.addr == addr;
+               }),
+               routes.end());
+}
+}
@@ -0,0 +1,108 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include "heap_guard.h"
+
+namespace heap_guard {
+static constexpr auto TAG  = "heap_guard";
+static constexpr auto CAPS = MALLOC_CAP_8BIT;
+
+static std::atomic<bool> armed{false};
+static std::atomic<uint32_t> allocs{0};
+static std::atomic<uint32_t> alloc_bytes{0};
+static std::atomic<void *> last_caller{nullptr};
+/// the free heap when armed, and at the last report. only touched by the timer task
+static size_t free_at_arm = 0;
+static size_t last_free   = 0;
+static StaticTimer_t timer_buf{};
+static TimerHandle_t timer = nullptr;
+
+#ifdef HEAP_GUARD
+static void note(size_t size, void *caller) {
+  if (!armed.load(std::memory_order_relaxed)) {
+    return;
+  }
+  allocs.fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  last_caller.store(caller, std::memory_order_relaxed);
+}
+#endif
+
+static void report(TimerHandle_t) {
+  const auto n       = allocs.exchange(0, std::memory_order_relaxed);
+  const auto bytes   = alloc_bytes.exchange(0, std::memory_order_relaxed);
+  const auto caller  = last_caller.exchange(nullptr, std::memory_order_relaxed);
+  const auto free_now = heap_caps_get_free_size(CAPS);
+  const auto largest  = heap_caps_get_largest_free_block(CAPS);
+  const auto min_free = heap_caps_get_minimum_free_size(CAPS);
+  const auto delta    = static_cast<int32_t>(free_now) - static_cast<int32_t>(free_at_arm);
+  if (n != 0 || free_now < last_free) {
+    ESP_LOGW(TAG, "%lu allocation(s) of %lu bytes; last caller=%p; free=%u (%+ld since init); min=%u; largest=%u;",
+             n, bytes, caller, free_now, delta, min_free, largest);
+  } else {
+    ESP_LOGD(TAG, "free=%u (%+ld since init); min=%u; largest=%u;", free_now, delta, min_free, largest);
+  }
+  last_free = free_now;
+}
+
+esp_err_t arm(std::chrono::seconds interval) {
+  if (timer != nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  const auto period = pdMS_TO_TICKS(std::chrono::duration_cast<std::chrono::milliseconds>(interval).count());
+  timer             = xTimerCreateStatic("heap_guard", period, pdTRUE, nullptr, report, &timer_buf);
+  if (timer == nullptr) {
+    return ESP_FAIL;
+  }
+  free_at_arm = heap_caps_get_free_size(CAPS);
+  last_free   = free_at_arm;
+  armed.store(true, std::memory_order_relaxed);
+  ESP_LOGI(TAG, "armed; free=%u; largest=%u;", free_at_arm, heap_caps_get_largest_free_block(CAPS));
+  return xTimerStart(timer, portMAX_DELAY) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+}
+
+#ifdef HEAP_GUARD
+// the exceptions are disabled, so an allocation failure aborts like the default one
+void *operator new(size_t size) {
+  heap_guard::note(size, __builtin_return_address(0));
+  auto *p = std::malloc(size);
+  if (p == nullptr) {
+    abort();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) {
+  heap_guard::note(size, __builtin_return_address(0));
+  auto *p = std::malloc(size);
+  if (p == nullptr) {
+    abort();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  std::free(p);
+}
+#endif
@@ -0,0 +1,74 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "hr_history.h"
+#include <mutex>
+#include <esp_log.h>
+#include <NimBLEDevice.h>
+#include "common.h"
+#include "metrics.h"
+
+namespace hr_history {
+static constexpr auto TAG = "hr_history";
+
+static store_t store{};
+static std::mutex mutex{};
+
+void record(name_table::handle_t name, uint8_t hr) {
+  if (name == name_table::INVALID || hr == 0) {
+    return;
+  }
+  const auto now = metrics::now_ms();
+  std::lock_guard<std::mutex> lk(mutex);
+  // the store keeps a reference of every device in it
+  if (store.find(name) == nullptr && !name_table::table.acquire(name)) {
+    return;
+  }
+  const auto dropped = store.add(name, now, hr);
+  if (dropped != name_table::INVALID) {
+    const auto dropped_name = name_table::table.view(dropped);
+    ESP_LOGW(TAG, "drop the history of %.*s", static_cast<int>(dropped_name.size()), dropped_name.data());
+    name_table::table.release(dropped);
+  }
+}
+
+/// @return the bytes written into `out`, 0 if the device is unknown
+static size_t serialize(name_table::handle_t name, uint8_t *out, size_t size) {
+  std::lock_guard<std::mutex> lk(mutex);
+  const auto *series = store.find(name);
+  if (series == nullptr) {
+    return 0;
+  }
+  return series->serialize(out, size);
+}
+
+class HistoryCharCallback final : public NimBLECharacteristicCallbacks {
+  /// only touched by the NimBLE host task
+  std::array<uint8_t, MAX_EXPORT_SIZE> buffer{};
+  size_t size   = 0;
+  size_t offset = 0;
+
+public:
+  void onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override {
+    const auto value = pCharacteristic->getValue();
+    const auto name  = std::string_view(reinterpret_cast<const char *>(value.data()), value.size());
+    offset           = 0;
+    size             = serialize(name_table::table.lookup(name), buffer.data(), buffer.size());
+    ESP_LOGI(TAG, "export %.*s (%zu bytes)", static_cast<int>(name.size()), name.data(), size);
+  }
+  void onRead(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override {
+    // the value of a read response is 1 byte shorter than the MTU
+    const auto chunk = std::min<size_t>(size - offset, connInfo.getMTU() - 1);
+    pCharacteristic->setValue(buffer.data() + offset, chunk);
+    offset += chunk;
+  }
+};
+
+void initBLE(NimBLEService &service) {
+  static auto callback = HistoryCharCallback{};
+  auto &c              = *service.createCharacteristic(common::BLE_CHAR_HR_HISTORY_UUID,
+                                                       NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::WRITE);
+  c.setCallbacks(&callback);
+}
+}
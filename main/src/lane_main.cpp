@@ -1,10 +1,12 @@
 #include <Arduino.h>
 #include <etl/map.h>
 #include <etl/random.h>
+#include <etl/delegate.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <NimBLEDevice.h>
 #include <mutex>
+#include <atomic>
 #include <memory.h>
 #include <RadioLib.h>
 #include <sdkconfig.h>
@@ -16,37 +18,124 @@
 #include "ScanCallback.h"
 #include "hr_lora.h"
 #include "ble_hr_data.h"
+#include "task_stats.h"
+#include "heap_guard.h"
+#include "metrics.h"
+#include "trace.h"
+#include "defer_log.h"
+#include "qos.h"
+#include "bench.h"
+#include "boot.h"
+#include "name_table.h"
+#include "hr_history.h"
 
 // #define DEBUG_SPEED
 
-void *rf_receive_data = nullptr;
 struct rf_receive_data_t {
   EventGroupHandle_t evt_grp = nullptr;
+  /**
+   * @brief the lower 32 bits of `esp_timer_get_time` when DIO1 was raised (RX done or TX done)
+   * @note 64-bit atomics are not lock-free on this target, so only the lower half is kept
+   *       (wraps every ~71 minutes, see `last_dio1_us`)
+   */
+  std::atomic<uint32_t> dio1_us{0};
 };
+/// shared with the DIO1 interrupt
+static rf_receive_data_t rf_receive_data{};
 
 constexpr auto RecvEvt = BIT0;
+/// a `start_report` is waiting to be sent by the recv task
+constexpr auto ReportEvt = BIT1;
+
+/**
+ * @brief the time of the last DIO1 interrupt in `esp_timer_get_time`
+ * @note should be called within ~71 minutes after the interrupt
+ */
+int64_t last_dio1_us() {
+  const auto now   = esp_timer_get_time();
+  const auto stamp = rf_receive_data.dio1_us.load(std::memory_order_relaxed);
+  const auto since = static_cast<uint32_t>(static_cast<uint32_t>(now) - stamp);
+  return now - since;
+}
+
+/**
+ * @brief RX done or TX done
+ * @note `EspHal` installs the GPIO ISR service with `ESP_INTR_FLAG_IRAM`, so it could run while the flash
+ *       cache is disabled by an NVS write. Everything it touches should be in IRAM or DRAM.
+ */
+static void IRAM_ATTR on_dio1() {
+  auto &data            = rf_receive_data;
+  BaseType_t task_woken = pdFALSE;
+  data.dio1_us.store(static_cast<uint32_t>(esp_timer_get_time()), std::memory_order_relaxed);
+  trace::emit(trace::event_t::DIO1, trace::INSTANT);
+  if (data.evt_grp != nullptr) {
+    const auto xResult = xEventGroupSetBitsFromISR(data.evt_grp, RecvEvt, &task_woken);
+    if (xResult != pdFAIL) {
+      portYIELD_FROM_ISR(task_woken);
+    }
+  }
+}
+
+/**
+ * @brief the state of the last synchronized start
+ */
+struct start_session_t {
+  uint8_t seq = 0;
+  bool measure = false;
+  /// whether the start is requested by BLE on this board
+  bool initiator = false;
+  /// the lateness of this board
+  int32_t late_us = 0;
+  /// the spread of the lateness reported by the other boards (including this one)
+  int32_t min_late_us = 0;
+  int32_t max_late_us = 0;
+};
 
 constexpr auto send_lk_timeout_tick = 100;
 constexpr auto MAX_DEVICE_COUNT     = 16;
 using repeater_t                    = HrLoRa::repeater_status::t;
-using device_name_map_t             = etl::flat_map<int, repeater_t, MAX_DEVICE_COUNT>;
+static_assert(HrLoRa::MAX_DEVICE_NAME_LENGTH <= name_table::MAX_NAME_LENGTH, "a device name would be truncated twice");
+
+/// a device behind a repeater, learned from its status
+struct known_device_t {
+  HrLoRa::addr_t repeater_addr{};
+  HrLoRa::name_map_key_t key = 0;
+  /// of the HR device
+  HrLoRa::addr_t addr{};
+  /// the device name, or its address in hex if it has no name. held by the map until the device is removed
+  name_table::handle_t name = name_table::INVALID;
+};
+using device_name_map_t = etl::flat_map<int, known_device_t, MAX_DEVICE_COUNT>;
 
+/**
+ * @note a delegate only refers to the callable, so the callables should be static
+ */
 struct handle_message_callbacks_t {
-  std::function<std::optional<HrLoRa::hr_device::t>(int)> get_device_by_key;
+  /// nullptr if the key is unknown. the device is owned by the map, and is valid until `update_device`
+  etl::delegate<const known_device_t *(int)> get_device_by_key;
   /// return true if the device is updated successfully, otherwise a key change is requested
-  std::function<bool(repeater_t)> update_device;
-  std::function<void(std::string name, int hr)> on_hr_data;
-  std::function<void(uint8_t *data, size_t size)> rf_send;
+  etl::delegate<bool(const repeater_t &)> update_device;
+  /// @param name a handle of `name_table::table`
+  etl::delegate<void(name_table::handle_t name, int hr)> on_hr_data;
+  etl::delegate<void(uint8_t *data, size_t size)> rf_send;
+  /// could be unset
+  etl::delegate<void(const HrLoRa::start_at::t &req, int64_t rx_us)> on_start_at;
+  /// could be unset
+  etl::delegate<void(const HrLoRa::start_report::t &report)> on_start_report;
 };
 
-void handle_message(uint8_t *pdata, size_t size, const handle_message_callbacks_t &callbacks) {
+/**
+ * @param rx_us when the packet is received (end of the packet), in `esp_timer_get_time`
+ */
+void handle_message(uint8_t *pdata, size_t size, int64_t rx_us, const handle_message_callbacks_t &callbacks) {
   static constexpr auto TAG = "handle_message";
-  const bool callback_ok          = callbacks.get_device_by_key != nullptr &&
-                     callbacks.update_device != nullptr &&
-                     callbacks.rf_send != nullptr &&
-                     callbacks.on_hr_data != nullptr;
+  const bool callback_ok          = callbacks.get_device_by_key.is_valid() &&
+                     callbacks.update_device.is_valid() &&
+                     callbacks.rf_send.is_valid() &&
+                     callbacks.on_hr_data.is_valid();
   if (!callback_ok) {
     ESP_LOGE(TAG, "bad callback");
+    metrics::registry.rx_dropped.inc();
     return;
   }
   static auto rng = etl::random_xorshift(esp_random());
@@ -54,19 +143,21 @@ void handle_message(uint8_t *pdata, size_t size, const handle_message_callbacks_
   switch (magic) {
     case HrLoRa::hr_data::magic: {
       if (const auto hr_data_ = HrLoRa::hr_data::unmarshal(pdata, size)) {
-        auto p_dev = callbacks.get_device_by_key(hr_data_->key);
-        if (!p_dev) {
+        const auto *p_dev = callbacks.get_device_by_key(hr_data_->key);
+        if (p_dev == nullptr) {
           ESP_LOGW(TAG, "no name for key %d", hr_data_->key);
           return;
         }
         callbacks.on_hr_data(p_dev->name, hr_data_->hr);
+      } else {
+        metrics::registry.rx_malformed.inc();
       }
       break;
     }
     case HrLoRa::named_hr_data::magic: {
       if (auto hr_data_ = HrLoRa::named_hr_data::unmarshal(pdata, size)) {
-        auto dev_ = callbacks.get_device_by_key(hr_data_->key);
-        if (!dev_) {
+        const auto *dev_ = callbacks.get_device_by_key(hr_data_->key);
+        if (dev_ == nullptr) {
           ESP_LOGW(TAG, "no addr for key %d", hr_data_->key);
           return;
         }
@@ -76,12 +167,10 @@ void handle_message(uint8_t *pdata, size_t size, const handle_message_callbacks_
                    utils::toHex(hr_data_->addr.data(), hr_data_->addr.size()).c_str());
           return;
         }
-        if (const auto name = dev_->name; name.empty()) {
-          auto addr_str = utils::toHex(hr_data_->addr.data(), hr_data_->addr.size());
-          callbacks.on_hr_data(addr_str, hr_data_->hr);
-        } else {
-          callbacks.on_hr_data(name, hr_data_->hr);
-        }
+        // a device without a name is interned with its address
+        callbacks.on_hr_data(dev_->name, hr_data_->hr);
+      } else {
+        metrics::registry.rx_malformed.inc();
       }
       break;
     }
@@ -93,7 +182,7 @@ void handle_message(uint8_t *pdata, size_t size, const handle_message_callbacks_
           // TODO: Handle the case where all keys are in use and a new one cannot be generated
           constexpr auto limit = MAX_DEVICE_COUNT;
           auto counter         = 0;
-          while (callbacks.get_device_by_key(new_key).has_value()) {
+          while (callbacks.get_device_by_key(new_key) != nullptr) {
             new_key = rng.range(0, 255);
             if (++counter > limit) {
               ESP_LOGE(TAG, "failed to generate a unique key");
@@ -114,6 +203,29 @@ void handle_message(uint8_t *pdata, size_t size, const handle_message_callbacks_
         }
       } else {
         ESP_LOGE(TAG, "failed to unmarshal repeater_status");
+        metrics::registry.rx_malformed.inc();
+      }
+      break;
+    }
+    case HrLoRa::start_at::magic: {
+      if (const auto req = HrLoRa::start_at::unmarshal(pdata, size)) {
+        if (callbacks.on_start_at.is_valid()) {
+          callbacks.on_start_at(*req, rx_us);
+        }
+      } else {
+        ESP_LOGE(TAG, "failed to unmarshal start_at");
+        metrics::registry.rx_malformed.inc();
+      }
+      break;
+    }
+    case HrLoRa::start_report::magic: {
+      if (const auto report = HrLoRa::start_report::unmarshal(pdata, size)) {
+        if (callbacks.on_start_report.is_valid()) {
+          callbacks.on_start_report(*report);
+        }
+      } else {
+        ESP_LOGE(TAG, "failed to unmarshal start_report");
+        metrics::registry.rx_malformed.inc();
       }
       break;
     }
@@ -124,6 +236,7 @@ void handle_message(uint8_t *pdata, size_t size, const handle_message_callbacks_
     }
     default: {
       ESP_LOGW(TAG, "unknown magic: %d", magic);
+      metrics::registry.rx_dropped.inc();
     }
   }
 }
@@ -131,25 +244,36 @@ void handle_message(uint8_t *pdata, size_t size, const handle_message_callbacks_
 /**
  * @brief try to transmit the data
  * @note would block until the transmission is done and will start receiving after that
+ * @return true if the data is transmitted
  */
-void try_transmit(uint8_t *data, size_t size,
+bool try_transmit(uint8_t *data, size_t size,
                   SemaphoreHandle_t lk, TickType_t timeout_tick,
                   LLCC68 &rf) {
   const auto TAG = "try_transmit";
   if (xSemaphoreTake(lk, timeout_tick) != pdTRUE) {
     ESP_LOGE(TAG, "failed to take rf_lock; no transmission happens;");
-    return;
+    metrics::registry.tx_failed.inc();
+    return false;
   }
-  if (const auto err = rf.transmit(data, size); err == RADIOLIB_ERR_NONE) {
-    // ok
+  const auto tx_start = esp_timer_get_time();
+  trace::emit(trace::event_t::TX, trace::BEGIN, size);
+  const auto err = rf.transmit(data, size);
+  trace::emit(trace::event_t::TX, trace::END, size);
+  if (err == RADIOLIB_ERR_NONE) {
+    metrics::registry.tx_packets.inc();
+    metrics::registry.tx_airtime_us.inc(static_cast<uint32_t>(esp_timer_get_time() - tx_start));
   } else if (err == RADIOLIB_ERR_TX_TIMEOUT) {
     ESP_LOGW(TAG, "tx timeout; please check the busy pin;");
   } else {
     ESP_LOGE(TAG, "failed to transmit, code %d", err);
   }
+  if (err != RADIOLIB_ERR_NONE) {
+    metrics::registry.tx_failed.inc();
+  }
   rf.standby();
   rf.startReceive();
   xSemaphoreGive(lk);
+  return err == RADIOLIB_ERR_NONE;
 }
 
 size_t try_receive(uint8_t *buf, size_t max_size,
@@ -167,26 +291,29 @@ size_t try_receive(uint8_t *buf, size_t max_size,
     xSemaphoreGive(lk);
     return 0;
   }
+  trace::emit(trace::event_t::RX, trace::BEGIN, length);
   auto err = rf.readData(buf, length);
-  std::string irq_status_str;
-  auto status = rf.getIrqStatus();
+  trace::emit(trace::event_t::RX, trace::END, length);
+  char irq_status_str[8] = {0};
+  size_t irq_status_len   = 0;
+  auto status             = rf.getIrqStatus();
   if (status & RADIOLIB_SX126X_IRQ_TIMEOUT) {
-    irq_status_str += "t";
+    irq_status_str[irq_status_len++] = 't';
   }
   if (status & RADIOLIB_SX126X_IRQ_RX_DONE) {
-    irq_status_str += "r";
+    irq_status_str[irq_status_len++] = 'r';
   }
   if (status & RADIOLIB_SX126X_IRQ_CRC_ERR) {
-    irq_status_str += "c";
+    irq_status_str[irq_status_len++] = 'c';
   }
   if (status & RADIOLIB_SX126X_IRQ_HEADER_ERR) {
-    irq_status_str += "h";
+    irq_status_str[irq_status_len++] = 'h';
   }
   if (status & RADIOLIB_SX126X_IRQ_TX_DONE) {
-    irq_status_str += "x";
+    irq_status_str[irq_status_len++] = 'x';
   }
-  if (!irq_status_str.empty()) {
-    ESP_LOGI(TAG, "flag=%s", irq_status_str.c_str());
+  if (irq_status_len != 0) {
+    DLOGI(TAG, "flag=%s", irq_status_str);
   }
   if (err != RADIOLIB_ERR_NONE) {
     ESP_LOGE(TAG, "failed to read data, code %d", err);
@@ -206,20 +333,21 @@ public:
   static constexpr auto NORMAL_REQUEST_INTERVAL = std::chrono::seconds{10};
   static constexpr auto FAST_REQUEST_INTERVAL   = std::chrono::seconds{5};
   /**
-   * @brief the callback to check if the device map is empty
+   * @brief the callback to check if the device map is empty. treated as empty if unset
    */
-  std::function<bool()> is_map_empty = []() { return true; };
+  etl::delegate<bool()> is_map_empty;
   /**
    * @brief the callback to send the status request
    */
-  std::function<void()> send_status_request = []() {};
+  etl::delegate<void()> send_status_request;
 
 private:
+  StaticTimer_t status_request_timer_buf{};
   TimerHandle_t status_request_timer         = nullptr;
   std::chrono::seconds last_request_interval = FAST_REQUEST_INTERVAL;
 
   [[nodiscard]] std::chrono::seconds get_target_request_interval() const {
-    if (is_map_empty()) {
+    if (!is_map_empty.is_valid() || is_map_empty()) {
       return FAST_REQUEST_INTERVAL;
     } else {
       return NORMAL_REQUEST_INTERVAL;
@@ -230,7 +358,7 @@ public:
   void start() {
     const auto run_timer_task = [](TimerHandle_t timer) {
       auto &self = *static_cast<StatusRequester *>(pvTimerGetTimerID(timer));
-      self.send_status_request();
+      self.send_status_request.call_if();
       const auto target_interval = std::chrono::duration_cast<std::chrono::seconds>(self.get_target_request_interval());
       const auto target_millis   = std::chrono::duration_cast<std::chrono::milliseconds>(target_interval);
       if (self.last_request_interval != target_interval) {
@@ -244,15 +372,16 @@ public:
       xTimerReset(timer, portMAX_DELAY);
     };
 
-    send_status_request();
+    send_status_request.call_if();
 
     const auto target_interval = get_target_request_interval();
     const auto target_millis   = std::chrono::duration_cast<std::chrono::milliseconds>(target_interval);
-    status_request_timer       = xTimerCreate("reqt",
-                                              target_millis.count(),
-                                              pdFALSE,
-                                              this,
-                                              run_timer_task);
+    status_request_timer       = xTimerCreateStatic("reqt",
+                                                    pdMS_TO_TICKS(target_millis.count()),
+                                                    pdFALSE,
+                                                    this,
+                                                    run_timer_task,
+                                                    &status_request_timer_buf);
     xTimerStart(status_request_timer, portMAX_DELAY);
   }
 };
@@ -264,62 +393,109 @@ extern "C" void app_main();
 
 void app_main() {
   constexpr auto TAG = "main";
-  initArduino();
-
-  Preferences pref;
-  pref.begin(PREF_RECORD_NAME, true);
-  const auto line_length   = pref.getFloat(PREF_LINE_LENGTH_NAME, DEFAULT_LINE_LENGTH.count());
-  const auto active_length = pref.getFloat(PREF_ACTIVE_LENGTH_NAME, DEFAULT_ACTIVE_LENGTH.count());
-  const auto line_LEDs_num = pref.getULong(PREF_LINE_LEDs_NUM_NAME, DEFAULT_LINE_LEDs_NUM);
-  const auto total_length  = pref.getFloat(PREF_TOTAL_LENGTH_NAME, DEFAULT_TARGET_LENGTH.count());
-  const auto color         = pref.getULong(PREF_COLOR_NAME, utils::Colors::Red);
-  const auto default_cfg   = ::lane::LaneConfig{
-        .color         = color,
-        .line_length   = lane::meter(line_length),
-        .active_length = lane::meter(active_length),
-        .finish_length = lane::meter(total_length),
-        .line_LEDs_num = line_LEDs_num,
-        .fps           = DEFAULT_FPS,
+  boot::record(boot::phase_t::STARTUP, 0, esp_timer_get_time());
+  {
+    auto _ = boot::scope_t{boot::phase_t::ARDUINO};
+    initArduino();
+  }
+  if (!defer_log::start()) {
+    ESP_LOGE(TAG, "failed to start the deferred log");
+  }
+
+  // a single blob instead of a lookup for each field
+  static auto cfg_store = config_store::Store{};
+  auto stored_cfg       = config_store::config_t{};
+  {
+    auto _     = boot::scope_t{boot::phase_t::CONFIG};
+    stored_cfg = cfg_store.load(config_store::config_t{
+        .color           = utils::Colors::Red,
+        .line_length_m   = DEFAULT_LINE_LENGTH.count(),
+        .active_length_m = DEFAULT_ACTIVE_LENGTH.count(),
+        .total_length_m  = DEFAULT_TARGET_LENGTH.count(),
+        .line_LEDs_num   = DEFAULT_LINE_LEDs_NUM,
+    });
+    ESP_ERROR_CHECK(cfg_store.begin());
+  }
+  const auto default_cfg = ::lane::LaneConfig{
+      .color         = stored_cfg.color,
+      .line_length   = lane::meter(stored_cfg.line_length_m),
+      .active_length = lane::meter(stored_cfg.active_length_m),
+      .finish_length = lane::meter(stored_cfg.total_length_m),
+      .line_LEDs_num = stored_cfg.line_LEDs_num,
+      .fps           = DEFAULT_FPS,
+  };
+
+  /********* lane initialization *********/
+  // started first, so the ready frame is shown while the radio and BLE come up
+  constexpr auto lane_task = [](void *param) {
+    auto &lane = *static_cast<lane::Lane *>(param);
+    {
+      auto _ = boot::scope_t{boot::phase_t::STRIP};
+      ESP_ERROR_CHECK(lane.begin());
+      lane.showReady();
+    }
+    lane.loop();
+    ESP_LOGE("lane", "lane loop exited");
   };
-  pref.end();
+  auto s           = strip::AdafruitPixel(default_cfg.line_LEDs_num, pin::LED, common::lanely::PIXEL_TYPE);
+  static auto lane = lane::Lane{std::make_unique<decltype(s)>(std::move(s))};
+  lane.setConfig(default_cfg);
+  lane.setStore(&cfg_store);
+  // a frame period is 100 ms at the default FPS
+  static auto write_gate = []() { lane.waitForShown(pdMS_TO_TICKS(250)); };
+  cfg_store.setWriteGate(write_gate);
+  // higher priority, and alone on the render core
+  static auto lane_task_mem = topology::static_task_t<topology::LANE>{};
+  lane_task_mem.create(lane_task, &lane);
+  /********* end of lane initialization *********/
 
   static auto hal    = EspHal(pin::SCK, pin::MISO, pin::MOSI);
   static auto module = Module(&hal, pin::NSS, pin::DIO1, pin::LoRa_RST, pin::BUSY);
-  auto *rf_lock      = xSemaphoreCreateMutex();
+  static auto rf_lock_buf = StaticSemaphore_t{};
+  static auto *rf_lock    = xSemaphoreCreateMutexStatic(&rf_lock_buf);
   if (rf_lock == nullptr) {
     ESP_LOGE("rf", "failed to create rf_lock");
     esp_restart();
   }
-  static auto rf = LLCC68(&module);
-  const auto st        = rf.begin(433.2, 500.0, 10, 7,
-                            RADIOLIB_SX126X_SYNC_WORD_PRIVATE, 22, 8, 1.6);
-  if (st != RADIOLIB_ERR_NONE) {
-    ESP_LOGE("rf", "failed, code %d", st);
-    esp_restart();
-  }
-
-  /********* recv interrupt initialization *********/
-  auto evt_grp    = xEventGroupCreate();
-  rf_receive_data = new rf_receive_data_t{.evt_grp = evt_grp};
-  rf.setPacketReceivedAction([]() {
-    const auto *data      = static_cast<rf_receive_data_t *>(rf_receive_data);
-    BaseType_t task_woken = pdFALSE;
-    if (data->evt_grp != nullptr) {
-      const auto xResult = xEventGroupSetBitsFromISR(data->evt_grp, RecvEvt, &task_woken);
-      if (xResult != pdFAIL) {
-        portYIELD_FROM_ISR(task_woken);
+  static auto rf          = LLCC68(&module);
+  static auto evt_grp_buf = StaticEventGroup_t{};
+  rf_receive_data.evt_grp = xEventGroupCreateStatic(&evt_grp_buf);
+
+  /********* radio initialization *********/
+  // the radio and BLE are independent, so they are brought up at the same time.
+  // not the task notification of main, which NimBLE uses for its blocking calls
+  static auto radio_ready_buf    = StaticSemaphore_t{};
+  static auto *radio_ready       = xSemaphoreCreateBinaryStatic(&radio_ready_buf);
+  constexpr auto radio_init_task = [](void *) {
+    {
+      auto _        = boot::scope_t{boot::phase_t::RADIO};
+      const auto st = rf.begin(433.2, 500.0, 10, 7,
+                               RADIOLIB_SX126X_SYNC_WORD_PRIVATE, 22, 8, 1.6);
+      if (st != RADIOLIB_ERR_NONE) {
+        ESP_LOGE("rf", "failed, code %d", st);
+        esp_restart();
       }
+      // attached on the radio core, which serves the interrupt
+      rf.setPacketReceivedAction(on_dio1);
     }
-  });
-  /********* end of recv interrupt initialization *********/
+    xSemaphoreGive(radio_ready);
+    task_stats::record_self();
+    vTaskDelete(nullptr);
+  };
+  static auto radio_init_task_mem = topology::static_task_t<topology::RADIO_INIT>{};
+  if (radio_init_task_mem.create(radio_init_task, nullptr) == nullptr) {
+    ESP_LOGE("rf", "failed to create the radio init task");
+    esp_restart();
+  }
+  /********* end of radio initialization *********/
 
   /********* status requester **********/
-  static auto device_map        = device_name_map_t{};
-  static auto status_requester  = StatusRequester{};
-  status_requester.is_map_empty = []() {
+  static auto device_map       = device_name_map_t{};
+  static auto status_requester = StatusRequester{};
+  static auto is_map_empty     = []() {
     return device_map.empty();
   };
-  auto send_status_request = [rf_lock]() {
+  static auto send_status_request = []() {
     const auto req = HrLoRa::query_device_by_mac::t{
         .addr = HrLoRa::query_device_by_mac::broadcast_addr};
 
@@ -331,170 +507,315 @@ void app_main() {
     }
     try_transmit(buf, sz, rf_lock, send_lk_timeout_tick, rf);
   };
+  status_requester.is_map_empty        = is_map_empty;
   status_requester.send_status_request = send_status_request;
 
   /********* recv task initialization            *********/
   static handle_message_callbacks_t handle_message_callbacks{};
-  auto recv_task = [evt_grp, rf_lock](LLCC68 &rf) {
+  /// written by the BLE host, the recv and the lane task
+  static auto start_session  = start_session_t{};
+  static auto session_mutex  = std::mutex{};
+  /// written by the lane task before `ReportEvt` is set
+  static auto pending_report = HrLoRa::start_report::t{};
+  constexpr auto recv_task   = [](void *) {
     constexpr auto TAG = "recv";
     for (;;) {
-      xEventGroupWaitBits(evt_grp, RecvEvt, pdTRUE, pdFALSE, portMAX_DELAY);
+      const auto bits  = xEventGroupWaitBits(rf_receive_data.evt_grp, RecvEvt | ReportEvt, pdTRUE, pdFALSE, portMAX_DELAY);
+      // before the report is sent, which would raise DIO1 again
+      const auto rx_us = last_dio1_us();
+      if (bits & ReportEvt) {
+        // spread the replies of the boards to avoid collision
+        constexpr auto REPORT_SLOT = std::chrono::milliseconds(150);
+        vTaskDelay(pdMS_TO_TICKS(REPORT_SLOT.count() * (pending_report.addr[5] % 8)));
+        uint8_t buf[16];
+        if (const auto sz = HrLoRa::start_report::marshal(pending_report, buf, sizeof(buf)); sz != 0) {
+          try_transmit(buf, sz, rf_lock, send_lk_timeout_tick, rf);
+        }
+        if (!(bits & RecvEvt)) {
+          continue;
+        }
+      }
       uint8_t data[255];
       const auto size = try_receive(data, sizeof(data), rf_lock, portMAX_DELAY, rf);
       if (size == 0) {
+        metrics::registry.rx_dropped.inc();
         continue;
       } else {
-        ESP_LOGI(TAG, "data=%s(%d)", utils::toHex(data, size).c_str(), size);
+        metrics::registry.rx_packets.inc();
+        DLOGI(TAG, "data=%s(%d)", defer_log::hex_t{data, size}, size);
       }
       // TODO: handle message stuff
-      handle_message(data, size, handle_message_callbacks);
-    }
-  };
-
-  struct recv_task_param_t {
-    std::function<void(LLCC68 &)> task;
-    LLCC68 *rf;
-    TaskHandle_t handle;
-    EventGroupHandle_t evt_grp;
-  };
-
-  /**
-   * a helper function to run a function on a new FreeRTOS task
-   */
-  auto run_recv_task = [](void *pvParameter) {
-    const auto param = static_cast<recv_task_param_t *>(pvParameter);
-    [[likely]] if (param->task != nullptr && param->rf != nullptr) {
-      param->task(*param->rf);
-    } else {
-      ESP_LOGW("recv task", "bad precondition");
+      handle_message(data, size, rx_us, handle_message_callbacks);
     }
-    const auto handle = param->handle;
-    delete param;
-    vTaskDelete(handle);
   };
-  static auto recv_param = recv_task_param_t{recv_task, &rf, nullptr, evt_grp};
-  xTaskCreate(run_recv_task,
-              "recv", 4096,
-              &recv_param, 1,
-              &recv_param.handle);
   /********** end of recv task initialization **********/
 
-  ESP_LOGI(TAG, "LoRa RF initiated");
-
-  /********* lane initialization *********/
-  constexpr auto lane_task = [](void *param) {
-    auto &lane = *static_cast<lane::Lane *>(param);
-    lane.loop();
-    ESP_LOGE("lane", "lane loop exited");
-  };
-  auto s           = strip::AdafruitPixel(default_cfg.line_LEDs_num, pin::LED, common::lanely::PIXEL_TYPE);
-  static auto lane = lane::Lane{std::make_unique<decltype(s)>(std::move(s))};
-  /********* end of lane initialization *********/
-
   /********* BLE initialization *********/
-  NimBLEDevice::init(BLE_NAME);
-  auto &server = *NimBLEDevice::createServer();
-  server.setCallbacks(new ServerCallbacks());
+  {
+    auto _ = boot::scope_t{boot::phase_t::BLE_STACK};
+    NimBLEDevice::init(BLE_NAME);
+  }
+  const auto ble_services_start_us = esp_timer_get_time();
+
+  auto &server                 = *NimBLEDevice::createServer();
+  static auto server_callbacks = ServerCallbacks{};
+  server.setCallbacks(&server_callbacks, false);
 
   lane.initBLE(server);
-  lane.setConfig(default_cfg);
-  ESP_ERROR_CHECK(lane.begin());
 
   auto &hr_service = *server.createService(BLE_CHAR_HR_SERVICE_UUID);
   auto &hr_char    = *hr_service.createCharacteristic(BLE_CHAR_HEARTBEAT_UUID,
                                                       NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::NOTIFY);
+  auto &white_list_char = *hr_service.createCharacteristic(BLE_CHAR_WHITE_LIST_UUID,
+                                                           NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::NOTIFY);
+  // owns the white list of the HR bands. the GATT handles of the bands are kept in NVS,
+  // so a band seen before the reboot skips the discovery too
+  static auto scan_callback       = ScanCallback{&hr_char, true};
+  static auto white_list_callback = WhiteListCallback{};
+  static auto set_list            = [](white_list::list_t list) { scan_callback.set_white_list(std::move(list)); };
+  static auto set_fixed_list      = [](const white_list::fixed_list_t &list) { scan_callback.set_white_list(list); };
+  static auto get_list            = []() -> const white_list::list_t & { return scan_callback.white_list(); };
+  static auto add_item            = [](const white_list::item_t &item) { return scan_callback.add_white_item(item); };
+  static auto remove_item         = [](const white_list::item_t &item) { return scan_callback.remove_white_item(item); };
+  static auto clear_list          = []() { scan_callback.clear_white_list(); };
+  static auto get_version         = []() { return scan_callback.white_list_version(); };
+  white_list_callback.setList      = set_list;
+  white_list_callback.setFixedList = set_fixed_list;
+  white_list_callback.getList      = get_list;
+  white_list_callback.addItem      = add_item;
+  white_list_callback.removeItem   = remove_item;
+  white_list_callback.clearList    = clear_list;
+  white_list_callback.getVersion   = get_version;
+  white_list_char.setCallbacks(&white_list_callback);
+  auto &scan = *NimBLEDevice::getScan();
+  // the repeated advertisements are skipped by `ad_dedup` instead, since the HR broadcasts change in place
+  scan.setScanCallbacks(&scan_callback, true);
+  // nothing is kept by NimBLE, every result is handled in `ScanCallback::onResult`
+  scan.setMaxResults(0);
+  scan.setActiveScan(false);
+#ifdef CONFIG_SCAN_CONTROLLER_FILTER
+  // let the controller filter the white listed bands, at the cost of the HR broadcasts of the watches
+  scan_callback.set_filter_mode(ScanFilterMode::CONTROLLER, false);
+#endif
+  hr_history::initBLE(hr_service);
   hr_service.start();
 
-  handle_message_callbacks = handle_message_callbacks_t{
-      .get_device_by_key = [](int key) -> std::optional<HrLoRa::hr_device::t> {
-        auto it = device_map.find(key);
-        if (it == device_map.end()) {
-          return std::nullopt;
-        } else {
-          if (it->second.device.has_value()) {
-            return std::make_optional(it->second.device.value());
-          } else {
-            return std::nullopt;
-          }
-        }
-      },
-      .update_device = [](repeater_t repeater) {
-        constexpr auto TAG = "update_device";
-        if (!repeater.device.has_value()){
-          ESP_LOGW(TAG, "null device");
-          return true;
-        }
-        auto repeater_addr = repeater.repeater_addr;
-        // search for the repeater's addr first
-        const auto addr_it = std::find_if(device_map.begin(), device_map.end(),
-                                    [&repeater_addr](const auto &pair) {
-                                      const auto [key, r] = pair;
-                                      return std::equal(r.repeater_addr.begin(),
-                                                        r.repeater_addr.end(),
-                                                        repeater_addr.begin());
-                                    });
-
-        if (addr_it == device_map.end()) {
-          // goto key_it since the repeater's addr is not in the map
-        } else {
-          // check if the key of the repeater is changed
-          if (repeater.key == addr_it->second.key) {
-            // same key, just update
-            addr_it->second = std::move(repeater);
-            return true;
-          } else {
-            // key mismatch, remove the old one
-            const auto &addr = addr_it->second.repeater_addr;
-            ESP_LOGI(TAG, "%s key %d (new) != %d (old)",
-                     utils::toHex(addr.data(),addr.size()).c_str(),
-                     addr_it->second.key, repeater.key);
-            device_map.erase(addr_it);
-          }
-        }
+  auto &diag_service = *server.createService(BLE_DIAG_SERVICE_UUID);
+  metrics::initBLE(diag_service);
+  trace::initBLE(diag_service);
+  diag_service.start();
 
-        const auto key_it = device_map.find(repeater.key);
-        if (key_it == device_map.end()) {
-          if (device_map.size() >= MAX_DEVICE_COUNT) {
-            ESP_LOGW(TAG, "full device map; clear it");
-            device_map.clear();
-          }
-          const auto& addr = repeater.repeater_addr;
-          const auto& dev_addr = repeater.device->addr;
-          ESP_LOGI(TAG, "new repeater addr=%s; key=%d; dev_addr=%s; dev_name=%s;",
-                   utils::toHex(addr.data(), addr.size()).c_str(),
-                   repeater.key,
-                   utils::toHex(dev_addr.data(), dev_addr.size()).c_str(),
-                   repeater.device->name.c_str());
-          device_map.insert({repeater.key, std::move(repeater)});
-          return true;
-        } else {
-          auto &addr = key_it->second.repeater_addr;
-          ESP_LOGW(TAG, "key %d is already used by %s", repeater.key,
-                   utils::toHex(addr.data(), addr.size()).c_str());
-          return false;
-        } },
-      .on_hr_data    = [&hr_char](std::string name, int hr) {
-        constexpr auto TAG = "on_hr_data";
-        ESP_LOGI(TAG, "hr=%d; name=%s", hr, name.c_str());
-        const auto ble_hr_data = ble::hr_data::t{
-            .name = std::move(name),
-            .hr = static_cast<uint8_t>(hr)
-        };
-        uint8_t buf[32] = {0};
-        const auto sz         = ble::hr_data::marshal(ble_hr_data, buf, sizeof(buf));
-        if (sz == 0) {
-          ESP_LOGE(TAG, "failed to marshal");
-          return;
+  // the delegates only refer to these, so they should be static
+  static auto get_device_by_key = [](int key) -> const known_device_t * {
+    const auto it = device_map.find(key);
+    if (it == device_map.end()) {
+      return nullptr;
+    }
+    return &it->second;
+  };
+  static auto update_device = [](const repeater_t &repeater) {
+    constexpr auto TAG = "update_device";
+    if (!repeater.device.has_value()){
+      ESP_LOGW(TAG, "null device");
+      return true;
+    }
+    const auto &dev_addr = repeater.device->addr;
+    // the name is interned once here, and the HR records only carry the key
+    auto name = std::string_view(repeater.device->name.data(), repeater.device->name.size());
+    char addr_str[HrLoRa::BLE_ADDR_SIZE * 2];
+    if (name.empty()) {
+      name = std::string_view(addr_str, utils::sprintHex(addr_str, sizeof(addr_str), dev_addr.data(), dev_addr.size()));
+    }
+    const auto device = known_device_t{
+        .repeater_addr = repeater.repeater_addr,
+        .key           = repeater.key,
+        .addr          = dev_addr,
+        .name          = name_table::table.intern(name),
+    };
+    if (device.name == name_table::INVALID) {
+      ESP_LOGW(TAG, "full name table; ignore %.*s", static_cast<int>(name.size()), name.data());
+      return true;
+    }
+    auto repeater_addr = repeater.repeater_addr;
+    // search for the repeater's addr first
+    const auto addr_it = std::find_if(device_map.begin(), device_map.end(),
+                                [&repeater_addr](const auto &pair) {
+                                  const auto &[key, r] = pair;
+                                  return std::equal(r.repeater_addr.begin(),
+                                                    r.repeater_addr.end(),
+                                                    repeater_addr.begin());
+                                });
+
+    if (addr_it == device_map.end()) {
+      // goto key_it since the repeater's addr is not in the map
+    } else {
+      // check if the key of the repeater is changed
+      if (repeater.key == addr_it->second.key) {
+        // same key, just update
+        name_table::table.release(addr_it->second.name);
+        addr_it->second = device;
+        return true;
+      } else {
+        // key mismatch, remove the old one
+        const auto &addr = addr_it->second.repeater_addr;
+        ESP_LOGI(TAG, "%s key %d (new) != %d (old)",
+                 utils::toHex(addr.data(),addr.size()).c_str(),
+                 addr_it->second.key, repeater.key);
+        name_table::table.release(addr_it->second.name);
+        device_map.erase(addr_it);
+      }
+    }
+
+    const auto key_it = device_map.find(repeater.key);
+    if (key_it == device_map.end()) {
+      if (device_map.size() >= MAX_DEVICE_COUNT) {
+        ESP_LOGW(TAG, "full device map; clear it");
+        for (const auto &[key, d] : device_map) {
+          name_table::table.release(d.name);
         }
-        hr_char.setValue(buf, sz);
-        hr_char.notify(); },
-      .rf_send       = [rf_lock](uint8_t *pdata, size_t size) { try_transmit(pdata, size, rf_lock, send_lk_timeout_tick, rf); },
+        device_map.clear();
+      }
+      const auto& addr = repeater.repeater_addr;
+      ESP_LOGI(TAG, "new repeater addr=%s; key=%d; dev_addr=%s; dev_name=%.*s;",
+               utils::toHex(addr.data(), addr.size()).c_str(),
+               repeater.key,
+               utils::toHex(dev_addr.data(), dev_addr.size()).c_str(),
+               static_cast<int>(name.size()), name.data());
+      device_map.insert({repeater.key, device});
+      return true;
+    } else {
+      auto &addr = key_it->second.repeater_addr;
+      ESP_LOGW(TAG, "key %d is already used by %s", repeater.key,
+               utils::toHex(addr.data(), addr.size()).c_str());
+      name_table::table.release(device.name);
+      return false;
+    }
+  };
+  static auto on_hr_data = [hr_char = &hr_char](name_table::handle_t handle, int hr) {
+    constexpr auto TAG = "on_hr_data";
+    const auto name    = name_table::table.view(handle);
+    DLOGI(TAG, "hr=%d; name=%s", hr, defer_log::str_t{name});
+    // kept even if the notification is skipped
+    hr_history::record(handle, static_cast<uint8_t>(hr));
+    if (!qos::admit_hr_notify()) {
+      return;
+    }
+    const auto ble_hr_data = ble::hr_data::t{
+        .name = name,
+        .hr   = static_cast<uint8_t>(hr),
+    };
+    uint8_t buf[32] = {0};
+    const auto sz   = ble::hr_data::marshal(ble_hr_data, buf, sizeof(buf));
+    if (sz == 0) {
+      ESP_LOGE(TAG, "failed to marshal");
+      return;
+    }
+    hr_char->setValue(buf, sz);
+    if (hr_char->notify()) {
+      metrics::registry.hr_notify_sent.inc();
+    } else {
+      metrics::registry.hr_notify_failed.inc();
+    }
+  };
+  static auto rf_send = [](uint8_t *pdata, size_t size) { try_transmit(pdata, size, rf_lock, send_lk_timeout_tick, rf); };
+  handle_message_callbacks.get_device_by_key = get_device_by_key;
+  handle_message_callbacks.update_device     = update_device;
+  handle_message_callbacks.on_hr_data        = on_hr_data;
+  handle_message_callbacks.rf_send           = rf_send;
+
+  /********* synchronized start *********/
+  // the end of a LoRa packet is seen by every board at the same time, so it's the time base
+  static auto on_start_at = [](const HrLoRa::start_at::t &req, int64_t rx_us) {
+    ESP_LOGI("start_at", "seq=%d; status=%d; speed=%.2f; delay=%lu ms; measure=%d;",
+             req.seq, req.status, req.speed, req.delay_ms, req.measure);
+    if (!lane::isLaneStatus(req.status)) {
+      ESP_LOGW("start_at", "bad status %d; ignored", req.status);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lk(session_mutex);
+      start_session = start_session_t{.seq = req.seq, .measure = req.measure, .initiator = false};
+    }
+    lane.startAt(static_cast<lane::LaneStatus>(req.status), req.speed, rx_us + static_cast<int64_t>(req.delay_ms) * 1000);
+  };
+  static auto on_start_report = [](const HrLoRa::start_report::t &report) {
+    auto session = start_session_t{};
+    {
+      std::lock_guard<std::mutex> lk(session_mutex);
+      if (!start_session.initiator || report.seq != start_session.seq) {
+        return;
+      }
+      start_session.min_late_us = std::min(start_session.min_late_us, report.late_us);
+      start_session.max_late_us = std::max(start_session.max_late_us, report.late_us);
+      session                   = start_session;
+    }
+    ESP_LOGI("start_report", "%s late by %ld us (%+ld us to this lane); spread=%ld us;",
+             utils::toHex(report.addr.data(), report.addr.size()).c_str(),
+             report.late_us, report.late_us - session.late_us,
+             session.max_late_us - session.min_late_us);
   };
+  handle_message_callbacks.on_start_at     = on_start_at;
+  handle_message_callbacks.on_start_report = on_start_report;
+  static auto broadcast_start = [](const ::LaneStartAt &msg) -> std::optional<int64_t> {
+    static uint8_t seq = 0;
+    const auto req     = HrLoRa::start_at::t{
+        .seq      = ++seq,
+        .status   = static_cast<uint8_t>(msg.status),
+        .speed    = static_cast<float>(msg.speed),
+        .delay_ms = msg.delay_ms,
+        .measure  = msg.measure,
+    };
+    uint8_t buf[16];
+    const auto sz = HrLoRa::start_at::marshal(req, buf, sizeof(buf));
+    if (sz == 0) {
+      ESP_LOGE("start_at", "failed to marshal");
+      return std::nullopt;
+    }
+    const auto tx_start = esp_timer_get_time();
+    if (!try_transmit(buf, sz, rf_lock, send_lk_timeout_tick, rf)) {
+      return std::nullopt;
+    }
+    {
+      std::lock_guard<std::mutex> lk(session_mutex);
+      start_session = start_session_t{.seq = req.seq, .measure = req.measure, .initiator = true};
+    }
+    // the TX done interrupt; fallback to now if it's missed
+    const auto tx_done = last_dio1_us();
+    return tx_done >= tx_start ? tx_done : esp_timer_get_time();
+  };
+  static auto on_started = [](int32_t late_us) {
+    auto session = start_session_t{};
+    {
+      std::lock_guard<std::mutex> lk(session_mutex);
+      start_session.late_us     = late_us;
+      start_session.min_late_us = late_us;
+      start_session.max_late_us = late_us;
+      session                   = start_session;
+    }
+    if (!session.measure || session.initiator) {
+      return;
+    }
+    auto &addr            = pending_report.addr;
+    const auto *self_addr = NimBLEDevice::getAddress().getNative();
+    std::copy(self_addr, self_addr + addr.size(), addr.begin());
+    pending_report.seq     = session.seq;
+    pending_report.late_us = late_us;
+    xEventGroupSetBits(rf_receive_data.evt_grp, ReportEvt);
+  };
+  lane.broadcastStartCb = broadcast_start;
+  lane.onStartedCb      = on_started;
+  /********* end of synchronized start *********/
 
   auto &ad = *NimBLEDevice::getAdvertising();
   ad.setName(BLE_NAME);
   ad.setScanResponse(false);
+  boot::record(boot::phase_t::BLE_SERVICES, ble_services_start_us, esp_timer_get_time());
 
+  // the recv task and the status requests need the radio
+  xSemaphoreTake(radio_ready, portMAX_DELAY);
+  static auto recv_task_mem = topology::static_task_t<topology::RECV>{};
+  recv_task_mem.create(recv_task, nullptr);
+  ESP_LOGI(TAG, "LoRa RF initiated");
   status_requester.start();
 
 #ifdef DEBUG_SPEED
@@ -502,14 +823,34 @@ void app_main() {
   lane.setSpeed(2);
 #endif
 
-  // higher priority
-  xTaskCreate(lane_task,
-              "lane", 8192,
-              &lane, 5,
-              nullptr);
+  bench::start_nvs_stall(lane);
+  task_stats::start(task_stats::DEFAULT_INTERVAL);
+  static auto set_fps_divider    = [](uint8_t divider) { lane.setFpsDivider(divider); };
+  static auto set_notify_divider = [](uint8_t divider) { lane.setNotifyDivider(divider); };
+  static auto queue_percent      = []() { return std::max(lane.pendingCommandsPercent(), scan_callback.pending_connects_percent()); };
+
+  const auto qos_started = qos::start(qos::hooks_t{
+      .set_fps_divider    = set_fps_divider,
+      .set_notify_divider = set_notify_divider,
+      .queue_percent      = queue_percent,
+  });
+  if (!qos_started) {
+    ESP_LOGE(TAG, "failed to start the QoS governor");
+  }
 
-  server.start();
-  NimBLEDevice::startAdvertising();
+  {
+    auto _ = boot::scope_t{boot::phase_t::ADVERTISING};
+    server.start();
+    NimBLEDevice::startAdvertising();
+    // scan for good. the filter policy and the `qos` parameters restart it when they change
+    if (!scan.start(0, false)) {
+      ESP_LOGE(TAG, "failed to start the scan");
+    }
+  }
   ESP_LOGI(TAG, "Initiated");
+  boot::report();
+  // nothing should be allocated from now on
+  heap_guard::arm(heap_guard::DEFAULT_INTERVAL);
+  task_stats::record_self();
   vTaskDelete(nullptr);
 }
@@ -0,0 +1,84 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "metrics.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <NimBLEDevice.h>
+#include "pb_encode.h"
+#include "common.h"
+
+static_assert(sizeof(::Histogram::bounds) / sizeof(uint32_t) == metrics::HISTOGRAM_BUCKETS,
+              "`Histogram.bounds` in `diag.options` should match `HISTOGRAM_BUCKETS`");
+static_assert(sizeof(::Histogram::counts) / sizeof(uint32_t) == metrics::HISTOGRAM_BUCKETS + 1,
+              "`Histogram.counts` in `diag.options` should be one more than `HISTOGRAM_BUCKETS`");
+
+namespace metrics {
+registry_t registry{};
+
+uint32_t now_ms() {
+  return static_cast<uint32_t>(esp_timer_get_time() / 1000);
+}
+
+void histogram_t::snapshot(::Histogram &out) const {
+  out.bounds_count = bounds.size();
+  for (size_t i = 0; i < bounds.size(); ++i) {
+    out.bounds[i] = bounds[i];
+  }
+  out.counts_count = counts.size();
+  for (size_t i = 0; i < counts.size(); ++i) {
+    out.counts[i] = counts[i].load(std::memory_order_relaxed);
+  }
+  out.sum = sum.load(std::memory_order_relaxed);
+  out.max = max.load(std::memory_order_relaxed);
+}
+
+void snapshot(::Metrics &out) {
+  const auto &r    = registry;
+  const auto ms    = now_ms();
+  out.uptime_ms    = ms;
+  out.frames       = r.frames.load();
+  out.frame_misses = r.frame_misses.load();
+  out.has_frame_us = true;
+  r.frame_us.snapshot(out.frame_us);
+  out.rx_packets           = r.rx_packets.load();
+  out.rx_dropped           = r.rx_dropped.load();
+  out.rx_malformed         = r.rx_malformed.load();
+  out.tx_packets           = r.tx_packets.load();
+  out.tx_failed            = r.tx_failed.load();
+  out.tx_airtime_us        = r.tx_airtime_us.load();
+  out.hr_notify_sent       = r.hr_notify_sent.load();
+  out.hr_notify_failed     = r.hr_notify_failed.load();
+  out.scan_results         = r.scan_results.load();
+  out.scan_results_per_sec = r.scan_rate.per_second(ms);
+  out.qos_level            = r.qos_level.load();
+  out.hr_notify_skipped    = r.hr_notify_skipped.load();
+  out.has_frame_jitter_us  = true;
+  r.frame_jitter_us.snapshot(out.frame_jitter_us);
+}
+
+class MetricsCharCallback final : public NimBLECharacteristicCallbacks {
+  /// only touched by the NimBLE host task
+  ::Metrics msg = Metrics_init_zero;
+  std::array<uint8_t, Metrics_size> encode_buffer{};
+
+public:
+  void onRead(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override {
+    constexpr auto TAG = "metrics::read";
+    snapshot(msg);
+    auto ostream = pb_ostream_from_buffer(encode_buffer.data(), encode_buffer.size());
+    if (const auto ok = pb_encode(&ostream, Metrics_fields, &msg); !ok) {
+      ESP_LOGE(TAG, "encode: %s", PB_GET_ERROR(&ostream));
+      return;
+    }
+    pCharacteristic->setValue(encode_buffer.data(), ostream.bytes_written);
+  }
+};
+
+void initBLE(NimBLEService &service) {
+  static auto callback = MetricsCharCallback{};
+  auto &c              = *service.createCharacteristic(common::BLE_CHAR_METRICS_UUID, NIMBLE_PROPERTY::READ);
+  c.setCallbacks(&callback);
+}
+}
@@ -0,0 +1,9 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "name_table.h"
+
+namespace name_table {
+Table table{};
+}
@@ -0,0 +1,137 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "qos.h"
+#include <algorithm>
+#include <atomic>
+#include <esp_log.h>
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <NimBLEDevice.h>
+#include "defer_log.h"
+#include "metrics.h"
+
+namespace qos {
+static constexpr auto TAG = "qos";
+
+static std::atomic<level_t> current{level_t::NORMAL};
+/// `metrics::now_ms` before which the HR records are skipped
+static std::atomic<uint32_t> next_hr_notify_ms{0};
+/// only touched by the timer task
+static hooks_t hooks_{};
+static governor_t governor{};
+static uint32_t last_frames = 0;
+static uint32_t last_misses = 0;
+static StaticTimer_t timer_buf{};
+static TimerHandle_t timer = nullptr;
+
+level_t level() {
+  return current.load(std::memory_order_relaxed);
+}
+
+bool admit_hr_notify() {
+  if (level() < level_t::SLOW_NOTIFY) {
+    return true;
+  }
+  const auto now = metrics::now_ms();
+  auto next      = next_hr_notify_ms.load(std::memory_order_relaxed);
+  // the other task wins the same slot if the exchange fails
+  if (static_cast<int32_t>(now - next) < 0 ||
+      !next_hr_notify_ms.compare_exchange_strong(next, now + HR_NOTIFY_MIN_INTERVAL.count(), std::memory_order_relaxed)) {
+    metrics::registry.hr_notify_skipped.inc();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief the scan parameters take effect on the next start, so a running scan is restarted
+ * @note 0 leaves them to the NimBLE defaults. A scan stopped by a connection picks them up
+ *       when the connect task resumes it
+ */
+static void setScanParams(uint16_t interval_ms, uint16_t window_ms) {
+  auto *scan              = NimBLEDevice::getScan();
+  const bool was_scanning = scan->isScanning();
+  if (was_scanning) {
+    scan->stop();
+  }
+  scan->setInterval(interval_ms);
+  scan->setWindow(window_ms);
+  if (was_scanning) {
+    scan->start(0, true);
+  }
+}
+
+/// only the actions whose threshold is crossed are applied
+static void apply(level_t from, level_t to) {
+  const auto crossed = [from, to](level_t threshold) {
+    return (from >= threshold) != (to >= threshold);
+  };
+  const auto on = [to](level_t threshold) {
+    return to >= threshold;
+  };
+  if (crossed(level_t::REDUCED_FPS) && hooks_.set_fps_divider.is_valid()) {
+    hooks_.set_fps_divider(on(level_t::REDUCED_FPS) ? FPS_DIVIDER : 1);
+  }
+  if (crossed(level_t::SLOW_NOTIFY) && hooks_.set_notify_divider.is_valid()) {
+    hooks_.set_notify_divider(on(level_t::SLOW_NOTIFY) ? NOTIFY_DIVIDER : 1);
+  }
+  if (crossed(level_t::SLOW_SCAN)) {
+    if (on(level_t::SLOW_SCAN)) {
+      setScanParams(SLOW_SCAN_INTERVAL_MS, SLOW_SCAN_WINDOW_MS);
+    } else {
+      setScanParams(0, 0);
+    }
+  }
+  if (crossed(level_t::QUIET_LOG)) {
+    const auto log_level = on(level_t::QUIET_LOG) ? ESP_LOG_WARN : static_cast<esp_log_level_t>(CONFIG_LOG_DEFAULT_LEVEL);
+    esp_log_level_set("*", log_level);
+    defer_log::set_level(on(level_t::QUIET_LOG) ? ESP_LOG_WARN : ESP_LOG_VERBOSE);
+  }
+}
+
+static void sample(TimerHandle_t) {
+  const auto frames = metrics::registry.frames.load();
+  const auto misses = metrics::registry.frame_misses.load();
+  auto queue        = defer_log::usage_percent();
+  if (hooks_.queue_percent.is_valid()) {
+    queue = std::max(queue, hooks_.queue_percent());
+  }
+  const auto s = sample_t{
+      .frames        = frames - last_frames,
+      .frame_misses  = misses - last_misses,
+      .queue_percent = queue,
+  };
+  last_frames = frames;
+  last_misses = misses;
+
+  const auto from = current.load(std::memory_order_relaxed);
+  const auto to   = governor.update(s);
+  if (to == from) {
+    return;
+  }
+  // the warnings are kept in `QUIET_LOG`
+  ESP_LOGW(TAG, "%s -> %s; frames=%lu; misses=%lu; queue=%d%%;",
+           levelToStr(from), levelToStr(to), s.frames, s.frame_misses, s.queue_percent);
+  apply(from, to);
+  current.store(to, std::memory_order_relaxed);
+  metrics::registry.qos_level.set(static_cast<uint32_t>(to));
+}
+
+bool start(hooks_t hooks) {
+  if (timer != nullptr) {
+    return false;
+  }
+  hooks_            = hooks;
+  last_frames       = metrics::registry.frames.load();
+  last_misses       = metrics::registry.frame_misses.load();
+  const auto period = pdMS_TO_TICKS(std::chrono::duration_cast<std::chrono::milliseconds>(SAMPLE_INTERVAL).count());
+  timer             = xTimerCreateStatic("qos", period, pdTRUE, nullptr, sample, &timer_buf);
+  if (timer == nullptr) {
+    return false;
+  }
+  return xTimerStart(timer, portMAX_DELAY) == pdPASS;
+}
+}
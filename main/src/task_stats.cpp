@@ -0,0 +1,268 @@
+//
+// Created by Kurosu Chan on 2023/11/28.
+//
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+#if CONFIG_HEAP_TASK_TRACKING
+#include <esp_heap_task_info.h>
+#endif
+#include "common.h"
+#include "task_stats.h"
+
+namespace task_stats {
+static constexpr auto TAG = "task_stats";
+
+#if configGENERATE_RUN_TIME_STATS
+struct snapshot_t {
+  std::array<TaskStatus_t, MAX_TASKS> tasks{};
+  UBaseType_t count = 0;
+  uint32_t total    = 0;
+
+  void take() {
+    count = uxTaskGetSystemState(tasks.data(), tasks.size(), &total);
+  }
+
+  [[nodiscard]] const TaskStatus_t *find(TaskHandle_t handle) const {
+    for (UBaseType_t i = 0; i < count; ++i) {
+      if (tasks[i].xHandle == handle) {
+        return &tasks[i];
+      }
+    }
+    return nullptr;
+  }
+};
+
+// too large for the stack of the reporting task
+static snapshot_t last{};
+static snapshot_t now{};
+static TickType_t period = 0;
+
+struct stack_size_t {
+  const char *name;
+  uint32_t size;
+};
+
+/// in bytes, since `StackType_t` is a byte on this target
+constexpr stack_size_t KNOWN_STACKS[] = {
+    {common::topology::LANE.name, common::topology::LANE.stack},
+    {common::topology::RADIO_INIT.name, common::topology::RADIO_INIT.stack},
+    {common::topology::RECV.name, common::topology::RECV.stack},
+    {common::topology::CONNECT.name, common::topology::CONNECT.stack},
+    {common::topology::CONFIG_STORE.name, common::topology::CONFIG_STORE.stack},
+    {common::topology::TASK_STATS.name, common::topology::TASK_STATS.stack},
+    {common::topology::DEFER_LOG.name, common::topology::DEFER_LOG.stack},
+    {common::topology::BENCH.name, common::topology::BENCH.stack},
+    {"main", CONFIG_ESP_MAIN_TASK_STACK_SIZE},
+    {"nimble_host", CONFIG_BT_NIMBLE_TASK_STACK_SIZE},
+    {"esp_timer", CONFIG_ESP_TIMER_TASK_STACK_SIZE},
+    {"Tmr Svc", CONFIG_FREERTOS_TIMER_TASK_STACK_DEPTH},
+    {"ipc0", CONFIG_ESP_IPC_TASK_STACK_SIZE},
+    {"ipc1", CONFIG_ESP_IPC_TASK_STACK_SIZE},
+    {"IDLE", CONFIG_FREERTOS_IDLE_TASK_STACKSIZE},
+};
+
+/// 0 if unknown
+static uint32_t stack_size_of(const char *name) {
+  for (const auto &s : KNOWN_STACKS) {
+    if (std::strncmp(s.name, name, configMAX_TASK_NAME_LEN) == 0) {
+      return s.size;
+    }
+  }
+  return 0;
+}
+
+/// the worst case of a task since boot. kept after the task is deleted
+struct watermark_t {
+  TaskHandle_t handle = nullptr;
+  std::array<char, configMAX_TASK_NAME_LEN> name{};
+  uint32_t min_free_stack = UINT32_MAX;
+  /// only with `CONFIG_HEAP_TASK_TRACKING`
+  uint32_t max_heap = 0;
+};
+static std::array<watermark_t, MAX_TASKS> watermarks{};
+/// guards `watermarks`, which is also updated by the tasks recording themselves
+static std::mutex watermarks_mutex{};
+
+/// should be called with `watermarks_mutex` held
+static watermark_t *watermark_of(TaskHandle_t handle, const char *name) {
+  for (auto &w : watermarks) {
+    if (w.handle == handle) {
+      return &w;
+    }
+    if (w.handle == nullptr) {
+      w.handle = handle;
+      std::strncpy(w.name.data(), name, w.name.size() - 1);
+      return &w;
+    }
+  }
+  return nullptr;
+}
+
+#if CONFIG_HEAP_TASK_TRACKING
+static std::array<heap_task_totals_t, MAX_TASKS> heap_totals{};
+static size_t heap_totals_count = 0;
+
+/// the heap (of any capability) held by each task now
+static void take_heap() {
+  auto params       = heap_task_info_params_t{};
+  params.caps[0]    = MALLOC_CAP_8BIT;
+  params.mask[0]    = MALLOC_CAP_8BIT;
+  params.totals     = heap_totals.data();
+  params.num_totals = &heap_totals_count;
+  params.max_totals = heap_totals.size();
+  heap_caps_get_per_task_info(&params);
+}
+
+static uint32_t heap_of(TaskHandle_t handle) {
+  for (size_t i = 0; i < heap_totals_count; ++i) {
+    if (heap_totals[i].task == handle) {
+      return heap_totals[i].size[0];
+    }
+  }
+  return 0;
+}
+#else
+static void take_heap() {}
+static uint32_t heap_of(TaskHandle_t) {
+  return 0;
+}
+#endif
+
+/// the heap field of the sizing report, left out if the heap isn't tracked
+static const char *heap_peak_str(const watermark_t &w, std::array<char, 32> &buf) {
+#if CONFIG_HEAP_TASK_TRACKING
+  std::snprintf(buf.data(), buf.size(), " heap peak=%lu;", w.max_heap);
+  return buf.data();
+#else
+  return "";
+#endif
+}
+
+static uint32_t recommend(uint32_t used) {
+  const auto headroom = std::max(used * STACK_HEADROOM_PERCENT / 100, MIN_STACK_HEADROOM);
+  // round up to 256 bytes
+  return (used + headroom + 0xff) & ~0xffu;
+}
+
+/// should be called with `watermarks_mutex` held
+static void update_watermark(TaskHandle_t handle, const char *name, uint32_t free_stack, uint32_t heap) {
+  if (auto *w = watermark_of(handle, name); w != nullptr) {
+    w->min_free_stack = std::min(w->min_free_stack, free_stack);
+    w->max_heap       = std::max(w->max_heap, heap);
+  }
+}
+
+/// should be called with `watermarks_mutex` held
+static void update_watermarks(const snapshot_t &snapshot) {
+  take_heap();
+  for (UBaseType_t i = 0; i < snapshot.count; ++i) {
+    const auto &t = snapshot.tasks[i];
+    update_watermark(t.xHandle, t.pcTaskName, t.usStackHighWaterMark, heap_of(t.xHandle));
+  }
+}
+
+void record_self() {
+  const auto free_stack = static_cast<uint32_t>(uxTaskGetStackHighWaterMark(nullptr));
+  std::lock_guard<std::mutex> lk(watermarks_mutex);
+  take_heap();
+  const auto handle = xTaskGetCurrentTaskHandle();
+  update_watermark(handle, pcTaskGetName(nullptr), free_stack, heap_of(handle));
+}
+
+void report_sizing() {
+  std::lock_guard<std::mutex> lk(watermarks_mutex);
+  uint32_t reclaimable = 0;
+  auto heap_buf        = std::array<char, 32>{};
+  ESP_LOGI(TAG, "sizing: heap min free=%u; largest=%u;",
+           heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  for (const auto &w : watermarks) {
+    if (w.handle == nullptr) {
+      break;
+    }
+    const auto size = stack_size_of(w.name.data());
+    if (size == 0 || w.min_free_stack > size) {
+      ESP_LOGI(TAG, "sizing: %-16s stack=?; min free=%lu;%s", w.name.data(), w.min_free_stack, heap_peak_str(w, heap_buf));
+      continue;
+    }
+    const auto used = size - w.min_free_stack;
+    const auto rec  = recommend(used);
+    if (rec < size) {
+      reclaimable += size - rec;
+    }
+    ESP_LOGI(TAG, "sizing: %-16s stack=%lu; used=%lu; recommend=%lu;%s",
+             w.name.data(), size, used, rec, heap_peak_str(w, heap_buf));
+  }
+  ESP_LOGI(TAG, "sizing: %lu bytes of stack could be reclaimed", reclaimable);
+}
+
+static void report() {
+  now.take();
+  if (now.count == 0) {
+    ESP_LOGW(TAG, "more than %d tasks", static_cast<int>(MAX_TASKS));
+    return;
+  }
+  // the run time counter is shared by the cores, so a busy core takes 100% of `elapsed`
+  const auto elapsed = now.total - last.total;
+  if (elapsed == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(watermarks_mutex);
+    update_watermarks(now);
+  }
+  for (UBaseType_t i = 0; i < now.count; ++i) {
+    const auto &t     = now.tasks[i];
+    const auto *prev  = last.find(t.xHandle);
+    const auto delta  = t.ulRunTimeCounter - (prev != nullptr ? prev->ulRunTimeCounter : 0);
+    const auto core   = xTaskGetAffinity(t.xHandle);
+    const auto share  = 100.f * static_cast<float>(delta) / static_cast<float>(elapsed);
+    const char core_c = core == tskNO_AFFINITY ? '*' : static_cast<char>('0' + core);
+    ESP_LOGI(TAG, "%-16s core=%c; prio=%u; cpu=%5.1f%%; stack free=%lu;",
+             t.pcTaskName, core_c, t.uxCurrentPriority, share, static_cast<uint32_t>(t.usStackHighWaterMark));
+  }
+  std::swap(last, now);
+}
+
+esp_err_t start(std::chrono::seconds interval) {
+  static auto task_mem       = common::topology::static_task_t<common::topology::TASK_STATS>{};
+  static TaskHandle_t handle = nullptr;
+  if (handle != nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  period = pdMS_TO_TICKS(std::chrono::duration_cast<std::chrono::milliseconds>(interval).count());
+  // the first sample is taken here, to catch the tasks that are gone before the first report
+  last.take();
+  {
+    std::lock_guard<std::mutex> lk(watermarks_mutex);
+    update_watermarks(last);
+  }
+  auto task = [](void *) {
+    for (uint32_t n = 1;; ++n) {
+      vTaskDelay(period);
+      report();
+      if (n % SIZING_EVERY == 0) {
+        report_sizing();
+      }
+    }
+  };
+  handle = task_mem.create(task, nullptr);
+  return handle != nullptr ? ESP_OK : ESP_FAIL;
+}
+#else
+esp_err_t start(std::chrono::seconds interval) {
+  ESP_LOGW(TAG, "CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS is not set");
+  return ESP_ERR_NOT_SUPPORTED;
+}
+void report_sizing() {}
+void record_self() {}
+#endif
+}
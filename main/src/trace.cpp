@@ -0,0 +1,142 @@
+//
+// Created by Kurosu Chan on 2023/11/29.
+//
+
+#include "trace.h"
+#include <cstring>
+#include <algorithm>
+#include <esp_log.h>
+#include <freertos/task.h>
+#include <NimBLEDevice.h>
+#include "common.h"
+#include "utils.h"
+
+namespace trace {
+static constexpr auto TAG = "trace";
+/// 'T' | core(1) | count(2)
+constexpr size_t FRAME_HEADER_SIZE = 4;
+constexpr uint8_t FRAME_MAGIC      = 'T';
+
+#ifdef TRACE
+std::array<ring_t, portNUM_PROCESSORS> rings{};
+std::atomic<bool> recording{true};
+
+void freeze() {
+  recording.store(false, std::memory_order_relaxed);
+  // let the writers preempted in the middle of a record finish.
+  // a record is only torn if its writer doesn't get the CPU in the meantime
+  vTaskDelay(pdMS_TO_TICKS(10));
+}
+
+void resume() {
+  for (auto &ring : rings) {
+    ring.head.store(0, std::memory_order_relaxed);
+  }
+  recording.store(true, std::memory_order_relaxed);
+}
+
+size_t read_chunk(cursor_t &cursor, uint8_t *out, size_t size) {
+  if (size < FRAME_HEADER_SIZE + sizeof(record_t)) {
+    return 0;
+  }
+  while (cursor.core < rings.size()) {
+    const auto &ring = rings[cursor.core];
+    const auto head  = ring.head.load(std::memory_order_relaxed);
+    if (!cursor.started) {
+      // the oldest record still in the ring
+      cursor.next    = head - std::min<uint32_t>(head, RING_SIZE);
+      cursor.started = true;
+    }
+    const auto count = std::min<size_t>(head - cursor.next, (size - FRAME_HEADER_SIZE) / sizeof(record_t));
+    if (count == 0) {
+      cursor.core += 1;
+      cursor.started = false;
+      continue;
+    }
+    out[0] = FRAME_MAGIC;
+    out[1] = cursor.core;
+    out[2] = count & 0xff;
+    out[3] = (count >> 8) & 0xff;
+    auto *p = out + FRAME_HEADER_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+      std::memcpy(p, &ring.records[(cursor.next + i) & (RING_SIZE - 1)], sizeof(record_t));
+      p += sizeof(record_t);
+    }
+    cursor.next += count;
+    return p - out;
+  }
+  return 0;
+}
+
+void dump_serial() {
+  freeze();
+  // 32 records a line
+  static uint8_t buf[FRAME_HEADER_SIZE + 32 * sizeof(record_t)];
+  static char hex[sizeof(buf) * 2 + 1];
+  auto cursor = cursor_t{};
+  ESP_LOGI(TAG, "begin");
+  while (const auto n = read_chunk(cursor, buf, sizeof(buf))) {
+    hex[utils::sprintHex(hex, sizeof(hex) - 1, buf, n)] = '\0';
+    ESP_LOGI(TAG, "%s", hex);
+  }
+  ESP_LOGI(TAG, "end");
+  resume();
+}
+
+class TraceCharCallback final : public NimBLECharacteristicCallbacks {
+  /// only touched by the NimBLE host task
+  cursor_t cursor{};
+  std::array<uint8_t, FRAME_HEADER_SIZE + 60 * sizeof(record_t)> buffer{};
+
+public:
+  void onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override {
+    const auto value = pCharacteristic->getValue();
+    if (value.size() == 0) {
+      return;
+    }
+    const auto command = value.data()[0];
+    switch (command) {
+      case 0x00:
+        resume();
+        break;
+      case 0x01:
+        freeze();
+        cursor = cursor_t{};
+        break;
+      case 0x02:
+        dump_serial();
+        break;
+      default:
+        ESP_LOGW(TAG, "unknown command %d", command);
+        break;
+    }
+  }
+  void onRead(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override {
+    if (recording.load(std::memory_order_relaxed)) {
+      // the rings are being written
+      pCharacteristic->setValue(buffer.data(), 0);
+      return;
+    }
+    const auto n = read_chunk(cursor, buffer.data(), buffer.size());
+    pCharacteristic->setValue(buffer.data(), n);
+  }
+};
+
+void initBLE(NimBLEService &service) {
+  static auto callback = TraceCharCallback{};
+  auto &c              = *service.createCharacteristic(common::BLE_CHAR_TRACE_UUID,
+                                                       NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::WRITE);
+  c.setCallbacks(&callback);
+}
+#else
+void freeze() {}
+void resume() {}
+size_t read_chunk(cursor_t &, uint8_t *, size_t) {
+  return 0;
+}
+void dump_serial() {
+  ESP_LOGW(TAG, "built without TRACE");
+}
+void initBLE(NimBLEService &) {}
+#endif
+}
@@ -6,6 +6,8 @@
 #include "pb_decode.h"
 #include "pb_encode.h"
 #include <functional>
+#include <algorithm>
+#include <cstring>
 
 #ifdef ESP32
 #define LOG_ERR(tag, fmt, ...) ESP_LOGE(tag, fmt, ##__VA_ARGS__)
@@ -130,6 +132,11 @@ void set_encode_white_list(::WhiteList &pb_list, list_t &list) {
   pb_list.items.arg = &list;
 }
 
+bool marshal_white_list_response(pb_ostream_t *ostream, ::WhiteListResponse &pb_response, response_t &response, uint32_t version) {
+  pb_response.version = version;
+  return marshal_white_list_response(ostream, pb_response, response);
+}
+
 bool marshal_white_list_response(pb_ostream_t *ostream, ::WhiteListResponse &pb_response, response_t &response) {
   if (std::holds_alternative<list_t>(response)) {
     pb_response.has_list = true;
@@ -164,6 +171,28 @@ struct DecodeWhiteListCallbacks {
   addr_fn addr;
 };
 
+/**
+ * @brief decode the item of `add`/`remove`, which is a single item instead of a repeated one
+ * @note `name` and `mac` share the callback in the union, so it's dispatched by the tag of the field
+ */
+void set_decode_white_item(::WhiteItem &item, DecodeWhiteListCallbacks &callbacks) {
+  item.item.name.funcs.decode = [](pb_istream_t *stream, const pb_field_iter_t *field, void **arg) {
+    auto &cbs = *static_cast<DecodeWhiteListCallbacks *>(*arg);
+    ::WhiteItem one = WhiteItem_init_zero;
+    switch (field->tag) {
+      case WhiteItem_name_tag:
+        set_decode_white_item_name(one, cbs.name);
+        return one.item.name.funcs.decode(stream, field, &one.item.name.arg);
+      case WhiteItem_mac_tag:
+        set_decode_white_item_addr(one, cbs.addr);
+        return one.item.mac.funcs.decode(stream, field, &one.item.mac.arg);
+      default:
+        return false;
+    }
+  };
+  item.item.name.arg = &callbacks;
+}
+
 void set_decode_white_list(::WhiteList &list, DecodeWhiteListCallbacks &callbacks) {
   auto white_list_decode = [](pb_istream_t *stream, const pb_field_iter_t *field, void **arg) {
     const auto TAG = "unmarshal_set_white_list_callback";
@@ -234,6 +263,29 @@ unmarshal_while_list_request(pb_istream_t *istream, ::WhiteListRequest &request)
       }
       return request_t{command};
     }
+    case WhiteListRequest_add_tag:
+    case WhiteListRequest_remove_tag: {
+      etl::optional<item_t> item{};
+      auto cbs = DecodeWhiteListCallbacks{
+          .name = [&item](auto name) {
+            item = item_t{std::move(name)};
+            return true; },
+          .addr = [&item](auto addr) {
+            item = item_t{addr};
+            return true; },
+      };
+      const bool is_add = tag == WhiteListRequest_add_tag;
+      set_decode_white_item(is_add ? request.add : request.remove, cbs);
+      auto ok = pb_decode(istream, WhiteListRequest_fields, &request);
+      if (!ok || !item.has_value()) {
+        LOG_ERR("white_list", "failed to decode %s", is_add ? "add" : "remove");
+        return etl::nullopt;
+      }
+      if (is_add) {
+        return request_t{add_t{std::move(*item)}};
+      }
+      return request_t{remove_t{std::move(*item)}};
+    }
     default:
       return etl::nullopt;
   }
@@ -267,4 +319,270 @@ unmarshal_white_list(pb_istream_t *istream, ::WhiteList &pb_list) {
   }
   return result;
 }
+
+//****************************** fixed ************************************/
+
+static bool addr_from_pb_fixed(const ::WhiteItemFixed &pb_item, Addr &out) {
+  if (pb_item.item.mac.size != BLE_MAC_ADDR_SIZE) {
+    LOG_ERR("white_list", "bad mac length %d", static_cast<int>(pb_item.item.mac.size));
+    return false;
+  }
+  std::copy(pb_item.item.mac.bytes, pb_item.item.mac.bytes + BLE_MAC_ADDR_SIZE, out.addr.begin());
+  return true;
+}
+
+static bool from_pb_fixed(const ::WhiteListFixed &pb_list, fixed_list_t &out) {
+  out.clear();
+  for (pb_size_t i = 0; i < pb_list.items_count; ++i) {
+    const auto &pb_item = pb_list.items[i];
+    switch (pb_item.which_item) {
+      case WhiteItemFixed_name_tag:
+        out.emplace_back(FixedName{pb_item.item.name});
+        break;
+      case WhiteItemFixed_mac_tag: {
+        auto addr = Addr{};
+        if (!addr_from_pb_fixed(pb_item, addr)) {
+          return false;
+        }
+        out.emplace_back(addr);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+static etl::optional<item_t> item_from_pb_fixed(const ::WhiteItemFixed &pb_item) {
+  switch (pb_item.which_item) {
+    case WhiteItemFixed_name_tag:
+      return item_t{Name{pb_item.item.name}};
+    case WhiteItemFixed_mac_tag: {
+      auto addr = Addr{};
+      if (!addr_from_pb_fixed(pb_item, addr)) {
+        return etl::nullopt;
+      }
+      return item_t{addr};
+    }
+    default:
+      return etl::nullopt;
+  }
+}
+
+etl::optional<fixed_request_t>
+unmarshal_white_list_request_fixed(pb_istream_t *istream, ::WhiteListRequestFixed &request) {
+  if (!pb_decode(istream, WhiteListRequestFixed_fields, &request)) {
+    // "array overflow" or "string overflow" is expected for a long list
+    LOG_INFO("white_list", "fixed decode: %s", PB_GET_ERROR(istream));
+    return etl::nullopt;
+  }
+  if (request.has_add || request.has_remove) {
+    const auto item = item_from_pb_fixed(request.has_add ? request.add : request.remove);
+    if (!item.has_value()) {
+      return etl::nullopt;
+    }
+    if (request.has_add) {
+      return fixed_request_t{add_t{*item}};
+    }
+    return fixed_request_t{remove_t{*item}};
+  }
+  if (!request.has_set) {
+    return fixed_request_t{request.command};
+  }
+  auto result = fixed_list_t{};
+  if (!from_pb_fixed(request.set, result)) {
+    return etl::nullopt;
+  }
+  return fixed_request_t{result};
+}
+
+etl::optional<fixed_list_t>
+unmarshal_white_list_fixed(pb_istream_t *istream, ::WhiteListFixed &pb_list) {
+  if (!pb_decode(istream, WhiteListFixed_fields, &pb_list)) {
+    LOG_INFO("white_list", "fixed decode: %s", PB_GET_ERROR(istream));
+    return etl::nullopt;
+  }
+  auto result = fixed_list_t{};
+  if (!from_pb_fixed(pb_list, result)) {
+    return etl::nullopt;
+  }
+  return result;
+}
+
+bool same_item(const item_t &a, const item_t &b) {
+  if (const auto *na = std::get_if<Name>(&a)) {
+    const auto *nb = std::get_if<Name>(&b);
+    return nb != nullptr && std::strcmp(na->name.c_str(), nb->name.c_str()) == 0;
+  }
+  const auto *aa = std::get_if<Addr>(&a);
+  const auto *ab = std::get_if<Addr>(&b);
+  return aa != nullptr && ab != nullptr && aa->addr == ab->addr;
+}
+
+item_t to_item(const fixed_item_t &item) {
+  if (const auto *name = std::get_if<FixedName>(&item)) {
+    return Name{std::string(name->name.data(), name->name.size())};
+  }
+  return std::get<Addr>(item);
+}
+
+//****************************** matcher ************************************/
+
+static bool is_regex_meta(char c) {
+  switch (c) {
+    case '.':
+    case '^':
+    case '$':
+    case '|':
+    case '(':
+    case ')':
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+    case '*':
+    case '+':
+    case '?':
+    case '\\':
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool is_quantifier(char c) {
+  return c == '*' || c == '?' || c == '{';
+}
+
+/**
+ * @brief the literal prefix every match of the regex must start with
+ * @note conservative. an empty prefix means we can't tell
+ */
+static std::string literal_prefix(const std::string &pattern) {
+  // alternation at any level would make the prefix meaningless
+  if (pattern.find('|') != std::string::npos) {
+    return {};
+  }
+  std::string prefix;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    const auto c = pattern[i];
+    if (is_regex_meta(c)) {
+      break;
+    }
+    // `T0?` only guarantees `T`
+    if (i + 1 < pattern.size() && is_quantifier(pattern[i + 1])) {
+      break;
+    }
+    prefix.push_back(c);
+  }
+  return prefix;
+}
+
+etl::optional<matcher_t::name_matcher_t> matcher_t::name_matcher_t::from(const Name &name) {
+  // the decoded name might carry the trailing 0x00
+  auto pattern = std::string(name.name.c_str());
+  if (pattern.empty()) {
+    return etl::nullopt;
+  }
+  auto m       = name_matcher_t{};
+  m.is_literal = std::none_of(pattern.begin(), pattern.end(), is_regex_meta);
+  if (!m.is_literal) {
+    m.prefix = literal_prefix(pattern);
+    m.re     = std::regex(pattern, std::regex::optimize);
+  }
+  m.pattern = std::move(pattern);
+  return m;
+}
+
+matcher_t::matcher_t(const list_t &list) {
+  for (const auto &item : list) {
+    if (const auto *addr = std::get_if<Addr>(&item)) {
+      addrs.push_back(addr->addr);
+    } else if (const auto *name = std::get_if<Name>(&item)) {
+      if (auto m = name_matcher_t::from(*name); m.has_value()) {
+        names.emplace_back(std::move(m.value()));
+      }
+    }
+  }
+  std::sort(addrs.begin(), addrs.end());
+  addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+}
+
+bool matcher_t::add(const item_t &item) {
+  if (const auto *addr = std::get_if<Addr>(&item)) {
+    // keep it sorted
+    auto it = std::lower_bound(addrs.begin(), addrs.end(), addr->addr);
+    if (it != addrs.end() && *it == addr->addr) {
+      return false;
+    }
+    addrs.insert(it, addr->addr);
+    return true;
+  }
+  if (const auto *name = std::get_if<Name>(&item)) {
+    const auto pattern = std::string_view(name->name.c_str());
+    const auto exists  = std::any_of(names.begin(), names.end(), [pattern](const auto &m) { return m.pattern == pattern; });
+    if (exists) {
+      return false;
+    }
+    auto m = name_matcher_t::from(*name);
+    if (!m.has_value()) {
+      return false;
+    }
+    names.emplace_back(std::move(m.value()));
+    return true;
+  }
+  return false;
+}
+
+bool matcher_t::remove(const item_t &item) {
+  if (const auto *addr = std::get_if<Addr>(&item)) {
+    auto it = std::lower_bound(addrs.begin(), addrs.end(), addr->addr);
+    if (it == addrs.end() || *it != addr->addr) {
+      return false;
+    }
+    addrs.erase(it);
+    return true;
+  }
+  if (const auto *name = std::get_if<Name>(&item)) {
+    const auto pattern = std::string_view(name->name.c_str());
+    auto it            = std::find_if(names.begin(), names.end(), [pattern](const auto &m) { return m.pattern == pattern; });
+    if (it == names.end()) {
+      return false;
+    }
+    names.erase(it);
+    return true;
+  }
+  return false;
+}
+
+bool matcher_t::match_addr(const uint8_t *addr) const {
+  if (addrs.empty() || addr == nullptr) {
+    return false;
+  }
+  auto key = addr_t{};
+  std::copy(addr, addr + BLE_MAC_ADDR_SIZE, key.begin());
+  return std::binary_search(addrs.begin(), addrs.end(), key);
+}
+
+bool matcher_t::match_name(std::string_view name) const {
+  if (name.empty()) {
+    return false;
+  }
+  for (const auto &m : names) {
+    if (m.is_literal) {
+      if (name == m.pattern) {
+        return true;
+      }
+      continue;
+    }
+    if (name.substr(0, m.prefix.size()) != m.prefix) {
+      continue;
+    }
+    if (std::regex_match(name.begin(), name.end(), m.re)) {
+      return true;
+    }
+  }
+  return false;
+}
 }
@@ -0,0 +1,159 @@
+//
+// Created by Kurosu Chan on 2023/11/22.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <random>
+#include "ad_parser.h"
+#include "ad_decoder.h"
+#include "simple_log.h"
+
+/**
+ * @brief fuzz and benchmark the advertisement parser with advertisements in the layout the watches use
+ * @note build with `-DAD_FUZZ_LIBFUZZER=ON` to get a libFuzzer target instead
+ */
+
+using payload_t = std::vector<uint8_t>;
+
+// flags | complete local name | watch data (see `WatchInfo`)
+// clang-format off
+static const payload_t samples[] = {
+    {0x02, 0x01, 0x06,
+     0x04, 0x09, 'Y', '0', '1',
+     0x15, 0xff, 0x17, 0x0b, 0x16, 0x0a, 0x1e, 0x03, 0xe8, 0x00, 0x30, 0x4e, 0x78, 0x50, 0x5a, 0x00, 0x00, 0x01, 0x6d, 0x00, 0x00, 0x62},
+    {0x02, 0x01, 0x06,
+     0x04, 0x09, 'Y', '1', '7',
+     0x15, 0xff, 0x17, 0x0b, 0x16, 0x0b, 0x02, 0x10, 0x01, 0x00, 0x45, 0x55, 0x7d, 0x52, 0x40, 0x00, 0x00, 0x01, 0x70, 0x00, 0x00, 0x61},
+    // shortened name, watch data cut short
+    {0x02, 0x01, 0x06,
+     0x04, 0x08, 'Y', '2', '2',
+     0x08, 0xff, 0x17, 0x0b, 0x16, 0x0b, 0x02, 0x10, 0x01},
+    // a band broadcasting Heart Rate Service data (flags=0, hr=72)
+    {0x02, 0x01, 0x06,
+     0x05, 0x16, 0x0d, 0x18, 0x00, 0x48},
+    // an unrelated device, with a length overflow at the end
+    {0x02, 0x01, 0x1a,
+     0x03, 0x03, 0x0d, 0x18,
+     0x09, 0x16, 0x0d, 0x18},
+};
+// clang-format on
+/// the HR decoded from each of `samples`, 0 for none
+static constexpr uint8_t expected_hr[] = {78, 85, 0, 72, 0};
+static_assert(std::size(expected_hr) == std::size(samples));
+
+/// stop with `what` unless `ok`. an abort is a crash for libFuzzer too
+static void expect(bool ok, const char *what) {
+  if (!ok) {
+    LOG_E("ad_fuzz", "%s", what);
+    std::abort();
+  }
+}
+
+static bool inside(ad::bytes_t field, const uint8_t *data, size_t size) {
+  return field.empty() || (field.data() >= data && field.data() + field.size() <= data + size);
+}
+
+/**
+ * @brief write the structures `reader_t` sees back, which should be the payload
+ *        up to where it stops (a zero length padding or a malformed structure)
+ */
+static void expect_round_trip(const uint8_t *data, size_t size) {
+  auto reader = ad::reader_t{ad::bytes_t(data, size)};
+  auto s      = ad::structure_t{};
+  size_t n    = 0;
+  while (reader.next(s)) {
+    expect(inside(s.value, data, size), "structure out of the payload");
+    expect(n + 2 + s.value.size() <= size, "structure longer than the payload");
+    expect(data[n] == s.value.size() + 1 && data[n + 1] == s.type &&
+               std::equal(s.value.begin(), s.value.end(), data + n + 2),
+           "structure round trip");
+    n += 2 + s.value.size();
+  }
+  expect(reader.malformed() || n == size || data[n] == 0, "structures skipped");
+}
+
+static size_t consume(const uint8_t *data, size_t size) {
+  const auto fields = ad::parse(ad::bytes_t(data, size));
+  expect(inside(fields.name, data, size) && inside(fields.manufacturer_data, data, size) &&
+             inside(fields.service_data, data, size) && inside(fields.after_name, data, size),
+         "field out of the payload");
+  expect_round_trip(data, size);
+  const auto watch_data = WatchInfo::locate(fields);
+  expect(WatchInfo::from_span(watch_data).has_value() == (watch_data.size() >= WatchInfo::SIZE_NEEDED),
+         "watch info size check");
+  const auto decoder = ad_decoder::find(fields);
+  const auto record  = decoder != nullptr ? decoder->decode(fields) : etl::nullopt;
+  // make the result observable so that it won't be optimized out
+  return fields.name.size() + (record.has_value() ? record->hr : 0) + (fields.malformed ? 1 : 0);
+}
+
+#ifdef AD_FUZZ_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  consume(data, size);
+  return 0;
+}
+#else
+int main() {
+  simple_log::init();
+  const auto TAG = "ad_fuzz";
+
+  for (size_t i = 0; i < std::size(samples); ++i) {
+    const auto &p      = samples[i];
+    const auto fields  = ad::parse(ad::bytes_t(p.data(), p.size()));
+    const auto decoder = ad_decoder::find(fields);
+    const auto record  = decoder != nullptr ? decoder->decode(fields) : etl::nullopt;
+    const auto name    = std::string(reinterpret_cast<const char *>(fields.name.data()), fields.name.size());
+    if (record.has_value()) {
+      LOG_I(TAG, "[%s] name=%s; hr=%d; steps=%d; battery=%d; malformed=%d",
+            decoder->vendor, name.c_str(), record->hr, record->steps.value_or(0), record->battery.value_or(0), fields.malformed);
+    } else {
+      LOG_I(TAG, "name=%s; no decoder or no data; malformed=%d", name.c_str(), fields.malformed);
+    }
+    expect((record.has_value() ? record->hr : 0) == expected_hr[i], "decoded HR of a sample");
+    consume(p.data(), p.size());
+  }
+
+  // every prefix shorter than the watch data is rejected
+  const auto watch_data = WatchInfo::locate(ad::parse(ad::bytes_t(samples[0].data(), samples[0].size())));
+  for (size_t n = 0; n < WatchInfo::SIZE_NEEDED; ++n) {
+    expect(!WatchInfo::from_span(watch_data.first(n)).has_value(), "short watch info");
+  }
+  expect(WatchInfo::from_span(watch_data).has_value(), "watch info");
+
+  // mutate the samples randomly. run with ASan to catch any out-of-bounds read
+  constexpr auto FUZZ_ROUNDS = 1000000;
+  auto rng                   = std::mt19937{42};
+  size_t sink                = 0;
+  for (auto i = 0; i < FUZZ_ROUNDS; ++i) {
+    auto p = samples[i % std::size(samples)];
+    switch (rng() % 3) {
+      case 0:
+        p[rng() % p.size()] = static_cast<uint8_t>(rng());
+        break;
+      case 1:
+        p.resize(rng() % (p.size() + 1));
+        break;
+      default:
+        p.push_back(static_cast<uint8_t>(rng()));
+        break;
+    }
+    // shrink to fit, so that ASan could see the exact bounds
+    p.shrink_to_fit();
+    sink += consume(p.data(), p.size());
+  }
+  LOG_I(TAG, "fuzz done; %d rounds; sink=%zu", FUZZ_ROUNDS, sink);
+
+  constexpr auto BENCH_ROUNDS = 1000000;
+  const auto start            = std::chrono::steady_clock::now();
+  for (auto i = 0; i < BENCH_ROUNDS; ++i) {
+    const auto &p = samples[i % std::size(samples)];
+    sink += consume(p.data(), p.size());
+  }
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+  LOG_I(TAG, "bench: %.1f ns per advertisement; sink=%zu",
+        static_cast<double>(elapsed.count()) / BENCH_ROUNDS, sink);
+  return 0;
+}
+#endif
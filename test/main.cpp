@@ -4,9 +4,38 @@
 #include <pb_decode.h>
 #include <pb_encode.h>
 #include <sstream>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
 #include "whitelist.h"
+#include "qos.h"
+#include "name_table.h"
+#include "hr_history.h"
+#include "frame_pacer.h"
+#include "defer_log.h"
 #include "simple_log.h"
 
+// count the heap allocations to compare the decoders
+static std::atomic<size_t> alloc_count{0};
+
+void *operator new(std::size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  if (auto *p = std::malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+  std::free(p);
+}
+
 template<typename T>
 etl::optional<T> from_pointer(T* ptr){
   if (ptr == nullptr){
@@ -16,6 +45,14 @@ etl::optional<T> from_pointer(T* ptr){
   }
 }
 
+/// stop the test with `what` unless `ok`
+static void expect(bool ok, const char *what) {
+  if (!ok) {
+    LOG_E("test", "%s", what);
+    std::exit(1);
+  }
+}
+
 int main() {
   simple_log::init();
   const auto TAG = "main";
@@ -97,7 +134,339 @@ int main() {
     }
   }
 
+  {
+    auto matcher = matcher_t{list_t{
+        item_t{Addr{{0x00, 0x01, 0x02, 0x03, 0x04, 0x05}}},
+        item_t{Name{"T03"}},
+        item_t{Name{"Y[0-9]+"}},
+    }};
+    const uint8_t known[]   = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+    const uint8_t unknown[] = {0x00, 0x01, 0x02, 0x03, 0x00, 0x00};
+    expect(matcher.match_addr(known), "matcher addr");
+    expect(!matcher.match_addr(unknown), "matcher unknown addr");
+    expect(matcher.match_name("T03"), "matcher literal");
+    expect(matcher.match_name("Y12"), "matcher regex");
+    expect(!matcher.match_name("X12"), "matcher prefix reject");
+
+    // edit in place
+    expect(matcher.add(item_t{Addr{{0x00, 0x01, 0x02, 0x03, 0x00, 0x00}}}), "matcher add");
+    expect(!matcher.add(item_t{Addr{{0x00, 0x01, 0x02, 0x03, 0x00, 0x00}}}), "matcher add again");
+    expect(matcher.remove(item_t{Name{"T03"}}), "matcher remove");
+    expect(!matcher.remove(item_t{Name{"T04"}}), "matcher remove a missing item");
+    expect(matcher.match_addr(unknown), "matcher added addr");
+    expect(!matcher.match_name("T03"), "matcher removed name");
+
+    // the controller could only take over an address only list, and drops the watches
+    expect(!controller_filterable(matcher, false), "controller filter with a name");
+    const auto addr_only = matcher_t{list_t{item_t{Addr{{0x00, 0x01, 0x02, 0x03, 0x04, 0x05}}}}};
+    expect(!controller_filterable(addr_only, true), "controller filter with the watches");
+    expect(controller_filterable(addr_only, false), "controller filter without the watches");
+    expect(!controller_filterable(matcher_t{}, false), "controller filter with an empty list");
+  }
+
+  {
+    // `add`/`remove` fall back to the dynamic decoder for a name too long for the fixed one
+    const auto long_name = std::string(MAX_FIXED_NAME_LENGTH + 1, 'A');
+    auto add_msg         = std::vector<uint8_t>{26, static_cast<uint8_t>(long_name.size() + 2), 10, static_cast<uint8_t>(long_name.size())};
+    add_msg.insert(add_msg.end(), long_name.begin(), long_name.end());
+    auto istream   = pb_istream_from_buffer(add_msg.data(), add_msg.size());
+    auto fixed_req = std::make_unique<WhiteListRequestFixed>();
+    expect(!unmarshal_white_list_request_fixed(&istream, *fixed_req).has_value(), "fixed add with a long name");
+    istream                = pb_istream_from_buffer(add_msg.data(), add_msg.size());
+    WhiteListRequest pb_rq = WhiteListRequest_init_zero;
+    const auto added       = unmarshal_while_list_request(&istream, pb_rq);
+    const auto *add        = added.has_value() ? std::get_if<add_t>(&added.value()) : nullptr;
+    expect(add != nullptr && same_item(add->item, item_t{Name{long_name}}), "dynamic add with a long name");
+
+    const uint8_t remove_msg[] = {34, 8, 18, 6, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+    istream                    = pb_istream_from_buffer(remove_msg, sizeof(remove_msg));
+    pb_rq                      = WhiteListRequest_init_zero;
+    const auto removed         = unmarshal_while_list_request(&istream, pb_rq);
+    const auto *remove         = removed.has_value() ? std::get_if<remove_t>(&removed.value()) : nullptr;
+    expect(remove != nullptr && same_item(remove->item, item_t{Addr{{0x00, 0x01, 0x02, 0x03, 0x04, 0x05}}}), "dynamic remove");
+  }
+
+  {
+    // fixed capacity decoder v.s. the callback (dynamic) one, on the same request
+    auto request_list = list_t{};
+    for (uint8_t i = 0; i < MAX_FIXED_ITEMS; ++i) {
+      if (i % 2 == 0) {
+        request_list.emplace_back(Addr{{0x00, 0x01, 0x02, 0x03, 0x04, i}});
+      } else {
+        request_list.emplace_back(Name{"T" + std::to_string(i)});
+      }
+    }
+    uint8_t list_buf[512];
+    auto list_ostream = pb_ostream_from_buffer(list_buf, sizeof(list_buf));
+    WhiteList pb_list = WhiteList_init_zero;
+    if (!marshal_white_list(&list_ostream, pb_list, request_list)) {
+      LOG_E(TAG, "bad marshal");
+      return 1;
+    }
+    uint8_t req_buf[520];
+    auto req_ostream = pb_ostream_from_buffer(req_buf, sizeof(req_buf));
+    if (!pb_encode_tag(&req_ostream, PB_WT_STRING, WhiteListRequest_set_tag) ||
+        !pb_encode_string(&req_ostream, list_buf, list_ostream.bytes_written)) {
+      LOG_E(TAG, "bad request");
+      return 1;
+    }
+    const auto req_size = req_ostream.bytes_written;
+
+    constexpr size_t ROUNDS = 100'000;
+    using clock             = std::chrono::steady_clock;
+    auto fixed_req          = std::make_unique<WhiteListRequestFixed>();
+    size_t fixed_items      = 0;
+    auto allocs_before      = alloc_count.load();
+    auto start              = clock::now();
+    for (size_t i = 0; i < ROUNDS; ++i) {
+      auto istream = pb_istream_from_buffer(req_buf, req_size);
+      auto r       = unmarshal_white_list_request_fixed(&istream, *fixed_req);
+      if (!r.has_value()) {
+        LOG_E(TAG, "bad fixed unmarshal");
+        return 1;
+      }
+      fixed_items += std::get<fixed_list_t>(*r).size();
+    }
+    const auto fixed_ns     = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    const auto fixed_allocs = alloc_count.load() - allocs_before;
+
+    size_t dynamic_items = 0;
+    allocs_before        = alloc_count.load();
+    start                = clock::now();
+    for (size_t i = 0; i < ROUNDS; ++i) {
+      auto istream           = pb_istream_from_buffer(req_buf, req_size);
+      WhiteListRequest pb_rq = WhiteListRequest_init_zero;
+      auto r                 = unmarshal_while_list_request(&istream, pb_rq);
+      if (!r.has_value()) {
+        LOG_E(TAG, "bad dynamic unmarshal");
+        return 1;
+      }
+      dynamic_items += std::get<list_t>(*r).size();
+    }
+    const auto dynamic_ns     = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    const auto dynamic_allocs = alloc_count.load() - allocs_before;
+
+    LOG_I(TAG, "request of %zu items (%zu bytes), %zu rounds", request_list.size(), req_size, ROUNDS);
+    LOG_I(TAG, "fixed:   %.1f ns/request; %.2f allocs/request; items=%zu",
+          static_cast<double>(fixed_ns) / ROUNDS, static_cast<double>(fixed_allocs) / ROUNDS, fixed_items);
+    LOG_I(TAG, "dynamic: %.1f ns/request; %.2f allocs/request; items=%zu",
+          static_cast<double>(dynamic_ns) / ROUNDS, static_cast<double>(dynamic_allocs) / ROUNDS, dynamic_items);
+
+    // one more than the capacity should be rejected by the fixed decoder
+    request_list.emplace_back(Name{"overflow"});
+    list_ostream = pb_ostream_from_buffer(list_buf, sizeof(list_buf));
+    pb_list      = WhiteList_init_zero;
+    marshal_white_list(&list_ostream, pb_list, request_list);
+    auto istream        = pb_istream_from_buffer(list_buf, list_ostream.bytes_written);
+    auto fixed_list     = std::make_unique<WhiteListFixed>();
+    expect(!unmarshal_white_list_fixed(&istream, *fixed_list).has_value(), "fixed decoder over the capacity");
+  }
+
+  {
+    // the QoS governor goes one level down per overloaded window, and one level up per `recover_windows` calm ones
+    using namespace qos;
+    auto governor         = governor_t{thresholds_t{.recover_windows = 3}};
+    const auto overloaded = sample_t{.frames = 90, .frame_misses = 10, .queue_percent = 0};
+    const auto in_between = sample_t{.frames = 99, .frame_misses = 1, .queue_percent = 0};
+    const auto calm       = sample_t{.frames = 100, .frame_misses = 0, .queue_percent = 0};
+    const auto queue_full = sample_t{.frames = 0, .frame_misses = 0, .queue_percent = 100};
+    governor.update(overloaded);
+    expect(governor.level() == level_t::REDUCED_FPS, "qos overloaded");
+    for (int i = 0; i < 10; ++i) {
+      governor.update(overloaded);
+    }
+    expect(governor.level() == MAX_LEVEL, "qos saturated");
+    governor.update(calm);
+    governor.update(calm);
+    governor.update(in_between);
+    governor.update(calm);
+    governor.update(calm);
+    expect(governor.level() == MAX_LEVEL, "qos calm streak broken");
+    governor.update(calm);
+    expect(governor.level() == level_t::SLOW_SCAN, "qos recovered one level");
+    governor.update(queue_full);
+    expect(governor.level() == MAX_LEVEL, "qos queue full");
+    for (int i = 0; i < 3 * 4; ++i) {
+      governor.update(calm);
+    }
+    expect(governor.level() == level_t::NORMAL, "qos recovered");
+    governor.update(sample_t{});
+    expect(governor.level() == level_t::NORMAL, "qos idle");
+    LOG_I(TAG, "qos governor ok");
+  }
+
+  {
+    // a name is interned once, and a handle is stable while it's held
+    using namespace name_table;
+    auto table   = std::make_unique<Table>();
+    const auto a = table->intern("Polar H10 1234");
+    const auto b = table->intern("HUAWEI WATCH GT");
+    expect(a != INVALID && b != INVALID && a != b, "name table distinct handles");
+    expect(table->intern("Polar H10 1234") == a, "name table same handle for the same name");
+    expect(table->view(b) == "HUAWEI WATCH GT", "name table view");
+    expect(table->view(INVALID).empty(), "name table invalid view");
+    const auto long_name = std::string(MAX_NAME_LENGTH + 8, 'x');
+    const auto l         = table->intern(long_name);
+    expect(table->view(l).size() == MAX_NAME_LENGTH, "name table truncated");
+    expect(table->lookup(long_name.substr(0, MAX_NAME_LENGTH)) == l, "name table truncated lookup");
+    for (size_t i = 0; table->held() < CAPACITY; ++i) {
+      expect(table->intern("band " + std::to_string(i)) != INVALID, "name table fill");
+    }
+    expect(table->intern("one more") == INVALID, "name table full");
+    expect(table->intern("Polar H10 1234") == a, "name table known name when full");
+
+    // a name is reclaimed once every holder has given it back, and found again until then
+    table->release(b);
+    expect(table->intern("HUAWEI WATCH GT") == b, "name table released name found again");
+    table->release(b);
+    expect(table->acquire(a) && !table->acquire(b), "name table acquire");
+    const auto c = table->intern("one more");
+    expect(c == b && table->view(c) == "one more", "name table reclaimed");
+    expect(table->lookup("HUAWEI WATCH GT") == INVALID, "name table reclaimed name gone");
+    expect(table->intern("HUAWEI WATCH GT") == INVALID, "name table full again");
+    LOG_I(TAG, "name table ok");
+  }
+
+  {
+    // a 2 hour session at 1 Hz fits in the ring, and the buckets decode to the averaged samples
+    using namespace hr_history;
+    auto series = std::make_unique<series_t>();
+    constexpr uint32_t START_MS = 1000;
+    const auto session_s        = static_cast<uint32_t>(std::chrono::seconds(SESSION).count());
+    auto hr_at                  = [](uint32_t s) {
+      // a slow ramp with a jump, and a pause in the middle
+      return static_cast<uint8_t>(s < 3600 ? 90 + s / 60 : 180 - (s % 7));
+    };
+    // bucket -> (sum, n)
+    auto expected_buckets = std::map<uint32_t, std::pair<uint32_t, uint32_t>>{};
+    for (uint32_t s = 0; s < session_s; ++s) {
+      if (s >= 1800 && s < 1900) {
+        continue;
+      }
+      const auto ms = START_MS + s * 1000;
+      series->add(ms, hr_at(s));
+      auto &[sum, n] = expected_buckets[ms / PERIOD_MS];
+      sum += hr_at(s);
+      n += 1;
+    }
+    const auto &st = series->stats();
+    expect(st.samples == session_s - 100, "hr history samples");
+    expect(st.min == 90 && st.max == 180, "hr history min and max");
+    uint32_t in_zones = 0;
+    for (const auto ms : st.zone_ms) {
+      in_zones += ms;
+    }
+    // every interval between the samples but the one over the pause
+    expect(in_zones == (session_s - 100 - 2) * 1000, "hr history time in zone");
+    expect(series->block(0).start_bucket == START_MS / PERIOD_MS, "hr history the whole session is kept");
+    uint32_t buckets = 0;
+    bool matched     = true;
+    for (size_t i = 0; i < series->blocks_count(); ++i) {
+      decode(series->block(i), [&](uint32_t bucket, uint8_t hr) {
+        const auto it = expected_buckets.find(bucket);
+        // the samples of a bucket are averaged
+        matched = matched && it != expected_buckets.end() && hr == (it->second.first + it->second.second / 2) / it->second.second;
+        ++buckets;
+      });
+    }
+    // the last bucket is still being averaged
+    expect(matched && buckets == expected_buckets.size() - 1, "hr history decoded buckets");
+    static uint8_t out[MAX_EXPORT_SIZE];
+    const auto size = series->serialize(out, sizeof(out));
+    expect(size > SUMMARY_SIZE && out[0] == SUMMARY_MAGIC, "hr history serialize");
+    LOG_I(TAG, "hr history: %u samples in %u buckets, %zu blocks (%zu bytes); export %zu bytes",
+          st.samples, buckets, series->blocks_count(), sizeof(series_t), size);
+
+    // a new device starts from scratch, and takes the slot of the least recently updated one when full
+    auto store = std::make_unique<store_t>();
+    for (name_table::handle_t d = 0; d < MAX_DEVICES; ++d) {
+      expect(store->add(d, START_MS + d, 100) == name_table::INVALID, "hr history new device");
+    }
+    expect(store->find(name_table::INVALID) == nullptr, "hr history invalid device");
+    expect(store->add(0, START_MS + MAX_DEVICES, 101) == name_table::INVALID, "hr history known device");
+    expect(store->find(0)->stats().samples == 2, "hr history known device samples");
+    const auto newcomer = static_cast<name_table::handle_t>(MAX_DEVICES);
+    expect(store->add(newcomer, START_MS + MAX_DEVICES + 1, 120) == 1, "hr history evict the least recent");
+    expect(store->find(1) == nullptr, "hr history evicted");
+    const auto &fresh = store->find(newcomer)->stats();
+    expect(fresh.samples == 1 && fresh.min == 120 && fresh.first_ms == START_MS + MAX_DEVICES + 1,
+           "hr history evicted slot cleared");
+    expect(store->find(newcomer)->blocks_count() == 0, "hr history evicted blocks cleared");
+    LOG_I(TAG, "hr history store ok");
+  }
+
+  {
+    // the frames skipped under load are covered by the next frame, so the distance keeps up with the clock
+    auto pacer                 = lane::pacer_t{};
+    constexpr int64_t START_US = 1'000'000;
+    constexpr int64_t PERIOD   = 100'000;
+    constexpr float SPEED      = 2.f;
+    constexpr auto FRAMES      = 100;
+    pacer.start(START_US, PERIOD);
+    float distance   = 0;
+    uint32_t skipped = 0;
+    for (auto i = 0; i < FRAMES; ++i) {
+      // what `Lane::iterate` integrates for the frame at `next_us`, from the first frame shown
+      if (i != 0) {
+        distance += SPEED * pacer.frame_s();
+      }
+      // every 10th frame takes 2.5 periods to show
+      const auto shown_us = pacer.next_us() + (i % 10 == 9 ? PERIOD * 5 / 2 : PERIOD / 10);
+      skipped += pacer.advance(shown_us);
+    }
+    const auto elapsed_s = static_cast<float>(pacer.next_us() - START_US) / 1'000'000.f;
+    // the frame being prepared would cover the rest
+    const auto expected = SPEED * (elapsed_s - pacer.frame_s());
+    expect(skipped == 2 * FRAMES / 10, "pacer skipped boundaries");
+    expect(std::abs(distance - expected) < 1e-3f, "pacer distance");
+    LOG_I(TAG, "pacer: %u boundaries skipped; %.2f m in %.2f s", skipped, distance, elapsed_s);
+  }
+
+  {
+    // a deferred log is formatted like printf, besides `str_t` and `hex_t`
+    using namespace defer_log;
+    enum class color_t : uint8_t { RED = 2 };
+    char out[MAX_MESSAGE_LEN];
+    uint8_t record[sizeof(header_t) + MAX_ARGS * (1 + MAX_HEX_LEN)];
+    auto rendered = [&](size_t out_size, const char *fmt, const auto &...args) {
+      encode(record, 0, 0, TAG, fmt, args...);
+      const auto n = render(record, record_size(args...), out, out_size);
+      return n == std::strlen(out) ? std::string_view{out} : std::string_view{"length mismatch"};
+    };
+    const uint8_t bytes[] = {0x00, 0xab, 0x0f};
+    const auto *ptr       = reinterpret_cast<const void *>(0x1234);
+    char ptr_str[32];
+    std::snprintf(ptr_str, sizeof(ptr_str), "%p", ptr);
 
+    expect(rendered(sizeof(out), "%d", int32_t{-42}) == "-42", "render i32");
+    expect(rendered(sizeof(out), "%u", uint32_t{42}) == "42", "render u32");
+    expect(rendered(sizeof(out), "%lld", int64_t{-1} << 40) == "-1099511627776", "render i64");
+    expect(rendered(sizeof(out), "%llu", uint64_t{1} << 40) == "1099511627776", "render u64");
+    expect(rendered(sizeof(out), "%.2f", 3.14159f) == "3.14", "render f64");
+    expect(rendered(sizeof(out), "%p", ptr) == ptr_str, "render ptr");
+    expect(rendered(sizeof(out), "%d", color_t::RED) == "2", "render enum");
+    expect(rendered(sizeof(out), "%s", "abc") == "abc", "render c string");
+    expect(rendered(sizeof(out), "%s", str_t{std::string_view{"hello world"}.substr(0, 5)}) == "hello", "render str_t");
+    expect(rendered(sizeof(out), "%s", hex_t{bytes, sizeof(bytes)}) == "00ab0f", "render hex_t");
+    expect(rendered(sizeof(out), "%d%%", 100) == "100%", "render percent sign");
+    expect(rendered(sizeof(out), "%d %d", 1) == "1 %d", "render missing argument");
+
+    // the width and the precision, which `hex_t` ignores
+    expect(rendered(sizeof(out), "%5d|%-5s|%05.1f|%.3s", 42, "ab", 3.14159, "abcdef") == "   42|ab   |003.1|abc", "render width and precision");
+    expect(rendered(sizeof(out), "%8s", hex_t{bytes, 1}) == "00", "render hex_t width");
+
+    // truncated
+    const auto long_str = std::string(MAX_STR_LEN + 10, 'x');
+    expect(rendered(sizeof(out), "%s", str_t{long_str}) == std::string_view{long_str}.substr(0, MAX_STR_LEN), "render long str_t");
+    expect(rendered(8, "%s", "abcdefghijkl") == "abcdefg", "render truncated str");
+    expect(rendered(8, "n=%d", 123456789) == "n=12345", "render truncated i32");
+    const uint8_t four[] = {0xaa, 0xbb, 0xcc, 0xdd};
+    expect(rendered(6, "%s", hex_t{four, sizeof(four)}) == "aabb", "render truncated hex_t");
+    expect(rendered(1, "%d", 1).empty(), "render into a single byte");
+
+    // the host fallback of `DLOGx`
+    expect(std::string_view{format("%s=%s", str_t{"addr"}, hex_t{bytes, sizeof(bytes)}).data()} == "addr=00ab0f", "format");
+  }
 
   return 0;
 }